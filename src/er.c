@@ -1,21 +1,39 @@
 #include <assert.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <libgen.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include "mpi.h"
 
 #include "kvtree.h"
 #include "kvtree_util.h"
+#include "kvtree_mpi.h"
 #include "redset.h"
 #include "shuffile.h"
+#include "rankstr_mpi.h"
 
 #include "er.h"
 #include "er_util.h"
+#include "er_progress.h"
+#include "er_stats.h"
+#include "er_trace.h"
+#include "er_pool.h"
+#include "er_io.h"
+#include "er_model.h"
+#include "er_compress.h"
+#include "er_comm.h"
 
 #define ER_DIRECTION_NULL (0)
 
@@ -32,23 +50,186 @@ typedef enum {
   ER_API_STATE_COMPLETED
 } er_api_state;
 
+/* most redundancy levels a scheme can be composed of */
+#define ER_MAX_LEVELS (2)
+
+/* structure to define a redundancy scheme object, the descriptor
+ * is shared by the scheme id and by any sets and cached descriptors
+ * that use it, and it is freed when the last of those lets go,
+ * a composed scheme has no descriptor of its own, it holds a
+ * reference to the scheme of each of its levels instead */
+typedef struct erscheme_struct {
+  redset d;
+  int refs;
+  int data_blocks;    /* number of data blocks the scheme was created with */
+  int erasure_blocks; /* number of erasure blocks the scheme was created with */
+  int type;           /* one of ER_MODEL constants */
+  int set_size;       /* number of failure domains per redundancy set */
+  int domains;        /* number of failure domains in the comm of the scheme, or procs if not counted */
+  int levels;         /* number of levels, 1 unless scheme was composed */
+  MPI_Group group;    /* group of the comm the scheme was created on, MPI_GROUP_NULL if composed */
+  struct erscheme_struct* level[ER_MAX_LEVELS]; /* schemes of each level if composed */
+} erscheme;
+
+/* scheme picked by the last call to ER_Create_Scheme_auto,
+ * reported by ER_Config */
+static int er_auto_valid = 0;
+static er_model er_auto_model;
+static int er_auto_domains = 0;
+
+/* contents of a file added with ER_Add_buffer */
+typedef struct {
+  const void* buf; /* bytes to be written to the file */
+  size_t size;     /* number of bytes in buf */
+  int valid;       /* whether file was added as a buffer */
+} erbuf;
+
 /* structure to define a set object */
 typedef struct {
   int type;
   er_api_state api_state;
   const char* name;
   int scheme_id;
-  MPI_Comm comm_world;
-  MPI_Comm comm_store;
-  kvtree* files;
+  erscheme* scheme; /* scheme used to encode, only valid if DIRECTION is ENCODE */
+  er_comm* world; /* our duplicates of comm_world, shared with other sets created on it */
+  er_comm* store; /* our duplicates of comm_store */
+  char** files;  /* paths of files in the order they were first added */
+  kvtree* index;  /* maps each path in files to its entry */
+  erbuf* bufs;    /* buffer of each file, if it was added as one */
+  int num_files;  /* number of entries in files and bufs */
+  int max_files;  /* number of entries allocated for files and bufs */
+  char* prev; /* name of predecessor set whose redundancy data may be reused, if any */
+  int compress; /* zlib level to compress files with before encoding, 0 if not compressed */
+  int delta;    /* whether to encode deltas against the files of the predecessor, if there is one */
+  char* flush_dir; /* directory to copy redundancy to after encoding, if any */
+  unsigned long verify_bw; /* bytes per second a verify may read, 0 if not limited */
+  int tier; /* ER_TIER reached by files of an encode set, protected by er_async_mutex */
   int rc;
+  int done; /* set to 1 once dispatched operation has finished */
+  kvtree* ready; /* files of a rebuild known to be intact before it has finished */
+  er_stats stats; /* time and bytes spent in each phase */
 } erset;
 
-static int er_scheme_counter = 0;
-static int er_set_counter = 0;
+/* table mapping integer ids to objects, ids are indices into the
+ * table plus one, so that lookups don't need to hash anything,
+ * ids of removed objects are handed out again */
+typedef struct {
+  void** ptrs;  /* object of each id, or NULL if id is unused */
+  int size;     /* number of entries allocated in ptrs */
+  int count;    /* number of ids in use */
+  int* unused;  /* stack of ids of removed objects */
+  int num_unused;
+} erhandles;
+
+static erhandles er_schemes;
+static erhandles er_sets;
+
+/* add object to table, returns its id */
+static int erhandles_add(erhandles* h, void* ptr)
+{
+  int id;
+  if (h->num_unused > 0) {
+    /* reuse the most recently freed id */
+    h->num_unused--;
+    id = h->unused[h->num_unused];
+  } else {
+    /* grow the table if it is full */
+    if (h->count == h->size) {
+      int size = (h->size > 0) ? 2 * h->size : 16;
+      h->ptrs   = (void**) ER_REALLOC(h->ptrs,   size * sizeof(void*));
+      h->unused = (int*)   ER_REALLOC(h->unused, size * sizeof(int));
+      h->size   = size;
+    }
+    id = h->count + 1;
+  }
+
+  h->ptrs[id - 1] = ptr;
+  if (id > h->count) {
+    h->count = id;
+  }
+  return id;
+}
+
+/* return object of given id, or NULL if id is not in use */
+static void* erhandles_get(const erhandles* h, int id)
+{
+  if (id < 1 || id > h->count) {
+    return NULL;
+  }
+  return h->ptrs[id - 1];
+}
+
+/* remove object of given id from table */
+static void erhandles_remove(erhandles* h, int id)
+{
+  if (erhandles_get(h, id) == NULL) {
+    return;
+  }
+  h->ptrs[id - 1] = NULL;
+  h->unused[h->num_unused] = id;
+  h->num_unused++;
+}
+
+/* returns number of ids in use */
+static int erhandles_used(const erhandles* h)
+{
+  return h->count - h->num_unused;
+}
+
+/* free table, all ids must have been removed */
+static void erhandles_free(erhandles* h)
+{
+  er_free(&h->ptrs);
+  er_free(&h->unused);
+  h->size       = 0;
+  h->count      = 0;
+  h->num_unused = 0;
+}
 
-static kvtree* er_schemes = NULL;
-static kvtree* er_sets = NULL;
+/* cached redundancy descriptor of an encoded set, this lets us
+ * delete the redundancy data of a set without having to recover
+ * its descriptor from the redundancy files first */
+typedef struct {
+  redset d[ER_MAX_LEVELS]; /* descriptor of each level used to encode or rebuild the set */
+  int levels;       /* number of levels in d */
+  erscheme* scheme; /* scheme that d belongs to, or NULL if we own d */
+  MPI_Group group;  /* group of comm_world that d was used on */
+  kvtree* files;    /* size and mtime of our app files at encode, or NULL */
+  unsigned long seq; /* order in which descriptors were cached */
+  long epoch;       /* agreed epoch of the state we last wrote for the set, or -1 */
+} erdesc;
+
+/* number of descriptors we keep for each group of procs, the oldest
+ * is dropped to make room for a new one, a set removed after its
+ * descriptor was dropped recovers it from the redundancy files again,
+ * and a successor of it computes its redundancy data anew */
+#define ER_MAX_CACHED_DESCS (64)
+
+/* number of sets in a row that may encode deltas against their
+ * predecessor, the next one is encoded in full, so rebuilding a set
+ * never needs the files of more than this many predecessors */
+#define ER_MAX_DELTA_DEPTH (8)
+
+
+/* maps metadata path of a set to its cached descriptor */
+static kvtree* er_descs = NULL;
+static unsigned long er_descs_seq = 0;
+
+/* maps path of a state file this process read or wrote to a copy of
+ * its contents along with the size and mtime the file had then,
+ * only used on rank 0 of a storage group, see er_state_load */
+static kvtree* er_states = NULL;
+
+/* protects scheme reference counts, which the progress thread
+ * updates when it caches descriptors */
+static pthread_mutex_t er_scheme_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* whether MPI allows us to execute dispatched operations on the progress thread */
+static int er_async = 0;
+
+/* protects the done flag and tier of sets, which the progress thread sets */
+static pthread_mutex_t er_async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  er_async_cond  = PTHREAD_COND_INITIALIZER;
 
 static erset* erset_new(int type)
 {
@@ -59,14 +240,74 @@ static erset* erset_new(int type)
   set->api_state  = ER_API_STATE_NULL;
   set->name       = NULL;
   set->scheme_id  = 0;
-  set->comm_world = MPI_COMM_NULL;
-  set->comm_store = MPI_COMM_NULL;
-  set->files      = kvtree_new();
+  set->scheme     = NULL;
+  set->world      = NULL;
+  set->store      = NULL;
+  set->files      = NULL;
+  set->index      = kvtree_new();
+  set->bufs       = NULL;
+  set->num_files  = 0;
+  set->max_files  = 0;
+  set->prev       = NULL;
+  set->compress   = 0;
+  set->delta      = 0;
+  set->flush_dir  = NULL;
+  set->verify_bw  = 0;
+  set->tier       = ER_TIER_NONE;
   set->rc         = ER_FAILURE;
+  set->done       = 0;
+  set->ready      = kvtree_new();
+  er_stats_clear(&set->stats);
 
   return set;
 }
 
+/* add a reference to a scheme */
+static void erscheme_acquire(erscheme* scheme)
+{
+  pthread_mutex_lock(&er_scheme_mutex);
+  scheme->refs++;
+  pthread_mutex_unlock(&er_scheme_mutex);
+}
+
+/* drop a reference to a scheme, frees the scheme with the last one */
+static int erscheme_release(erscheme* scheme)
+{
+  pthread_mutex_lock(&er_scheme_mutex);
+  scheme->refs--;
+  int last = (scheme->refs == 0);
+  pthread_mutex_unlock(&er_scheme_mutex);
+
+  int rc = ER_SUCCESS;
+  if (last && scheme->levels > 1) {
+    /* let go of the schemes of each level */
+    int i;
+    for (i = 0; i < scheme->levels; i++) {
+      if (erscheme_release(scheme->level[i]) != ER_SUCCESS) {
+        rc = ER_FAILURE;
+      }
+    }
+    er_free(&scheme);
+  } else if (last) {
+    MPI_Group_free(&scheme->group);
+
+    /* free reddesc */
+    if (redset_delete(&scheme->d) != REDSET_SUCCESS) {
+      /* failed to free redundancy descriptor */
+      er_err("Failed to free redundancy descriptor @ %s:%d",
+        __FILE__, __LINE__);
+      rc = ER_FAILURE;
+    }
+
+    /* TODO: what to do here if redset_delete fails? */
+
+    /* free the scheme */
+    er_free(&scheme);
+  }
+
+  return rc;
+}
+
 static void erset_delete(erset** ptr)
 {
   if (ptr != NULL) {
@@ -78,19 +319,26 @@ static void erset_delete(erset** ptr)
       er_free(&set->name);
     }
 
-    /* TODO: since we haven't dup'd these, we don't need to free them */
-    /* free communicators */
-    if (set->comm_world != MPI_COMM_NULL) {
-      //MPI_Comm_free(&set->comm_world);
-      set->comm_world = MPI_COMM_NULL;
-    }
-    if (set->comm_store != MPI_COMM_NULL) {
-      //MPI_Comm_free(&set->comm_store);
-      set->comm_store = MPI_COMM_NULL;
-    }
+    /* release communicators */
+    er_comm_release(&set->world);
+    er_comm_release(&set->store);
 
     /* free the list of files */
-    kvtree_delete(&set->files);
+    int i;
+    for (i = 0; i < set->num_files; i++) {
+      er_free(&set->files[i]);
+    }
+    er_free(&set->files);
+    kvtree_delete(&set->index);
+    er_free(&set->bufs);
+    kvtree_delete(&set->ready);
+    er_free(&set->prev);
+    er_free(&set->flush_dir);
+
+    /* let go of the scheme */
+    if (set->scheme != NULL) {
+      erscheme_release(set->scheme);
+    }
 
     /* free the object */
     er_free(ptr);
@@ -102,787 +350,3820 @@ static void erset_delete(erset** ptr)
 static erset* erset_get(int set_id)
 {
   /* lookup set id */
-  erset* setptr = NULL;
-  kvtree* set = kvtree_get_kv_int(er_sets, "SETS", set_id);
-  kvtree_util_get_ptr(set, "STRUCT", (void**)&setptr);
-  return setptr;
+  return (erset*) erhandles_get(&er_sets, set_id);
 }
 
-static redset* erscheme_get(int scheme_id)
+static erscheme* erscheme_get(int scheme_id)
 {
   /* look up entry for this scheme id */
-  redset* d = NULL;
-  kvtree* scheme = kvtree_get_kv_int(er_schemes, "SCHEMES", scheme_id);
-  kvtree_util_get_ptr(scheme, "PTR", (void**)&d);
-  return d;
+  return (erscheme*) erhandles_get(&er_schemes, scheme_id);
 }
 
-/* define the path to the er file */
-static void build_er_path(char* file, size_t len, const char* path)
+/* copy the redundancy descriptor of each level of scheme to descs,
+ * cheapest level first, returns the number of levels */
+static int erscheme_descs(const erscheme* scheme, redset* descs)
 {
-  snprintf(file, len, "%s.er", path);
-}
+  if (scheme->levels == 1) {
+    descs[0] = scheme->d;
+    return 1;
+  }
 
-/* define the path to the shuffile file */
-static void build_shuffile_path(char* file, size_t len, const char* path)
-{
-  snprintf(file, len, "%s.shuffile", path);
+  int i;
+  for (i = 0; i < scheme->levels; i++) {
+    descs[i] = scheme->level[i]->d;
+  }
+  return scheme->levels;
 }
 
-/* define the path to the redset file for the specified rank */
-static void build_redset_path(char* file, size_t len, const char* path, int rank)
+/* grow list of files of set to hold at least count more entries */
+static void erset_reserve_files(erset* set, int count)
 {
-  snprintf(file, len, "%s.", path);
+  int need = set->num_files + count;
+  if (need <= set->max_files) {
+    return;
+  }
+
+  int max = (set->max_files > 0) ? 2 * set->max_files : 16;
+  while (max < need) {
+    max *= 2;
+  }
+  set->files = (char**) ER_REALLOC(set->files, max * sizeof(char*));
+  set->bufs  = (erbuf*) ER_REALLOC(set->bufs,  max * sizeof(erbuf));
+  set->max_files = max;
 }
 
-static void er_state_write(MPI_Comm comm_world, MPI_Comm comm_store, const char* path, int state)
+/* append file to list of files of set unless it was added before,
+ * returns its buffer entry, which is cleared if file was added before
+ * so that the last call for a file decides how it is added */
+static erbuf* erset_add_file(erset* set, const char* file)
 {
-  /* get our rank in our storage group */
-  int rank_store;
-  MPI_Comm_rank(comm_store, &rank_store);
+  int i;
+  if (kvtree_util_get_int(set->index, file, &i) != KVTREE_SUCCESS) {
+    erset_reserve_files(set, 1);
+    i = set->num_files;
+    set->files[i] = strdup(file);
+    kvtree_util_set_int(set->index, file, i);
+    set->num_files++;
+  }
 
-  if (rank_store == 0) {
-    /* build name of er state file */
-    char er_file[1024];
-    build_er_path(er_file, sizeof(er_file), path);
+  set->bufs[i].buf   = NULL;
+  set->bufs[i].size  = 0;
+  set->bufs[i].valid = 0;
 
-    /* write state to file */
-    kvtree* data = kvtree_new();
-    kvtree_util_set_int(data, "STATE", state);
-    kvtree_write_file(er_file, data);
-    kvtree_delete(&data);
+  return &set->bufs[i];
+}
+
+/* drop cached descriptor for set with given metadata path, if any */
+static void erdesc_drop(const char* path)
+{
+  erdesc* desc = NULL;
+  kvtree* entry = kvtree_get_kv(er_descs, "DESC", path);
+  kvtree_util_get_ptr(entry, "PTR", (void**)&desc);
+  if (desc == NULL) {
+    return;
   }
 
-  /* wait for everyone to update state */
-  MPI_Barrier(comm_world);
+  kvtree_unset_kv(er_descs, "DESC", path);
 
-  return;
+  /* free the descriptor or let go of the scheme it belongs to */
+  if (desc->scheme != NULL) {
+    erscheme_release(desc->scheme);
+  } else {
+    int i;
+    for (i = 0; i < desc->levels; i++) {
+      redset_delete(&desc->d[i]);
+    }
+  }
+  MPI_Group_free(&desc->group);
+  kvtree_delete(&desc->files);
+  er_free(&desc);
 }
 
-static void er_state_read(MPI_Comm comm_world, MPI_Comm comm_store, const char* path, int* state)
+/* cache the descriptors d of each of levels used on comm_world for
+ * set with given metadata path, if scheme is not NULL d belongs to
+ * that scheme, otherwise the cache takes ownership of d, the cache
+ * also takes ownership of the file records in files (may be NULL),
+ * replaces any existing entry, must be called in the same order on
+ * all procs */
+static void erdesc_put(const char* path, int levels, const redset* d, erscheme* scheme, MPI_Comm comm_world, kvtree* files)
 {
-  /* intialize state to NULL */
-  *state = ER_STATE_NULL;
+  erdesc_drop(path);
+
+  /* sets that are never removed would grow the cache without bound,
+   * all procs of comm_world cached the same descriptors in the same
+   * order, so they agree on the oldest */
+  MPI_Group group;
+  MPI_Comm_group(comm_world, &group);
+  int count = 0;
+  const char* oldest = NULL;
+  unsigned long oldest_seq = 0;
+  kvtree_elem* elem;
+  for (elem = kvtree_elem_first(kvtree_get(er_descs, "DESC"));
+       elem != NULL;
+       elem = kvtree_elem_next(elem))
+  {
+    erdesc* other = NULL;
+    kvtree_util_get_ptr(kvtree_elem_hash(elem), "PTR", (void**)&other);
+    int result = MPI_UNEQUAL;
+    if (other != NULL) {
+      MPI_Group_compare(group, other->group, &result);
+    }
+    if (result == MPI_IDENT) {
+      if (oldest == NULL || other->seq < oldest_seq) {
+        oldest     = kvtree_elem_key(elem);
+        oldest_seq = other->seq;
+      }
+      count++;
+    }
+  }
+  MPI_Group_free(&group);
+  if (count >= ER_MAX_CACHED_DESCS) {
+    erdesc_drop(oldest);
+  }
 
-  /* get our rank in our storage group */
-  int rank_store;
-  MPI_Comm_rank(comm_store, &rank_store);
+  erdesc* desc = (erdesc*) ER_MALLOC(sizeof(erdesc));
+  int i;
+  for (i = 0; i < levels; i++) {
+    desc->d[i] = d[i];
+  }
+  desc->levels = levels;
+  desc->scheme = scheme;
+  if (scheme != NULL) {
+    erscheme_acquire(scheme);
+  }
+  MPI_Comm_group(comm_world, &desc->group);
+  desc->files  = files;
+  desc->seq    = er_descs_seq++;
+  desc->epoch  = -1;
 
-  if (rank_store == 0) {
-    /* build name of er state file */
-    char er_file[1024];
-    build_er_path(er_file, sizeof(er_file), path);
+  kvtree* entry = kvtree_set_kv(er_descs, "DESC", path);
+  kvtree_util_set_ptr(entry, "PTR", (void*)desc);
+}
 
-    /* read state from file */
-    kvtree* data = kvtree_new();
-    kvtree_read_file(er_file, data);
-    kvtree_util_get_int(data, "STATE", state);
-    kvtree_delete(&data);
+/* return cached descriptor for set with given metadata path if it
+ * was used on the same ranks in the same order as comm_world,
+ * returns NULL otherwise, since cache entries are created
+ * collectively, the result is the same on all procs */
+static erdesc* erdesc_get(const char* path, MPI_Comm comm_world)
+{
+  erdesc* desc = NULL;
+  kvtree* entry = kvtree_get_kv(er_descs, "DESC", path);
+  kvtree_util_get_ptr(entry, "PTR", (void**)&desc);
+  if (desc == NULL) {
+    return NULL;
   }
 
-  /* TODO: we could end up with stale state files under cases like:
-   * 1) job runs and writes file (file version 1), then dies
-   * 2) job runs on different nodes and writes file (file version 2), then dies again
-   * 3) job runs back on original nodes (some of which have v1 and some v2)
-   *
-   * right now, we're just picking the lowest rank that has some version */
+  /* comparing groups is a local operation */
+  int result;
+  MPI_Group group;
+  MPI_Comm_group(comm_world, &group);
+  MPI_Group_compare(group, desc->group, &result);
+  MPI_Group_free(&group);
+  if (result != MPI_IDENT) {
+    return NULL;
+  }
 
-  /* agree on state across processes,
-   * just go with the lowest rank who has the value */
-  int rank_world, ranks_world;
-  MPI_Comm_rank(comm_world, &rank_world);
-  MPI_Comm_size(comm_world, &ranks_world);
+  return desc;
+}
 
-  /* if we have a state value, this process is eligible */
-  int valid_rank = ranks_world;
-  if (*state != ER_STATE_NULL) {
-    valid_rank = rank_world;
-  }
+/* define the path to the er file */
+static void build_er_path(char* file, size_t len, const char* path)
+{
+  snprintf(file, len, "%s.er", path);
+}
 
-  /* compute lowest rank that has a valid value */
-  int lowest_rank;
-  MPI_Allreduce(&valid_rank, &lowest_rank, 1, MPI_INT, MPI_MIN, comm_world);
+/* define the path to the shuffile file */
+static void build_shuffile_path(char* file, size_t len, const char* path)
+{
+  snprintf(file, len, "%s.shuffile", path);
+}
 
-  /* get value from lowest rank with valid value,
-   * if there was to valid value, state still be set to ER_STATE_NULL */
-  if (lowest_rank < ranks_world) {
-    MPI_Bcast(state, 1, MPI_INT, lowest_rank, comm_world);
+/* define the path to the redset file for the specified rank,
+ * the first level of a scheme keeps the name sets had before
+ * schemes could have several levels */
+static void build_redset_path(char* file, size_t len, const char* path, int rank, int level)
+{
+  if (level == 0) {
+    snprintf(file, len, "%s.", path);
+  } else {
+    snprintf(file, len, "%s.L%d.", path, level);
   }
+}
 
-  return;
+/* define the path to the copy of file src in the flush directory dir,
+ * appends suffix to the name of the copy if it is not negative, so
+ * files shared by a storage group don't collide with those of other groups */
+static void build_flush_path(char* file, size_t len, const char* dir, const char* src, int suffix)
+{
+  char* name = strdup(src);
+  if (suffix >= 0) {
+    snprintf(file, len, "%s/%s.%d", dir, basename(name), suffix);
+  } else {
+    snprintf(file, len, "%s/%s", dir, basename(name));
+  }
+  er_free(&name);
 }
 
-int ER_Init(const char* conf_file)
+/* define the path to the compressed copy or delta of file index of the
+ * specified rank, these share the prefix of the redset files
+ * so that a remove can find them without knowing the file names */
+static void build_shadow_path(char* file, size_t len, const char* path, int rank, int index)
 {
-  /* initialize the redundancy library */
-  if (redset_init() != REDSET_SUCCESS) {
-    /* clean up and return */
-    er_err("ER_Init redset_init failed @ %s:%d",
-      __FILE__, __LINE__);
-    return ER_FAILURE;
+  snprintf(file, len, "%s.z.%d.%d", path, rank, index);
+}
+
+/* checksum of a file computed on an I/O thread */
+typedef struct {
+  const char* file;    /* path to file */
+  const erbuf* buf;    /* contents to be written, if any */
+  unsigned long size;  /* number of bytes in file */
+  unsigned long crc;   /* checksum of file */
+  int todo;            /* whether this file needs work */
+  int unlink_bad;      /* whether to delete file if it does not match */
+  unsigned long expect_size; /* recorded size of file */
+  unsigned long expect_crc;  /* recorded checksum of file */
+  int has_crc;         /* whether a checksum was recorded */
+  int check_crc;       /* whether to compare the recorded checksum */
+  er_throttle* throttle; /* limits the rate files are read at, if not NULL */
+  int match;           /* whether file matches its record */
+} erfilejob;
+
+/* computes size and checksum of file of job i */
+static int er_records_build_one(int i, void* arg)
+{
+  erfilejob* job = &((erfilejob*) arg)[i];
+  if (! job->todo) {
+    return ER_SUCCESS;
   }
 
-  /* initialize the shuffile library */
-  if (shuffile_init() != SHUFFILE_SUCCESS) {
-    /* clean up and return */
-    er_err("ER_Init shuffile_init failed @ %s:%d",
-      __FILE__, __LINE__);
-    redset_finalize();
+  uint32_t crc;
+  if (er_crc32c_file(job->file, &crc, &job->size, NULL) != ER_SUCCESS) {
+    er_err("Failed to compute checksum of %s @ %s:%d",
+      job->file, __FILE__, __LINE__);
+    job->todo = 0;
     return ER_FAILURE;
   }
-
-  /* allocate maps to track scheme and set data */
-  er_schemes = kvtree_new();
-  er_sets    = kvtree_new();
+  job->crc = (unsigned long) crc;
 
   return ER_SUCCESS;
 }
 
-int ER_Finalize(void)
+/* compute size and checksum of each file and record them in
+ * records under FILE/<file>, skips files that already have a checksum,
+ * returns ER_SUCCESS if all files could be read */
+static int er_records_build(kvtree* records, int count, const char** files)
 {
-  /* TODO: free descriptors for any outstanding schemes,
-   * probably need to do this in same order on all procs,
-   * for now, force user to clean up */
-  kvtree* schemes = kvtree_get(er_schemes, "SCHEMES");
-  if (kvtree_size(schemes) > 0) {
-    er_err("ER_Finalize called before schemes freed @ %s:%d",
-      __FILE__, __LINE__);
-    return ER_FAILURE;
+  /* files written from buffers were checksummed on the way out */
+  erfilejob* jobs = (erfilejob*) ER_MALLOC(count * sizeof(erfilejob));
+  int i;
+  for (i = 0; i < count; i++) {
+    unsigned long known;
+    kvtree* known_hash = kvtree_get_kv(records, "FILE", files[i]);
+    jobs[i].file = files[i];
+    jobs[i].todo = (kvtree_util_get_unsigned_long(known_hash, "CRC32C", &known) != KVTREE_SUCCESS);
   }
 
-  /* free outstanding sets */
-  kvtree* sets = kvtree_get(er_sets, "SETS");
-  if (kvtree_size(sets) > 0) {
-    er_err("ER_Finalize called before sets freed @ %s:%d",
-      __FILE__, __LINE__);
-    return ER_FAILURE;
+  /* read files concurrently, then record results on this thread */
+  int rc = er_io_run(count, er_records_build_one, jobs);
+
+  for (i = 0; i < count; i++) {
+    if (jobs[i].todo) {
+      kvtree* file = kvtree_set_kv(records, "FILE", files[i]);
+      kvtree_util_set_bytecount(file, "SIZE", jobs[i].size);
+      kvtree_util_set_unsigned_long(file, "CRC32C", jobs[i].crc);
+    }
   }
+  er_free(&jobs);
 
-  /* free maps */
-  kvtree_delete(&er_schemes);
-  kvtree_delete(&er_sets);
+  return rc;
+}
 
-  /* shut down shuffile library */
-  if (shuffile_finalize() != SHUFFILE_SUCCESS) {
-    er_err("ER_Finalize shuffile_finalize() failed @ %s:%d",
-      __FILE__, __LINE__);
-    return ER_FAILURE;
-  }
+/* record size and modification time of each file in records
+ * under FILE/<file>, returns ER_SUCCESS if all files exist */
+static int er_records_stat(kvtree* records, int count, const char** files)
+{
+  int rc = ER_SUCCESS;
 
-  /* shut down redundancy library */
-  if (redset_finalize() != REDSET_SUCCESS) {
-    er_err("ER_Finalize redset_finalize() failed @ %s:%d",
-       __FILE__, __LINE__);
-    return ER_FAILURE;
+  int i;
+  for (i = 0; i < count; i++) {
+    struct stat st;
+    if (stat(files[i], &st) != 0) {
+      rc = ER_FAILURE;
+      continue;
+    }
+
+    kvtree* file = kvtree_set_kv(records, "FILE", files[i]);
+    kvtree_util_set_bytecount(file, "SIZE", (unsigned long) st.st_size);
+    kvtree_util_set_unsigned_long(file, "MTIME", (unsigned long) st.st_mtim.tv_sec);
+    kvtree_util_set_unsigned_long(file, "MTIME_NSEC", (unsigned long) st.st_mtim.tv_nsec);
   }
 
-  return ER_SUCCESS;
+  return rc;
 }
 
-/** Set ER config parameters */
-static kvtree* ER_Config_Set(const kvtree* config)
+/* returns 1 if the files in cur are the same files as in base, which
+ * holds the records of a predecessor set, a file is unchanged if its
+ * size is the same and either its mtime or its checksum is the same,
+ * if CRC_ON_COPY is set, computes and adds checksums to cur as needed */
+static int er_records_same(const kvtree* base, kvtree* cur, int count, const char** files)
 {
-  kvtree* retval = (kvtree*)config;
-  assert(retval != NULL);
+  /* predecessor must have had the same list of files */
+  kvtree* base_files = kvtree_get(base, "FILE");
+  if (kvtree_size(base_files) != count) {
+    return 0;
+  }
 
-  static const char* known_options[] = {
-    ER_KEY_CONFIG_DEBUG,
-    ER_KEY_CONFIG_SET_SIZE,
-    ER_KEY_CONFIG_MPI_BUF_SIZE,
-    ER_KEY_CONFIG_CRC_ON_COPY,
-    NULL
-  };
+  int i;
+  for (i = 0; i < count; i++) {
+    kvtree* b = kvtree_get(base_files, files[i]);
+    kvtree* c = kvtree_get_kv(cur, "FILE", files[i]);
+    if (b == NULL || c == NULL) {
+      return 0;
+    }
 
-  /* read out all options we know about */
-  /* TODO: this could be turned into a list of structs */
-  kvtree_util_get_int(config, ER_KEY_CONFIG_DEBUG, &er_debug);
+    unsigned long b_size, c_size;
+    if (kvtree_util_get_bytecount(b, "SIZE", &b_size) != KVTREE_SUCCESS ||
+        kvtree_util_get_bytecount(c, "SIZE", &c_size) != KVTREE_SUCCESS ||
+        b_size != c_size)
+    {
+      return 0;
+    }
 
-  kvtree_util_get_int(config, ER_KEY_CONFIG_SET_SIZE, &er_set_size);
+    unsigned long b_sec, b_nsec, c_sec, c_nsec;
+    if (kvtree_util_get_unsigned_long(b, "MTIME",      &b_sec)  == KVTREE_SUCCESS &&
+        kvtree_util_get_unsigned_long(b, "MTIME_NSEC", &b_nsec) == KVTREE_SUCCESS &&
+        kvtree_util_get_unsigned_long(c, "MTIME",      &c_sec)  == KVTREE_SUCCESS &&
+        kvtree_util_get_unsigned_long(c, "MTIME_NSEC", &c_nsec) == KVTREE_SUCCESS &&
+        b_sec == c_sec && b_nsec == c_nsec)
+    {
+      /* not touched since the predecessor was encoded */
+      continue;
+    }
 
-  unsigned long ul;
-  if (kvtree_util_get_bytecount(config, ER_KEY_CONFIG_MPI_BUF_SIZE, &ul) ==
-      KVTREE_SUCCESS)
-  {
-    er_mpi_buf_size = (int) ul;
-    if (er_mpi_buf_size != ul) {
-      char *value;
-      kvtree_util_get_str(config, ER_KEY_CONFIG_MPI_BUF_SIZE, &value);
-      er_err("Value '%s' passed for %s exceeds int range @ %s:%d",
-        value, ER_KEY_CONFIG_MPI_BUF_SIZE, __FILE__, __LINE__
-      );
-      retval = NULL;
+    /* file was rewritten, it is still the same if its contents are,
+     * files written from buffers come with a checksum for free */
+    unsigned long b_crc, c_crc;
+    if (kvtree_util_get_unsigned_long(b, "CRC32C", &b_crc) != KVTREE_SUCCESS) {
+      return 0;
+    }
+    if (kvtree_util_get_unsigned_long(c, "CRC32C", &c_crc) != KVTREE_SUCCESS) {
+      if (! er_crc_on_copy || er_records_build(cur, 1, &files[i]) != ER_SUCCESS) {
+        return 0;
+      }
+      kvtree_util_get_unsigned_long(c, "CRC32C", &c_crc);
+    }
+    if (b_crc != c_crc) {
+      return 0;
     }
   }
-  /* TODO: handle ER_KEY_CONFIG_CRC_ON_COPY */
-
-  /* pass options to redset */
-  kvtree* redset_config_values = kvtree_new();
 
-  kvtree_util_set_int(redset_config_values,
-    REDSET_KEY_CONFIG_DEBUG, er_debug);
-
-  kvtree_util_set_int(redset_config_values,
-    REDSET_KEY_CONFIG_SET_SIZE, er_set_size);
+  return 1;
+}
 
-  kvtree_util_set_int(redset_config_values,
-    REDSET_KEY_CONFIG_MPI_BUF_SIZE, er_mpi_buf_size);
+/* copy the records of count files named in files from records into
+ * needed, along with the name of their compressed copy if they have
+ * one, returns the number of files that have no record */
+static int er_records_select(const kvtree* records, int count, char** files, kvtree* needed)
+{
+  int unknown = 0;
+  int i;
+  for (i = 0; i < count; i++) {
+    kvtree* rec = kvtree_get_kv(records, "FILE", files[i]);
+    if (rec == NULL) {
+      er_warn("No record of %s in set being rebuilt @ %s:%d",
+        files[i], __FILE__, __LINE__);
+      unknown++;
+      continue;
+    }
+    kvtree_merge(kvtree_set_kv(needed, "FILE", files[i]), rec);
 
-  if (redset_config(redset_config_values) == NULL) {
-    retval = NULL;
+    kvtree* zip = kvtree_get_kv(records, "COMPRESSED", files[i]);
+    if (zip != NULL) {
+      kvtree_merge(kvtree_set_kv(needed, "COMPRESSED", files[i]), zip);
+    }
   }
+  return unknown;
+}
 
-  kvtree_delete(&redset_config_values);
+/* checks file of job i against its record */
+static int er_records_verify_one(int i, void* arg)
+{
+  erfilejob* job = &((erfilejob*) arg)[i];
+  job->size  = 0;
+  job->match = 0;
 
-  /* pass options to shuffile */
-  kvtree* shuffile_config_values = kvtree_new();
+  /* missing files are left for redset to rebuild */
+  struct stat st;
+  if (stat(job->file, &st) != 0) {
+    return ER_FAILURE;
+  }
 
-  kvtree_util_set_int(shuffile_config_values,
-    SHUFFILE_KEY_CONFIG_MPI_BUF_SIZE, er_mpi_buf_size);
+  int match = ((unsigned long) st.st_size == job->expect_size);
 
-  kvtree_util_set_int(shuffile_config_values,
-    SHUFFILE_KEY_CONFIG_DEBUG, er_debug);
+  if (match && job->check_crc && job->has_crc) {
+    uint32_t crc;
+    int read_rc = er_crc32c_file(job->file, &crc, &job->size, job->throttle);
+    match = (read_rc == ER_SUCCESS && job->size == job->expect_size &&
+             (unsigned long) crc == job->expect_crc);
+  }
 
-  if (shuffile_config(shuffile_config_values) == NULL) {
-    retval = NULL;
+  if (! match) {
+    er_warn("Size or checksum mismatch on %s @ %s:%d",
+      job->file, __FILE__, __LINE__);
+    if (job->unlink_bad) {
+      unlink(job->file);
+    }
+    return ER_FAILURE;
   }
 
-  kvtree_delete(&shuffile_config_values);
+  job->match = 1;
+  return ER_SUCCESS;
+}
 
-  /* report all unknown options (typos?) */
-  const kvtree_elem* elem;
-  for (elem = kvtree_elem_first(config);
+/* check files listed in records against their recorded size and, if
+ * check_crc is set, their checksum, reading files at the rate allowed
+ * by throttle (may be NULL), if unlink_bad is set, delete
+ * files that don't match so that they are rebuilt from redundancy
+ * data, adds number of bytes read to bytes, if good is not NULL,
+ * adds files that match to good under FILE/<file>,
+ * returns ER_SUCCESS if all files exist and match */
+static int er_records_verify(const kvtree* records, int unlink_bad, int check_crc, er_throttle* throttle, unsigned long* bytes, kvtree* good)
+{
+  /* collect files that have a record */
+  kvtree* files = kvtree_get(records, "FILE");
+  int count = kvtree_size(files);
+  erfilejob* jobs = (erfilejob*) ER_MALLOC(count * sizeof(erfilejob));
+  int num = 0;
+  kvtree_elem* elem;
+  for (elem = kvtree_elem_first(files);
        elem != NULL;
        elem = kvtree_elem_next(elem))
   {
-    /* must be only one level deep, ie plain kev = value */
-    const kvtree* elem_hash = kvtree_elem_hash(elem);
-    assert(kvtree_size(elem_hash) == 1);
+    kvtree* file_hash = kvtree_elem_hash(elem);
+    erfilejob* job = &jobs[num];
+    if (kvtree_util_get_bytecount(file_hash, "SIZE", &job->expect_size) != KVTREE_SUCCESS) {
+      /* nothing recorded for this file */
+      continue;
+    }
+    job->file       = kvtree_elem_key(elem);
+    job->unlink_bad = unlink_bad;
+    job->check_crc  = check_crc;
+    job->throttle   = throttle;
+    job->has_crc    = (kvtree_util_get_unsigned_long(file_hash, "CRC32C", &job->expect_crc) == KVTREE_SUCCESS);
+    num++;
+  }
 
-    const kvtree* kvtree_first_elem_hash =
-      kvtree_elem_hash(kvtree_elem_first(elem_hash));
-    assert(kvtree_size(kvtree_first_elem_hash) == 0);
+  /* check files concurrently, then collect results on this thread */
+  int rc = er_io_run(num, er_records_verify_one, jobs);
 
-    /* check against known options */
-    const char** opt;
-    int found = 0;
-    for (opt = known_options; *opt != NULL; opt++) {
-      if (strcmp(*opt, kvtree_elem_key(elem)) == 0) {
-        found = 1;
+  int i;
+  for (i = 0; i < num; i++) {
+    *bytes += jobs[i].size;
+    if (jobs[i].match && good != NULL) {
+      kvtree_set_kv(good, "FILE", jobs[i].file);
+    }
+  }
+  er_free(&jobs);
+
+  return rc;
+}
+
+/* called by rank 0 of the storage group with the contents of the state
+ * file, returns 1 if the state file has records for every proc in the
+ * storage group and all of their files are present with the recorded
+ * sizes, which means no file was lost or has to be moved */
+static int er_records_intact(const kvtree* data, MPI_Comm comm_world, MPI_Comm comm_store)
+{
+  int ranks_store;
+  MPI_Comm_size(comm_store, &ranks_store);
+
+  /* get rank in comm_world of each proc in our storage group */
+  MPI_Group group_world, group_store;
+  MPI_Comm_group(comm_world, &group_world);
+  MPI_Comm_group(comm_store, &group_store);
+  int* ranks  = (int*) ER_MALLOC(ranks_store * sizeof(int));
+  int* worlds = (int*) ER_MALLOC(ranks_store * sizeof(int));
+  int i;
+  for (i = 0; i < ranks_store; i++) {
+    ranks[i] = i;
+  }
+  MPI_Group_translate_ranks(group_store, ranks_store, ranks, group_world, worlds);
+  MPI_Group_free(&group_store);
+  MPI_Group_free(&group_world);
+
+  int intact = 1;
+  for (i = 0; i < ranks_store && intact; i++) {
+    kvtree* records = kvtree_get_kv_int(data, "RANK", worlds[i]);
+    if (kvtree_size(kvtree_get(records, "FILE")) == 0) {
+      /* don't know which files this proc should have */
+      intact = 0;
+      break;
+    }
+
+    kvtree* files = kvtree_get(records, "FILE");
+    kvtree_elem* elem;
+    for (elem = kvtree_elem_first(files);
+         elem != NULL;
+         elem = kvtree_elem_next(elem))
+    {
+      unsigned long expect_size;
+      struct stat st;
+      if (kvtree_util_get_bytecount(kvtree_elem_hash(elem), "SIZE", &expect_size) != KVTREE_SUCCESS ||
+          stat(kvtree_elem_key(elem), &st) != 0 ||
+          (unsigned long) st.st_size != expect_size)
+      {
+        intact = 0;
         break;
       }
     }
-    if (! found) {
-      er_err("Unknown configuration parameter '%s' with value '%s' @ %s:%d",
-        kvtree_elem_key(elem),
-        kvtree_elem_key(kvtree_elem_first(kvtree_elem_hash(elem))),
-        __FILE__, __LINE__
-      );
-      retval = NULL;
-    }
   }
 
-  return retval;
+  er_free(&worlds);
+  er_free(&ranks);
+
+  return intact;
 }
 
-/** Get ER config parameters */
-static kvtree* ER_Config_Get(void)
+
+/* collect file records from all procs in the storage group on its
+ * rank 0 under RANK/<rank in comm_world>, returns the collected records
+ * on rank 0 and NULL on all other procs */
+static kvtree* er_records_gather(MPI_Comm comm_world, MPI_Comm comm_store, const kvtree* records)
 {
-  kvtree* retval = kvtree_new();
-  assert(retval != NULL);
+  int rank_world, rank_store;
+  MPI_Comm_rank(comm_world, &rank_world);
+  MPI_Comm_rank(comm_store, &rank_store);
 
-  int success = 1;
+  /* send our records to rank 0 of our storage group */
+  kvtree* send = kvtree_new();
+  kvtree* mine = kvtree_set(send, "0", kvtree_new());
+  kvtree* rank_hash = kvtree_set_kv_int(mine, "RANK", rank_world);
+  kvtree_merge(rank_hash, records);
+
+  kvtree* recv = kvtree_new();
+  double trace_start = ER_TRACE_BEGIN();
+  kvtree_exchange(send, recv, comm_store);
+  ER_TRACE_END(ER_TRACE_COLL, "er_records_gather", trace_start, 0);
+  kvtree_delete(&send);
+
+  if (rank_store != 0) {
+    kvtree_delete(&recv);
+    return NULL;
+  }
 
-  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_DEBUG, er_debug) !=
-    KVTREE_SUCCESS)
+  /* merge records from all procs into one tree */
+  kvtree* all = kvtree_new();
+  kvtree_elem* elem;
+  for (elem = kvtree_elem_first(recv);
+       elem != NULL;
+       elem = kvtree_elem_next(elem))
   {
-    success = 0;
+    kvtree_merge(all, kvtree_elem_hash(elem));
   }
+  kvtree_delete(&recv);
 
-  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_SET_SIZE, er_set_size) !=
-    KVTREE_SUCCESS)
+  return all;
+}
+
+/* given the contents of a state file read by rank 0 of each storage
+ * group (NULL on other procs), deliver to each proc the file records
+ * stored for its rank in comm_world, returns a new tree on all procs */
+static kvtree* er_records_scatter(MPI_Comm comm_world, const kvtree* data)
+{
+  /* send each rank the records we hold for it */
+  kvtree* send = kvtree_new();
+  kvtree* ranks = kvtree_get(data, "RANK");
+  kvtree_elem* elem;
+  for (elem = kvtree_elem_first(ranks);
+       elem != NULL;
+       elem = kvtree_elem_next(elem))
   {
-    success = 0;
+    const char* rank = kvtree_elem_key(elem);
+    kvtree* dest = kvtree_set(send, rank, kvtree_new());
+    kvtree_merge(dest, kvtree_elem_hash(elem));
   }
 
-  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_MPI_BUF_SIZE,
-    er_mpi_buf_size) != KVTREE_SUCCESS)
+  kvtree* recv = kvtree_new();
+  double trace_start = ER_TRACE_BEGIN();
+  kvtree_exchange(send, recv, comm_world);
+  ER_TRACE_END(ER_TRACE_COLL, "er_records_scatter", trace_start, 0);
+  kvtree_delete(&send);
+
+  /* merge what we got, normally only one storage group has our records */
+  kvtree* records = kvtree_new();
+  for (elem = kvtree_elem_first(recv);
+       elem != NULL;
+       elem = kvtree_elem_next(elem))
   {
-    success = 0;
+    kvtree_merge(records, kvtree_elem_hash(elem));
   }
+  kvtree_delete(&recv);
 
-  if (!success) {
-    kvtree_delete(&retval);
+  return records;
+}
+
+/* remember contents of state file, which we just read or wrote */
+static void er_state_cache(const char* file, const kvtree* data)
+{
+  struct stat st;
+  if (stat(file, &st) != 0) {
+    kvtree_unset_kv(er_states, "FILE", file);
+    return;
   }
 
-  return retval;
+  kvtree* entry = kvtree_set_kv(er_states, "FILE", file);
+  kvtree_unset_all(entry);
+  kvtree_util_set_bytecount(entry, "SIZE", (unsigned long) st.st_size);
+  kvtree_util_set_unsigned_long(entry, "MTIME", (unsigned long) st.st_mtime);
+  kvtree_util_set_unsigned_long(entry, "MTIME_NSEC", (unsigned long) st.st_mtim.tv_nsec);
+  kvtree_merge(kvtree_set(entry, "DATA", kvtree_new()), data);
 }
 
-/** Get / Set ER config parameters */
-kvtree* ER_Config(const kvtree* config)
+/* read contents of state file into data, uses our cached copy
+ * instead of parsing the file again if the file has not changed
+ * since we last read or wrote it */
+static void er_state_load(const char* file, kvtree* data)
 {
-  if (config != NULL) {
-    return ER_Config_Set(config);
-  } else {
-    return ER_Config_Get();
+  struct stat st;
+  if (stat(file, &st) != 0) {
+    kvtree_unset_kv(er_states, "FILE", file);
+    return;
   }
-  return NULL; /* NOTREACHED */
+
+  unsigned long size, mtime, nsec;
+  kvtree* entry = kvtree_get_kv(er_states, "FILE", file);
+  if (entry != NULL &&
+      kvtree_util_get_bytecount(entry, "SIZE", &size) == KVTREE_SUCCESS &&
+      kvtree_util_get_unsigned_long(entry, "MTIME", &mtime) == KVTREE_SUCCESS &&
+      kvtree_util_get_unsigned_long(entry, "MTIME_NSEC", &nsec) == KVTREE_SUCCESS &&
+      size  == (unsigned long) st.st_size &&
+      mtime == (unsigned long) st.st_mtime &&
+      nsec  == (unsigned long) st.st_mtim.tv_nsec)
+  {
+    kvtree_merge(data, kvtree_get(entry, "DATA"));
+    return;
+  }
+
+  kvtree_read_file(file, data);
+  er_state_cache(file, data);
 }
 
-int ER_Create_Scheme(
-  MPI_Comm comm,
-  const char* failure_domain,
-  int data_blocks,
-  int erasure_blocks)
+/* record scheme metadata in data under SCHEME, which a rebuild
+ * uses to reject state written for a different set of procs,
+ * and rebuild and remove use to find every level of redundancy
+ * and whether there are compressed copies or deltas of files to delete,
+ * as remove does with the directory the set is flushed to (may be NULL) */
+static void er_state_scheme(kvtree* data, MPI_Comm comm_world, const erscheme* scheme, int compress, int delta, const char* flush_dir)
 {
-  if (comm == MPI_COMM_NULL) {
-    er_err("ER_Create_scheme comm parameter is MPI_COMM_NULL @ %s:%d",
-      __FILE__, __LINE__);
-    return -1;
+  int ranks;
+  MPI_Comm_size(comm_world, &ranks);
+
+  kvtree* meta = kvtree_set(data, "SCHEME", kvtree_new());
+  kvtree_util_set_int(meta, "RANKS", ranks);
+  if (scheme != NULL) {
+    kvtree_util_set_int(meta, "LEVELS", scheme->levels);
+  }
+  if (compress) {
+    kvtree_util_set_int(meta, "COMPRESS", compress);
+  }
+  if (delta) {
+    kvtree_util_set_int(meta, "DELTA", delta);
   }
+  if (flush_dir != NULL) {
+    kvtree_util_set_str(meta, "FLUSH_DIR", flush_dir);
+  }
+}
 
-  if (failure_domain == NULL) {
-    er_err("ER_Create_scheme failure_domain parameter is null @ %s:%d",
-      __FILE__, __LINE__);
-    return -1;
+/* get the number of redundancy levels of a set from the scheme
+ * metadata written by er_state_scheme, which only rank 0 of each
+ * storage group holds (NULL elsewhere), sets encoded before schemes
+ * had levels have one, collective over comm_world */
+static int er_state_levels(MPI_Comm comm_world, const kvtree* data)
+{
+  int levels = 1;
+  if (data != NULL) {
+    kvtree_util_get_int(kvtree_get(data, "SCHEME"), "LEVELS", &levels);
   }
 
-  /* check that we can support the scheme the caller is asking for */
-  if (data_blocks < 1) {
-    /* no data to be encoded, don't know what to do */
-    er_err("ER_Create_scheme invalid for data_blocks to be less than 1 @ %s:%d",
-      __FILE__, __LINE__);
-    return -1;
+  int max;
+  double trace_start = ER_TRACE_BEGIN();
+  MPI_Allreduce(&levels, &max, 1, MPI_INT, MPI_MAX, comm_world);
+  ER_TRACE_END(ER_TRACE_COLL, "er_state_levels", trace_start, levels);
+  if (max > ER_MAX_LEVELS) {
+    max = ER_MAX_LEVELS;
   }
+  return max;
+}
 
-  /* allocate a new redundancy descriptor */
-  redset* d = ER_MALLOC(sizeof(redset));
+/* get the epoch for each of count sets identified by their path
+ * prefixes that are about to be encoded, this is one more than the
+ * newest epoch of any state file of those sets, so that the new
+ * state wins over what any storage group still holds from an
+ * earlier encode, collective over comm_world, returns the number of
+ * reductions this took, none if we wrote the state of all sets last */
+static int er_state_next_epoch(MPI_Comm comm_world, MPI_Comm comm_store, int count, char** paths, long* epochs)
+{
+  /* get our rank in our storage group */
+  int rank_store;
+  MPI_Comm_rank(comm_store, &rank_store);
 
-  int redset_rc = REDSET_SUCCESS;
-  if (erasure_blocks == 0) {
-    /* SINGLE */
-    redset_rc = redset_create_single(comm, failure_domain, d);
-  } else if (erasure_blocks == 1) {
-    /* XOR */
-    redset_rc = redset_create_xor(comm, failure_domain, er_set_size, d);
-  } else if (erasure_blocks < data_blocks) {
-    /* Reed-Solomon */
-    redset_rc = redset_create_rs(comm, failure_domain, er_set_size, erasure_blocks, d);
-  } else if (erasure_blocks % data_blocks == 0) {
-    /* PARTNER */
-    int replicas = erasure_blocks / data_blocks;
-    redset_rc = redset_create_partner(comm, failure_domain, er_set_size, replicas, d);
-  } else {
-    /* some form of Reed-Solomon that we don't support yet */
-    er_free(&d);
-    return -1;
+  /* if we wrote the state of every set last, no state file holds an
+   * epoch newer than the one we agreed on then, descriptors are cached
+   * on all procs alike, so they all skip the reduction or none does */
+  long epoch = 0;
+  int known = 1;
+  int i;
+  for (i = 0; i < count; i++) {
+    erdesc* desc = erdesc_get(paths[i], comm_world);
+    if (desc == NULL || desc->epoch < 0) {
+      known = 0;
+    } else if (desc->epoch > epoch) {
+      epoch = desc->epoch;
+    }
+  }
+  if (known) {
+    for (i = 0; i < count; i++) {
+      epochs[i] = epoch + 1;
+    }
+    return 0;
   }
 
-  /* create the scheme */
-  if (redset_rc == REDSET_SUCCESS) {
-    /* bump our internal counter */
-    er_scheme_counter++;
+  /* one epoch for all sets is enough to order them */
+  epoch = 0;
+  for (i = 0; i < count; i++) {
+    if (rank_store == 0) {
+      char er_file[1024];
+      build_er_path(er_file, sizeof(er_file), paths[i]);
+
+      unsigned long val = 0;
+      kvtree* data = kvtree_new();
+      er_state_load(er_file, data);
+      kvtree_util_get_unsigned_long(data, "EPOCH", &val);
+      kvtree_delete(&data);
+      if ((long) val > epoch) {
+        epoch = (long) val;
+      }
+    }
+  }
 
-    /* create a new record in our scheme map */
-    kvtree* scheme = kvtree_set_kv_int(er_schemes, "SCHEMES", er_scheme_counter);
+  long max;
+  double trace_start = ER_TRACE_BEGIN();
+  MPI_Allreduce(&epoch, &max, 1, MPI_LONG, MPI_MAX, comm_world);
+  ER_TRACE_END(ER_TRACE_COLL, "er_state_next_epoch", trace_start, count);
 
-    /* record pointer to reddesc in our map */
-    kvtree_util_set_ptr(scheme, "PTR", (void*)d);
-  } else {
-    /* clean up and return */
-    kvtree_unset_kv_int(er_schemes, "SCHEMES", er_scheme_counter);
-    redset_delete(d);
-    er_free(&d);
-    return -1;
+  for (i = 0; i < count; i++) {
+    epochs[i] = max + 1;
   }
-
-  return er_scheme_counter;
+  return 1;
 }
 
-int ER_Free_Scheme(int scheme_id)
+/* record state for each of count sets identified by their path
+ * prefixes along with the epoch in epochs[i], skipping sets whose
+ * state is ER_STATE_NULL, if records is not NULL, records[i] holds
+ * file records and scheme metadata to be stored with the state of
+ * set i on rank 0 of the storage group (see er_records_gather)
+ *
+ * Each storage group records the state of the set in its own file.
+ * Before any process modifies files of a set, its storage group must
+ * have marked the set as CORRUPT, so callers that write CORRUPT pass
+ * a non-zero wait to wait on the other procs in our storage group,
+ * which all procs of comm_store must pass alike, whether or not their
+ * own batch ended up with a set to mark.  This does not need to
+ * synchronize with other storage groups, because er_state_read
+ * treats a set as CORRUPT if any storage group says so at the
+ * newest epoch.  Storage groups that have not written CORRUPT yet
+ * have not touched their files either.
+ *
+ * Writing ENCODED needs no synchronization at all, since the redset
+ * and shuffile operations that precede it only return after all procs
+ * have completed them, the set is fully encoded by the time any proc
+ * gets here, no matter how far the other procs got with their writes. */
+static void er_state_write(MPI_Comm comm_store, int count, char** paths, const int* states, const long* epochs, kvtree** records, int wait)
 {
-  int rc = ER_SUCCESS;
+  /* get our rank in our storage group */
+  int rank_store;
+  MPI_Comm_rank(comm_store, &rank_store);
 
-  /* look up entry for this scheme id */
-  redset* d = erscheme_get(scheme_id);
-  if (d != NULL) {
-    /* free reddesc */
-    if (redset_delete(d) != REDSET_SUCCESS) {
-      /* failed to free redundancy descriptor */
-      er_err("ER_Free_scheme failed to free redundancy descriptor @ %s:%d",
-        __FILE__, __LINE__);
-      rc = ER_FAILURE;
-    }
+  int i;
+  if (rank_store == 0) {
+    for (i = 0; i < count; i++) {
+      if (states[i] == ER_STATE_NULL) {
+        continue;
+      }
 
-    /* TODO: what to do here if redset_delete fails? */
+      /* build name of er state file */
+      char er_file[1024];
+      build_er_path(er_file, sizeof(er_file), paths[i]);
+
+      /* write state to file, along with any file records
+       * our storage group collected for the set */
+      kvtree* data = kvtree_new();
+      kvtree_util_set_int(data, "STATE", states[i]);
+      kvtree_util_set_unsigned_long(data, "EPOCH", (unsigned long) epochs[i]);
+      if (records != NULL && records[i] != NULL) {
+        kvtree_merge(data, records[i]);
+      }
+      kvtree_write_file(er_file, data);
+      er_state_cache(er_file, data);
+      kvtree_delete(&data);
 
-    /* free the pointer to the redundancy descriptor */
-    er_free(&d);
-  } else {
-    /* failed to find pointer to reddesc */
-    er_err("ER_Free_scheme failed to find pointer to reddesc @ %s:%d",
-      __FILE__, __LINE__);
-    rc = ER_FAILURE;
+      ER_TRACE_MARK(ER_TRACE_STATE,
+        (states[i] == ER_STATE_CORRUPT) ? "CORRUPT" : "ENCODED", epochs[i]);
+    }
   }
 
-  /* drop scheme entry from our map */
-  kvtree_unset_kv_int(er_schemes, "SCHEMES", scheme_id);
+  /* wait for our storage group to mark files as corrupt
+   * before anyone in the group goes on to modify them */
+  if (wait) {
+    double trace_start = ER_TRACE_BEGIN();
+    MPI_Barrier(comm_store);
+    ER_TRACE_END(ER_TRACE_COLL, "er_state_write", trace_start, count);
+  }
 
-  return rc;
+  return;
 }
 
-/* create a named set, and specify whether it should be encoded or recovered */
-int ER_Create(MPI_Comm comm_world, MPI_Comm comm_store, const char* name, int direction, int scheme_id)
+/* agree on the state of each of count sets identified by their
+ * path prefixes using a single reduction, epochs[i] gets the epoch
+ * of the agreed state, if datas is not NULL, rank 0 of each storage
+ * group returns the contents of the state file of set i in datas[i]
+ * if it holds the agreed state and all other procs get NULL,
+ * the caller must delete these, if intact is not NULL, the same
+ * reduction sets intact[i] to 1 if every proc holds all of its
+ * files of an encoded set i, see er_records_intact, named[i] says
+ * whether this proc named the files it needs of set i, and is set
+ * to whether any proc did by the same reduction */
+static void er_state_read(MPI_Comm comm_world, MPI_Comm comm_store, int count, char** paths, int* states, long* epochs, kvtree** datas, int* intact, int* named)
 {
-  if ((comm_world == MPI_COMM_NULL) || (comm_store == MPI_COMM_NULL)) {
-    er_err("ER_Create comm_store or comm_world parameter is MPI_COMM_NULL @ %s:%d",
-      __FILE__, __LINE__);
-    return -1;
+  /* get our rank in our storage group */
+  int rank_store;
+  MPI_Comm_rank(comm_store, &rank_store);
+
+  int ranks;
+  MPI_Comm_size(comm_world, &ranks);
+
+  /* whether storage group found a set to be incomplete */
+  int* lost = (int*) ER_MALLOC(count * sizeof(int));
+
+  int i;
+  for (i = 0; i < count; i++) {
+    /* intialize state to NULL */
+    states[i] = ER_STATE_NULL;
+    epochs[i] = 0;
+    if (datas != NULL) {
+      datas[i] = NULL;
+    }
+    lost[i] = 0;
+
+    if (rank_store == 0) {
+      /* build name of er state file */
+      char er_file[1024];
+      build_er_path(er_file, sizeof(er_file), paths[i]);
+
+      /* read state from file */
+      unsigned long epoch = 0;
+      kvtree* data = kvtree_new();
+      er_state_load(er_file, data);
+      kvtree_util_get_int(data, "STATE", &states[i]);
+      kvtree_util_get_unsigned_long(data, "EPOCH", &epoch);
+      epochs[i] = (long) epoch;
+
+      /* state written for a different number of procs is of no use */
+      int state_ranks;
+      kvtree* meta = kvtree_get(data, "SCHEME");
+      if (kvtree_util_get_int(meta, "RANKS", &state_ranks) == KVTREE_SUCCESS &&
+          state_ranks != ranks)
+      {
+        er_warn("Ignoring state of %s written by %d procs @ %s:%d",
+          er_file, state_ranks, __FILE__, __LINE__);
+        states[i] = ER_STATE_NULL;
+        epochs[i] = 0;
+      }
+
+      if (intact != NULL) {
+        lost[i] = (states[i] != ER_STATE_ENCODED ||
+                   ! er_records_intact(data, comm_world, comm_store));
+      }
+      if (datas != NULL) {
+        datas[i] = data;
+      } else {
+        kvtree_delete(&data);
+      }
+    }
   }
 
-  /* check that we got a name */
-  if (name == NULL || strcmp(name, "") == 0) {
-    er_err("ER_Create name parameter is null @ %s:%d",
-      __FILE__, __LINE__);
-    return -1;
+  /* agree on state across processes, a storage group whose jobs ran
+   * on different nodes may have state of an older encode left over,
+   * so we pick the state with the newest epoch, storage groups only
+   * mark a set as CORRUPT before they modify its files and
+   * er_state_write does not wait for other groups, so of the newest
+   * epoch the set is only intact if no storage group found it to be
+   * CORRUPT, procs without a state value (e.g., lost their files)
+   * don't get a say, we combine epoch and state into one key so that
+   * a max reduction picks the newest epoch and within it CORRUPT over
+   * ENCODED over NULL, a set is intact unless some storage group lost
+   * files or holds a different key, we get the former and the
+   * smallest key from the same reduction */
+  long* vals   = (long*) ER_MALLOC(4 * count * sizeof(long));
+  long* agreed = (long*) ER_MALLOC(4 * count * sizeof(long));
+  for (i = 0; i < count; i++) {
+    long rank = 0;
+    if (states[i] == ER_STATE_ENCODED) {
+      rank = 1;
+    } else if (states[i] != ER_STATE_NULL) {
+      rank = 2;
+    }
+    vals[i] = epochs[i] * 3 + rank;
+    vals[count + i] = (long) lost[i];
+
+    /* only storage group leaders have a key to compare */
+    vals[2 * count + i] = (rank_store == 0) ? -vals[i] : LONG_MIN;
+
+    vals[3 * count + i] = (long) named[i];
   }
 
-  /* check that we got a valid value for direction */
-  if (direction != ER_DIRECTION_ENCODE  &&
-      direction != ER_DIRECTION_REBUILD &&
-      direction != ER_DIRECTION_REMOVE)
-  {
-    er_err("ER_Create invalid direction @ %s:%d",
-      __FILE__, __LINE__);
-    return -1;
+  double trace_start = ER_TRACE_BEGIN();
+  MPI_Allreduce(vals, agreed, 4 * count, MPI_LONG, MPI_MAX, comm_world);
+  ER_TRACE_END(ER_TRACE_COLL, "er_state_read", trace_start, count);
+
+  /* if there was no valid value, state is still set to ER_STATE_NULL */
+  for (i = 0; i < count; i++) {
+    long key = agreed[i];
+    states[i] = ER_STATE_NULL;
+    if (key % 3 == 1) {
+      states[i] = ER_STATE_ENCODED;
+    } else if (key % 3 == 2) {
+      states[i] = ER_STATE_CORRUPT;
+    }
+    epochs[i] = key / 3;
+
+    /* records of a stale state don't describe the current files */
+    if (datas != NULL && vals[i] != key) {
+      kvtree_delete(&datas[i]);
+    }
+
+    if (intact != NULL) {
+      int consistent = (-agreed[2 * count + i] == key);
+      intact[i] = (states[i] == ER_STATE_ENCODED && agreed[count + i] == 0 && consistent);
+    }
+
+    named[i] = (int) agreed[3 * count + i];
   }
 
-  /* allocate object for this set */
-  erset* setptr = erset_new(direction);
+  er_free(&agreed);
+  er_free(&vals);
+  er_free(&lost);
 
-  /* update our API state on this set */
-  setptr->api_state = ER_API_STATE_CREATED;
+  return;
+}
 
-  /* record operation path */
-  setptr->name = strdup(name);
+int ER_Init(const char* conf_file)
+{
+  /* we can only run operations in the background if MPI
+   * lets our progress thread issue calls concurrently */
+  int provided;
+  MPI_Query_thread(&provided);
+  er_async = (provided == MPI_THREAD_MULTIPLE);
+
+  /* buffers for our own file I/O are aligned to pages */
+  er_page_size = (size_t) sysconf(_SC_PAGESIZE);
+  if (! er_async) {
+    er_dbg(2, "MPI_THREAD_MULTIPLE not available, ER_Dispatch will block until complete");
+  }
 
-  /* record comms */
-  setptr->comm_world = comm_world;
-  setptr->comm_store = comm_store;
+  /* initialize the redundancy library */
+  if (redset_init() != REDSET_SUCCESS) {
+    /* clean up and return */
+    er_err("ER_Init redset_init failed @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
 
-  /* record scheme id (only valid if DIRECTION is ENCODE) */
-  setptr->scheme_id = scheme_id;
+  /* initialize the shuffile library */
+  if (shuffile_init() != SHUFFILE_SUCCESS) {
+    /* clean up and return */
+    er_err("ER_Init shuffile_init failed @ %s:%d",
+      __FILE__, __LINE__);
+    redset_finalize();
+    return ER_FAILURE;
+  }
 
-  /* bump set counter */
-  er_set_counter++;
+  /* prepare pool of transfer buffers for our own file I/O */
+  er_pool_init();
 
-  /* add an entry for this set */
-  kvtree* set = kvtree_set_kv_int(er_sets, "SETS", er_set_counter);
+  /* prepare cache of communicator dups shared by sets */
+  if (er_comm_init() != ER_SUCCESS) {
+    er_err("ER_Init failed to create communicator keyval @ %s:%d",
+      __FILE__, __LINE__);
+    er_pool_finalize();
+    shuffile_finalize();
+    redset_finalize();
+    return ER_FAILURE;
+  }
 
-  /* record pointer to our structure */
-  kvtree_util_set_ptr(set, "STRUCT", setptr);
+  /* allocate maps to track cached descriptors and state */
+  er_descs   = kvtree_new();
+  er_states  = kvtree_new();
 
-  /* when encoding, we need to remember the scheme,
-   * it's implied by name on rebuild */
-  if (direction == ER_DIRECTION_ENCODE) {
-    /* look up entry for this scheme id */
-    kvtree* scheme = kvtree_get_kv_int(er_schemes, "SCHEMES", scheme_id);
-    if (! scheme) {
-      /* failed to find scheme id in map */
-      er_err("ER_Create failed to find scheme id in map @ %s:%d",
+  /* start progress thread to execute dispatched operations */
+  if (er_async) {
+    if (er_progress_init() != ER_SUCCESS) {
+      er_warn("ER_Init failed to start progress thread, ER_Dispatch will block until complete @ %s:%d",
         __FILE__, __LINE__);
-      kvtree_unset_kv_int(er_sets, "SETS", er_set_counter);
-      erset_delete(&setptr);
-      return -1;
     }
   }
 
-  return er_set_counter;
+  return ER_SUCCESS;
 }
 
-/* adds file to specified set id */
-int ER_Add(int set_id, const char* file)
+int ER_Finalize(void)
 {
-  /* check that we got a file name */
-  if (file == NULL || strcmp(file, "") == 0) {
-    er_err("ER_Add file parameter is NULL @ %s:%d",
+  /* TODO: free descriptors for any outstanding schemes,
+   * probably need to do this in same order on all procs,
+   * for now, force user to clean up */
+  if (erhandles_used(&er_schemes) > 0) {
+    er_err("ER_Finalize called before schemes freed @ %s:%d",
       __FILE__, __LINE__);
     return ER_FAILURE;
   }
 
-  /* lookup set id */
-  erset* set = erset_get(set_id);
-  if (set) {
-    /* check that we're in the right state */
-    if (set->api_state != ER_API_STATE_CREATED) {
-      /* wrong state */
-      er_err("ER_Add called in wrong order @ %s:%d",
-        __FILE__, __LINE__);
-      return ER_FAILURE;
+  /* free outstanding sets */
+  if (erhandles_used(&er_sets) > 0) {
+    er_err("ER_Finalize called before sets freed @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* stop the progress thread */
+  er_progress_finalize();
+
+  /* write out trace events, nothing records them from here on */
+  if (ER_TRACE_WRITE() != ER_SUCCESS) {
+    er_warn("ER_Finalize failed to write trace file @ %s:%d",
+      __FILE__, __LINE__);
+  }
+
+  /* free pooled transfer buffers */
+  er_pool_finalize();
+
+  /* free communicator dups still cached on application comms */
+  er_comm_finalize();
+
+  /* free cached descriptors, entries were added in the same
+   * order on all procs, so we free them in the same order */
+  kvtree* descs = kvtree_get(er_descs, "DESC");
+  kvtree_elem* elem = kvtree_elem_first(descs);
+  while (elem != NULL) {
+    const char* path = kvtree_elem_key(elem);
+    elem = kvtree_elem_next(elem);
+    erdesc_drop(path);
+  }
+
+  /* free maps */
+  erhandles_free(&er_schemes);
+  erhandles_free(&er_sets);
+  kvtree_delete(&er_descs);
+  kvtree_delete(&er_states);
+
+  /* shut down shuffile library */
+  if (shuffile_finalize() != SHUFFILE_SUCCESS) {
+    er_err("ER_Finalize shuffile_finalize() failed @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* shut down redundancy library */
+  if (redset_finalize() != REDSET_SUCCESS) {
+    er_err("ER_Finalize redset_finalize() failed @ %s:%d",
+       __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  return ER_SUCCESS;
+}
+
+/** Set ER config parameters */
+static kvtree* ER_Config_Set(const kvtree* config)
+{
+  kvtree* retval = (kvtree*)config;
+  assert(retval != NULL);
+
+  static const char* known_options[] = {
+    ER_KEY_CONFIG_DEBUG,
+    ER_KEY_CONFIG_SET_SIZE,
+    ER_KEY_CONFIG_MPI_BUF_SIZE,
+    ER_KEY_CONFIG_CRC_ON_COPY,
+    ER_KEY_CONFIG_STATS,
+    ER_KEY_CONFIG_BUF_HUGEPAGE,
+    ER_KEY_CONFIG_PIPELINE_REBUILD,
+    ER_KEY_CONFIG_IO_THREADS,
+    ER_KEY_CONFIG_COMPRESS,
+    ER_KEY_CONFIG_DELTA,
+    ER_KEY_CONFIG_MMAP,
+    ER_KEY_CONFIG_FLUSH_DIR,
+    ER_KEY_CONFIG_VERIFY_BW,
+    ER_KEY_CONFIG_MAX_BW,
+    ER_KEY_CONFIG_MAX_CHUNKS,
+    ER_KEY_CONFIG_PROGRESS,
+    ER_KEY_CONFIG_PROGRESS_CPUS,
+    ER_KEY_CONFIG_PROGRESS_POLL,
+    ER_KEY_CONFIG_TRACE_FILE,
+    NULL
+  };
+
+  /* read out all options we know about */
+  /* TODO: this could be turned into a list of structs */
+  kvtree_util_get_int(config, ER_KEY_CONFIG_DEBUG, &er_debug);
+
+  kvtree_util_get_int(config, ER_KEY_CONFIG_SET_SIZE, &er_set_size);
+
+  unsigned long ul;
+  if (kvtree_util_get_bytecount(config, ER_KEY_CONFIG_MPI_BUF_SIZE, &ul) ==
+      KVTREE_SUCCESS)
+  {
+    er_mpi_buf_size = (int) ul;
+    if (er_mpi_buf_size != ul) {
+      char *value;
+      kvtree_util_get_str(config, ER_KEY_CONFIG_MPI_BUF_SIZE, &value);
+      er_err("Value '%s' passed for %s exceeds int range @ %s:%d",
+        value, ER_KEY_CONFIG_MPI_BUF_SIZE, __FILE__, __LINE__
+      );
+      retval = NULL;
+    }
+  }
+
+  kvtree_util_get_int(config, ER_KEY_CONFIG_CRC_ON_COPY, &er_crc_on_copy);
+
+  kvtree_util_get_int(config, ER_KEY_CONFIG_STATS, &er_collect_stats);
+
+  kvtree_util_get_int(config, ER_KEY_CONFIG_BUF_HUGEPAGE, &er_buf_hugepage);
+
+  kvtree_util_get_int(config, ER_KEY_CONFIG_PIPELINE_REBUILD, &er_pipeline_rebuild);
+
+  kvtree_util_get_int(config, ER_KEY_CONFIG_IO_THREADS, &er_io_threads);
+
+  int level;
+  if (kvtree_util_get_int(config, ER_KEY_CONFIG_COMPRESS, &level) ==
+      KVTREE_SUCCESS)
+  {
+#ifndef HAVE_LIBZ
+    if (level > 0) {
+      er_err("%s requires ER to be built with zlib @ %s:%d",
+        ER_KEY_CONFIG_COMPRESS, __FILE__, __LINE__
+      );
+      retval = NULL;
+    } else
+#endif
+    if (level >= 0 && level <= 9) {
+      er_compress = level;
+    } else {
+      er_err("Value '%d' passed for %s is not a compression level from 0 to 9 @ %s:%d",
+        level, ER_KEY_CONFIG_COMPRESS, __FILE__, __LINE__
+      );
+      retval = NULL;
+    }
+  }
+
+  kvtree_util_get_int(config, ER_KEY_CONFIG_DELTA, &er_delta);
+
+  kvtree_util_get_int(config, ER_KEY_CONFIG_MMAP, &er_mmap);
+
+  char* flush_dir;
+  if (kvtree_util_get_str(config, ER_KEY_CONFIG_FLUSH_DIR, &flush_dir) ==
+      KVTREE_SUCCESS)
+  {
+    /* leave room for the names of the files copied into it */
+    if (strlen(flush_dir) < ER_MAX_FILENAME / 2) {
+      er_free(&er_flush_dir);
+      if (flush_dir[0] != '\0') {
+        er_flush_dir = strdup(flush_dir);
+      }
+    } else {
+      er_err("Value '%s' passed for %s is too long @ %s:%d",
+        flush_dir, ER_KEY_CONFIG_FLUSH_DIR, __FILE__, __LINE__
+      );
+      retval = NULL;
+    }
+  }
+
+  kvtree_util_get_bytecount(config, ER_KEY_CONFIG_VERIFY_BW, &er_verify_bw);
+
+  kvtree_util_get_bytecount(config, ER_KEY_CONFIG_MAX_BW, &er_max_bw);
+
+  kvtree_util_get_int(config, ER_KEY_CONFIG_MAX_CHUNKS, &er_max_chunks);
+
+  kvtree_util_get_int(config, ER_KEY_CONFIG_PROGRESS, &er_progress);
+
+  char* cpus;
+  if (kvtree_util_get_str(config, ER_KEY_CONFIG_PROGRESS_CPUS, &cpus) ==
+      KVTREE_SUCCESS)
+  {
+    if (er_progress_check_cpus(cpus) == ER_SUCCESS) {
+      er_free(&er_progress_cpus);
+      er_progress_cpus = strdup(cpus);
+    } else {
+      er_err("Value '%s' passed for %s is not a list of cpus @ %s:%d",
+        cpus, ER_KEY_CONFIG_PROGRESS_CPUS, __FILE__, __LINE__
+      );
+      retval = NULL;
+    }
+  }
+
+  kvtree_util_get_int(config, ER_KEY_CONFIG_PROGRESS_POLL, &er_progress_poll);
+
+  char* trace_file;
+  if (kvtree_util_get_str(config, ER_KEY_CONFIG_TRACE_FILE, &trace_file) ==
+      KVTREE_SUCCESS)
+  {
+    /* leave room for the rank and extension */
+    if (strlen(trace_file) < ER_MAX_FILENAME / 2) {
+      er_free(&er_trace_file);
+      if (trace_file[0] != '\0') {
+        er_trace_file = strdup(trace_file);
+      }
+    } else {
+      er_err("Value '%s' passed for %s is too long @ %s:%d",
+        trace_file, ER_KEY_CONFIG_TRACE_FILE, __FILE__, __LINE__
+      );
+      retval = NULL;
+    }
+  }
+
+  /* start, stop, or rebind progress thread as needed */
+  if (er_progress_update() != ER_SUCCESS) {
+    retval = NULL;
+  }
+
+  /* pass options to redset */
+  kvtree* redset_config_values = kvtree_new();
+
+  kvtree_util_set_int(redset_config_values,
+    REDSET_KEY_CONFIG_DEBUG, er_debug);
+
+  kvtree_util_set_int(redset_config_values,
+    REDSET_KEY_CONFIG_SET_SIZE, er_set_size);
+
+  kvtree_util_set_int(redset_config_values,
+    REDSET_KEY_CONFIG_MPI_BUF_SIZE, er_mpi_buf_size);
+
+  if (redset_config(redset_config_values) == NULL) {
+    retval = NULL;
+  }
+
+  kvtree_delete(&redset_config_values);
+
+  /* pass options to shuffile */
+  kvtree* shuffile_config_values = kvtree_new();
+
+  kvtree_util_set_int(shuffile_config_values,
+    SHUFFILE_KEY_CONFIG_MPI_BUF_SIZE, er_mpi_buf_size);
+
+  kvtree_util_set_int(shuffile_config_values,
+    SHUFFILE_KEY_CONFIG_DEBUG, er_debug);
+
+  if (shuffile_config(shuffile_config_values) == NULL) {
+    retval = NULL;
+  }
+
+  kvtree_delete(&shuffile_config_values);
+
+  /* report all unknown options (typos?) */
+  const kvtree_elem* elem;
+  for (elem = kvtree_elem_first(config);
+       elem != NULL;
+       elem = kvtree_elem_next(elem))
+  {
+    /* must be only one level deep, ie plain kev = value */
+    const kvtree* elem_hash = kvtree_elem_hash(elem);
+    assert(kvtree_size(elem_hash) == 1);
+
+    const kvtree* kvtree_first_elem_hash =
+      kvtree_elem_hash(kvtree_elem_first(elem_hash));
+    assert(kvtree_size(kvtree_first_elem_hash) == 0);
+
+    /* check against known options */
+    const char** opt;
+    int found = 0;
+    for (opt = known_options; *opt != NULL; opt++) {
+      if (strcmp(*opt, kvtree_elem_key(elem)) == 0) {
+        found = 1;
+        break;
+      }
+    }
+    if (! found) {
+      er_err("Unknown configuration parameter '%s' with value '%s' @ %s:%d",
+        kvtree_elem_key(elem),
+        kvtree_elem_key(kvtree_elem_first(kvtree_elem_hash(elem))),
+        __FILE__, __LINE__
+      );
+      retval = NULL;
     }
+  }
+
+  return retval;
+}
+
+/** Get ER config parameters */
+static kvtree* ER_Config_Get(void)
+{
+  kvtree* retval = kvtree_new();
+  assert(retval != NULL);
+
+  int success = 1;
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_DEBUG, er_debug) !=
+    KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_SET_SIZE, er_set_size) !=
+    KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_MPI_BUF_SIZE,
+    er_mpi_buf_size) != KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_CRC_ON_COPY,
+    er_crc_on_copy) != KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_STATS,
+    er_collect_stats) != KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_BUF_HUGEPAGE,
+    er_buf_hugepage) != KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_PIPELINE_REBUILD,
+    er_pipeline_rebuild) != KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_IO_THREADS,
+    er_io_threads) != KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_COMPRESS, er_compress) !=
+    KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_DELTA, er_delta) !=
+    KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_MMAP, er_mmap) !=
+    KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  const char* flush_dir = (er_flush_dir != NULL) ? er_flush_dir : "";
+  if (kvtree_util_set_str(retval, ER_KEY_CONFIG_FLUSH_DIR, flush_dir) !=
+    KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_bytecount(retval, ER_KEY_CONFIG_VERIFY_BW, er_verify_bw) !=
+    KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_bytecount(retval, ER_KEY_CONFIG_MAX_BW, er_max_bw) !=
+    KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_MAX_CHUNKS, er_max_chunks) !=
+    KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_PROGRESS, er_progress) !=
+    KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  const char* cpus = (er_progress_cpus != NULL) ? er_progress_cpus : "";
+  if (kvtree_util_set_str(retval, ER_KEY_CONFIG_PROGRESS_CPUS, cpus) !=
+    KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  if (kvtree_util_set_int(retval, ER_KEY_CONFIG_PROGRESS_POLL,
+    er_progress_poll) != KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  const char* trace_file = (er_trace_file != NULL) ? er_trace_file : "";
+  if (kvtree_util_set_str(retval, ER_KEY_CONFIG_TRACE_FILE, trace_file) !=
+    KVTREE_SUCCESS)
+  {
+    success = 0;
+  }
+
+  /* read-only values describing the scheme ER_Create_Scheme_auto picked */
+  if (er_auto_valid) {
+    if (kvtree_util_set_str(retval, ER_KEY_CONFIG_AUTO_SCHEME_TYPE,
+      er_model_name(er_auto_model.type)) != KVTREE_SUCCESS)
+    {
+      success = 0;
+    }
+
+    if (kvtree_util_set_int(retval, ER_KEY_CONFIG_AUTO_SCHEME_SET_SIZE,
+      er_auto_model.set_size) != KVTREE_SUCCESS)
+    {
+      success = 0;
+    }
+
+    if (kvtree_util_set_int(retval, ER_KEY_CONFIG_AUTO_SCHEME_ERASURE,
+      er_auto_model.erasure) != KVTREE_SUCCESS)
+    {
+      success = 0;
+    }
+
+    if (kvtree_util_set_int(retval, ER_KEY_CONFIG_AUTO_SCHEME_DOMAINS,
+      er_auto_domains) != KVTREE_SUCCESS)
+    {
+      success = 0;
+    }
+  }
+
+  if (!success) {
+    kvtree_delete(&retval);
+  }
+
+  return retval;
+}
+
+/** Get / Set ER config parameters */
+kvtree* ER_Config(const kvtree* config)
+{
+  if (config != NULL) {
+    return ER_Config_Set(config);
+  } else {
+    return ER_Config_Get();
+  }
+  return NULL; /* NOTREACHED */
+}
+
+/* count failure domains in comm, collective over comm */
+static void er_count_domains(MPI_Comm comm, const char* failure_domain, int* domains)
+{
+  int domain_id;
+  rankstr_mpi(failure_domain, comm, 0, 1, domains, &domain_id);
+}
+
+/* create a scheme of given type over domains failure domains,
+ * returns NULL on failure */
+static erscheme* erscheme_create(MPI_Comm comm, const char* failure_domain, int domains,
+  int type, int set_size, int data_blocks, int erasure_blocks)
+{
+  /* allocate a new scheme with a redundancy descriptor,
+   * the scheme id holds the first reference */
+  erscheme* schemeptr = (erscheme*) ER_MALLOC(sizeof(erscheme));
+  schemeptr->refs = 1;
+  schemeptr->data_blocks    = data_blocks;
+  schemeptr->erasure_blocks = erasure_blocks;
+  schemeptr->type           = type;
+  schemeptr->set_size       = set_size;
+  schemeptr->domains        = domains;
+  schemeptr->levels         = 1;
+  redset* d = &schemeptr->d;
+
+  int redset_rc = REDSET_SUCCESS;
+  switch (type) {
+  case ER_MODEL_SINGLE:
+    redset_rc = redset_create_single(comm, failure_domain, d);
+    break;
+  case ER_MODEL_XOR:
+    redset_rc = redset_create_xor(comm, failure_domain, set_size, d);
+    break;
+  case ER_MODEL_RS:
+    redset_rc = redset_create_rs(comm, failure_domain, set_size, erasure_blocks, d);
+    break;
+  case ER_MODEL_PARTNER:
+    redset_rc = redset_create_partner(comm, failure_domain, set_size, erasure_blocks / data_blocks, d);
+    break;
+  default:
+    er_free(&schemeptr);
+    return NULL;
+  }
+
+  if (redset_rc != REDSET_SUCCESS) {
+    /* clean up and return */
+    redset_delete(d);
+    er_free(&schemeptr);
+    return NULL;
+  }
+  MPI_Comm_group(comm, &schemeptr->group);
+
+  return schemeptr;
+}
+
+int ER_Create_Scheme(
+  MPI_Comm comm,
+  const char* failure_domain,
+  int data_blocks,
+  int erasure_blocks)
+{
+  if (comm == MPI_COMM_NULL) {
+    er_err("ER_Create_scheme comm parameter is MPI_COMM_NULL @ %s:%d",
+      __FILE__, __LINE__);
+    return -1;
+  }
+
+  if (failure_domain == NULL) {
+    er_err("ER_Create_scheme failure_domain parameter is null @ %s:%d",
+      __FILE__, __LINE__);
+    return -1;
+  }
+
+  /* check that we can support the scheme the caller is asking for */
+  if (data_blocks < 1) {
+    /* no data to be encoded, don't know what to do */
+    er_err("ER_Create_scheme invalid for data_blocks to be less than 1 @ %s:%d",
+      __FILE__, __LINE__);
+    return -1;
+  }
+
+  int type;
+  if (erasure_blocks == 0) {
+    /* SINGLE */
+    type = ER_MODEL_SINGLE;
+  } else if (erasure_blocks == 1) {
+    /* XOR */
+    type = ER_MODEL_XOR;
+  } else if (erasure_blocks < data_blocks) {
+    /* Reed-Solomon */
+    type = ER_MODEL_RS;
+  } else if (erasure_blocks % data_blocks == 0) {
+    /* PARTNER */
+    type = ER_MODEL_PARTNER;
+  } else {
+    /* some form of Reed-Solomon that we don't support yet */
+    return -1;
+  }
+
+  /* redset spreads sets over at most one failure domain per proc,
+   * counting the domains would cost a collective of its own */
+  int domains;
+  MPI_Comm_size(comm, &domains);
+
+  /* create the scheme */
+  erscheme* schemeptr = erscheme_create(comm, failure_domain, domains, type, er_set_size,
+    data_blocks, erasure_blocks);
+  if (schemeptr == NULL) {
+    return -1;
+  }
+
+  /* record pointer to scheme in our map */
+  return erhandles_add(&er_schemes, (void*)schemeptr);
+}
+
+int ER_Create_Scheme_auto(
+  MPI_Comm comm,
+  const char* failure_domain,
+  int tolerance,
+  double overhead)
+{
+  if (comm == MPI_COMM_NULL) {
+    er_err("ER_Create_Scheme_auto comm parameter is MPI_COMM_NULL @ %s:%d",
+      __FILE__, __LINE__);
+    return -1;
+  }
+
+  if (failure_domain == NULL) {
+    er_err("ER_Create_Scheme_auto failure_domain parameter is null @ %s:%d",
+      __FILE__, __LINE__);
+    return -1;
+  }
+
+  if (tolerance < 0 || overhead < 0.0) {
+    er_err("ER_Create_Scheme_auto tolerance and overhead must not be negative @ %s:%d",
+      __FILE__, __LINE__);
+    return -1;
+  }
+
+  /* count failure domains, costs are per byte of a proc, and all
+   * schemes send the data of every proc in a domain alike, so how
+   * many procs a domain holds does not change which scheme is cheapest */
+  int domains;
+  er_count_domains(comm, failure_domain, &domains);
+
+  /* every proc computes the same choice from the same inputs */
+  er_model m;
+  if (er_model_pick(domains, tolerance, overhead, &m) != ER_SUCCESS) {
+    er_err("ER_Create_Scheme_auto found no scheme that tolerates %d of %d failure domains within overhead %f @ %s:%d",
+      tolerance, domains, overhead, __FILE__, __LINE__);
+    return -1;
+  }
+
+  /* express scheme in data and erasure blocks as ER_Create_Scheme does */
+  int data_blocks    = m.set_size - m.erasure;
+  int erasure_blocks = m.erasure;
+  if (m.type == ER_MODEL_SINGLE || m.type == ER_MODEL_PARTNER) {
+    data_blocks = 1;
+  }
+
+  erscheme* schemeptr = erscheme_create(comm, failure_domain, domains, m.type, m.set_size,
+    data_blocks, erasure_blocks);
+  if (schemeptr == NULL) {
+    er_err("ER_Create_Scheme_auto failed to create %s scheme of set size %d @ %s:%d",
+      er_model_name(m.type), m.set_size, __FILE__, __LINE__);
+    return -1;
+  }
+
+  er_dbg(1, "Picked %s scheme with set size %d and %d erasure blocks for %d failure domains",
+    er_model_name(m.type), m.set_size, m.erasure, domains);
+
+  /* remember what we picked so ER_Config can report it */
+  er_auto_valid        = 1;
+  er_auto_model        = m;
+  er_auto_domains      = domains;
+
+  return erhandles_add(&er_schemes, (void*)schemeptr);
+}
+
+int ER_Compose_Scheme(int local_scheme_id, int global_scheme_id)
+{
+  erscheme* local  = erscheme_get(local_scheme_id);
+  erscheme* global = erscheme_get(global_scheme_id);
+  if (local == NULL || global == NULL) {
+    er_err("ER_Compose_Scheme unknown scheme id %d or %d @ %s:%d",
+      local_scheme_id, global_scheme_id, __FILE__, __LINE__);
+    return -1;
+  }
+
+  if (local->levels > 1 || global->levels > 1 || local == global) {
+    er_err("ER_Compose_Scheme needs two distinct schemes that are not composed themselves @ %s:%d",
+      __FILE__, __LINE__);
+    return -1;
+  }
+
+  /* sets apply each level on their comm_world, so both levels must
+   * have been created on the same procs in the same order, which
+   * is what MPI_Comm_compare calls congruent, comparing their
+   * groups tells us as much without keeping a comm around */
+  int result;
+  MPI_Group_compare(local->group, global->group, &result);
+  if (result != MPI_IDENT) {
+    er_err("ER_Compose_Scheme needs schemes created on congruent comms @ %s:%d",
+      __FILE__, __LINE__);
+    return -1;
+  }
+
+  /* the composed scheme holds a reference to each level,
+   * which keeps them alive after their ids are freed */
+  erscheme* schemeptr = (erscheme*) ER_MALLOC(sizeof(erscheme));
+  memset(schemeptr, 0, sizeof(erscheme));
+  schemeptr->refs           = 1;
+  schemeptr->data_blocks    = local->data_blocks;
+  schemeptr->erasure_blocks = local->erasure_blocks + global->erasure_blocks;
+  schemeptr->type           = local->type;
+  schemeptr->set_size       = local->set_size;
+  schemeptr->domains        = local->domains;
+  schemeptr->levels         = 2;
+  schemeptr->group          = MPI_GROUP_NULL;
+  schemeptr->level[0]       = local;
+  schemeptr->level[1]       = global;
+  erscheme_acquire(local);
+  erscheme_acquire(global);
+
+  return erhandles_add(&er_schemes, (void*)schemeptr);
+}
+
+int ER_Free_Scheme(int scheme_id)
+{
+  int rc = ER_SUCCESS;
+
+  /* look up entry for this scheme id */
+  erscheme* scheme = erscheme_get(scheme_id);
+  if (scheme != NULL) {
+    /* drop the reference held by the scheme id, the descriptor
+     * is freed once no set or cached descriptor uses it */
+    rc = erscheme_release(scheme);
+  } else {
+    /* failed to find pointer to reddesc */
+    er_err("ER_Free_scheme failed to find pointer to reddesc @ %s:%d",
+      __FILE__, __LINE__);
+    rc = ER_FAILURE;
+  }
+
+  /* drop scheme entry from our map */
+  erhandles_remove(&er_schemes, scheme_id);
+
+  return rc;
+}
+
+/* describe a single level scheme in terms of the cost model, with the
+ * set size redset actually uses, which is capped at the number of
+ * failure domains the scheme was created over, or at its procs if
+ * those were not counted */
+static void erscheme_model(const erscheme* scheme, er_model* m)
+{
+  m->type     = scheme->type;
+  m->set_size = scheme->set_size;
+  m->erasure  = scheme->erasure_blocks;
+  if (m->set_size > scheme->domains) {
+    m->set_size = scheme->domains;
+  }
+  if (m->type == ER_MODEL_PARTNER) {
+    /* erasure blocks count data blocks times replicas */
+    m->erasure = scheme->erasure_blocks / scheme->data_blocks;
+  }
+  if (m->type == ER_MODEL_XOR && m->set_size < 2) {
+    /* nothing to compute parity with */
+    m->type = ER_MODEL_SINGLE;
+  }
+  if (m->type == ER_MODEL_RS && m->set_size <= m->erasure) {
+    m->type = ER_MODEL_SINGLE;
+  }
+  er_model_eval(m);
+}
+
+kvtree* ER_Estimate(int scheme_id, int num_files, unsigned long bytes_per_rank)
+{
+  erscheme* scheme = erscheme_get(scheme_id);
+  if (scheme == NULL) {
+    er_err("ER_Estimate unknown scheme id %d @ %s:%d",
+      scheme_id, __FILE__, __LINE__);
+    return NULL;
+  }
+
+  if (num_files < 0) {
+    er_err("ER_Estimate number of files must not be negative @ %s:%d",
+      __FILE__, __LINE__);
+    return NULL;
+  }
+
+  kvtree* hash = kvtree_new();
+  double data = (double) bytes_per_rank;
+
+  /* each level computes its redundancy from all files of the set */
+  double parity  = 0.0;
+  double network = 0.0;
+  double rebuild = 0.0;
+  int levels = scheme->levels;
+  int level;
+  for (level = 0; level < levels; level++) {
+    const erscheme* s = (levels > 1) ? scheme->level[level] : scheme;
+    er_model m;
+    erscheme_model(s, &m);
+
+    kvtree* level_hash = kvtree_set_kv_int(hash, "LEVEL", level);
+    kvtree_util_set_str(level_hash, "TYPE", er_model_name(m.type));
+    kvtree_util_set_int(level_hash, "SET_SIZE", m.set_size);
+    kvtree_util_set_int(level_hash, "ERASURE", m.erasure);
+    kvtree_util_set_unsigned_long(level_hash, "PARITY_BYTES", (unsigned long) (m.overhead * data));
+    kvtree_util_set_unsigned_long(level_hash, "NETWORK_BYTES", (unsigned long) (m.encode * data));
+    kvtree_util_set_unsigned_long(level_hash, "REBUILD_BYTES", (unsigned long) (m.rebuild * data));
+
+    parity  += m.overhead * data;
+    network += m.encode * data;
+
+    /* a rebuild tries the first level first */
+    if (level == 0) {
+      rebuild = m.rebuild * data;
+    }
+  }
+
+  /* compressed copies are kept next to the redundancy files, they take
+   * at most as much space as the files themselves, and are what
+   * redundancy is computed from, a set without a predecessor has
+   * nothing to compute deltas against */
+  int shadows = (er_compress > 0);
+  double storage = parity;
+  if (shadows) {
+    storage += data;
+  }
+
+  /* redset writes one file per level, plus one copy per file */
+  int files = levels;
+  if (shadows) {
+    files += num_files;
+  }
+
+  /* steps of an encode without a predecessor that synchronize procs,
+   * each counted once in COLLECTIVES by ER_Get_Stats: reading the state,
+   * marking it corrupt, writing buffers, applying each level, registering
+   * with shuffile, writing the state, and for the options that are set,
+   * compressing, checksumming, and flushing */
+  unsigned long steps = 5 + (unsigned long) levels;
+  if (shadows) {
+    steps++;
+  }
+  if (er_crc_on_copy) {
+    steps++;
+  }
+  if (er_flush_dir != NULL) {
+    steps++;
+  }
+
+  kvtree_util_set_str(hash, "TYPE", er_model_name(scheme->type));
+  kvtree_util_set_int(hash, "LEVELS", levels);
+  kvtree_util_set_int(hash, "DOMAINS", scheme->domains);
+  kvtree_util_set_unsigned_long(hash, "PARITY_BYTES", (unsigned long) parity);
+  kvtree_util_set_unsigned_long(hash, "NETWORK_BYTES", (unsigned long) network);
+  kvtree_util_set_unsigned_long(hash, "REBUILD_BYTES", (unsigned long) rebuild);
+  kvtree_util_set_unsigned_long(hash, "STORAGE_BYTES", (unsigned long) storage);
+  kvtree_util_set_int(hash, "FILES", files);
+  kvtree_util_set_unsigned_long(hash, "STEPS", steps);
+
+  return hash;
+}
+
+/* create a named set, and specify whether it should be encoded or recovered */
+int ER_Create(MPI_Comm comm_world, MPI_Comm comm_store, const char* name, int direction, int scheme_id)
+{
+  if ((comm_world == MPI_COMM_NULL) || (comm_store == MPI_COMM_NULL)) {
+    er_err("ER_Create comm_store or comm_world parameter is MPI_COMM_NULL @ %s:%d",
+      __FILE__, __LINE__);
+    return -1;
+  }
+
+  /* check that we got a name */
+  if (name == NULL || strcmp(name, "") == 0) {
+    er_err("ER_Create name parameter is null @ %s:%d",
+      __FILE__, __LINE__);
+    return -1;
+  }
+
+  /* check that we got a valid value for direction */
+  if (direction != ER_DIRECTION_ENCODE  &&
+      direction != ER_DIRECTION_REBUILD &&
+      direction != ER_DIRECTION_REMOVE  &&
+      direction != ER_DIRECTION_VERIFY)
+  {
+    er_err("ER_Create invalid direction @ %s:%d",
+      __FILE__, __LINE__);
+    return -1;
+  }
+
+  /* when encoding, we need to remember the scheme,
+   * it's implied by name on rebuild */
+  if (direction == ER_DIRECTION_ENCODE) {
+    /* look up entry for this scheme id */
+    erscheme* scheme = erscheme_get(scheme_id);
+    if (! scheme) {
+      /* failed to find scheme id in map */
+      er_err("ER_Create failed to find scheme id in map @ %s:%d",
+        __FILE__, __LINE__);
+      return -1;
+    }
+  }
+
+  /* allocate object for this set */
+  erset* setptr = erset_new(direction);
+
+  /* update our API state on this set */
+  setptr->api_state = ER_API_STATE_CREATED;
+
+  /* record operation path */
+  setptr->name = strdup(name);
+
+  /* record comms, we use dups so that collectives we issue while an
+   * operation runs in the background can't match collectives the
+   * application issues on its own communicators in the meantime,
+   * the dups are cached on the application comms and shared by all
+   * sets created on them, so only the first set pays for them */
+  setptr->world = er_comm_acquire(comm_world);
+  setptr->store = er_comm_acquire(comm_store);
+  if (setptr->world == NULL || setptr->store == NULL) {
+    er_err("ER_Create failed to duplicate communicators @ %s:%d",
+      __FILE__, __LINE__);
+    erset_delete(&setptr);
+    return -1;
+  }
+
+  /* record scheme id (only valid if DIRECTION is ENCODE),
+   * and hold on to the scheme until the set is freed */
+  setptr->scheme_id = scheme_id;
+  if (direction == ER_DIRECTION_ENCODE) {
+    setptr->scheme = erscheme_get(scheme_id);
+    erscheme_acquire(setptr->scheme);
+
+    /* compression is picked when the set is created */
+    setptr->compress = er_compress;
+    setptr->delta    = er_delta;
+
+    /* as is the tier redundancy is flushed to */
+    if (er_flush_dir != NULL) {
+      setptr->flush_dir = strdup(er_flush_dir);
+    }
+  }
+
+  /* a verify reads no faster than allowed when it was created */
+  if (direction == ER_DIRECTION_VERIFY) {
+    setptr->verify_bw = er_verify_bw;
+  }
+
+  /* add an entry for this set */
+  return erhandles_add(&er_sets, (void*)setptr);
+}
+
+/* adds file to specified set id */
+int ER_Add(int set_id, const char* file)
+{
+  /* check that we got a file name */
+  if (file == NULL || strcmp(file, "") == 0) {
+    er_err("ER_Add file parameter is NULL @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* lookup set id */
+  erset* set = erset_get(set_id);
+  if (set) {
+    /* check that we're in the right state */
+    if (set->api_state != ER_API_STATE_CREATED) {
+      /* wrong state */
+      er_err("ER_Add called in wrong order @ %s:%d",
+        __FILE__, __LINE__);
+      return ER_FAILURE;
+    }
+
+    /* add file to set, this replaces any buffer added under the
+     * same name */
+    erset_add_file(set, file);
+
+    /* TODO: capture current working dir? */
+  } else {
+    /* failed to find set id */
+    er_err("ER_Add failed to find set id %d @ %s:%d",
+      set_id, __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  return ER_SUCCESS;
+}
+
+/* adds list of files to specified set id */
+int ER_Add_files(int set_id, int count, const char** files)
+{
+  if (count < 0 || (count > 0 && files == NULL)) {
+    er_err("ER_Add_files invalid list of files @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* check that we got a name for every file before adding any */
+  int i;
+  for (i = 0; i < count; i++) {
+    if (files[i] == NULL || files[i][0] == '\0') {
+      er_err("ER_Add_files file %d in list is NULL @ %s:%d",
+        i, __FILE__, __LINE__);
+      return ER_FAILURE;
+    }
+  }
+
+  /* lookup set id */
+  erset* set = erset_get(set_id);
+  if (set == NULL) {
+    /* failed to find set id */
+    er_err("ER_Add_files failed to find set id %d @ %s:%d",
+      set_id, __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* check that we're in the right state */
+  if (set->api_state != ER_API_STATE_CREATED) {
+    /* wrong state */
+    er_err("ER_Add_files called in wrong order @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* append all files at once, files added before are
+   * kept once like with ER_Add */
+  erset_reserve_files(set, count);
+  for (i = 0; i < count; i++) {
+    erset_add_file(set, files[i]);
+  }
+
+  return ER_SUCCESS;
+}
+
+int ER_Set_predecessor(int set_id, const char* name)
+{
+  /* check that we got a name */
+  if (name == NULL || strcmp(name, "") == 0) {
+    er_err("ER_Set_predecessor name parameter is NULL @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* lookup set id */
+  erset* set = erset_get(set_id);
+  if (set == NULL) {
+    /* failed to find set id */
+    er_err("ER_Set_predecessor failed to find set id %d @ %s:%d",
+      set_id, __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* check that we're in the right state */
+  if (set->api_state != ER_API_STATE_CREATED) {
+    /* wrong state */
+    er_err("ER_Set_predecessor called in wrong order @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  if (set->type != ER_DIRECTION_ENCODE) {
+    er_err("ER_Set_predecessor requires a set created with ER_DIRECTION_ENCODE @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  er_free(&set->prev);
+  set->prev = strdup(name);
+
+  return ER_SUCCESS;
+}
+
+int ER_Add_buffer(int set_id, const char* file, const void* buf, size_t size)
+{
+  /* check that we got a file name */
+  if (file == NULL || strcmp(file, "") == 0) {
+    er_err("ER_Add_buffer file parameter is NULL @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  if (buf == NULL && size > 0) {
+    er_err("ER_Add_buffer buf parameter is NULL @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* lookup set id */
+  erset* set = erset_get(set_id);
+  if (set == NULL) {
+    /* failed to find set id */
+    er_err("ER_Add_buffer failed to find set id %d @ %s:%d",
+      set_id, __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* check that we're in the right state */
+  if (set->api_state != ER_API_STATE_CREATED) {
+    /* wrong state */
+    er_err("ER_Add_buffer called in wrong order @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* only an encode writes files */
+  if (set->type != ER_DIRECTION_ENCODE) {
+    er_err("ER_Add_buffer requires a set created with ER_DIRECTION_ENCODE @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* record the buffer, it is written out during dispatch */
+  erbuf* b = erset_add_file(set, file);
+  b->buf   = buf;
+  b->size  = size;
+  b->valid = 1;
+
+  return ER_SUCCESS;
+}
+
+static int er_write_buffer_one(int i, void* arg)
+{
+  erfilejob* job = &((erfilejob*) arg)[i];
+  if (! job->todo) {
+    /* file was added by path */
+    return ER_SUCCESS;
+  }
+
+  uint32_t crc;
+  uint32_t* crcp = job->has_crc ? &crc : NULL;
+  if (er_write_buffer(job->file, job->buf->buf, job->buf->size, crcp) != ER_SUCCESS) {
+    job->todo = 0;
+    return ER_FAILURE;
+  }
+  job->size = (unsigned long) job->buf->size;
+  job->crc  = job->has_crc ? (unsigned long) crc : 0;
+
+  return ER_SUCCESS;
+}
+
+/* write the files of an encode set that were added with ER_Add_buffer,
+ * if records is not NULL, their size and checksum are recorded in it,
+ * returns ER_SUCCESS if all procs in comm_world wrote their buffers */
+static int er_write_buffers(MPI_Comm comm_world, const erset* set, kvtree* records, er_stats* stats)
+{
+  unsigned long bytes = 0;
+  double start = er_stats_begin();
+
+  /* write files concurrently, then record results on this thread */
+  int count = set->num_files;
+  erfilejob* jobs = (erfilejob*) ER_MALLOC(count * sizeof(erfilejob));
+  int i;
+  for (i = 0; i < count; i++) {
+    jobs[i].file    = set->files[i];
+    jobs[i].buf     = &set->bufs[i];
+    jobs[i].todo    = set->bufs[i].valid;
+    jobs[i].has_crc = (records != NULL);
+  }
+
+  int rc = er_io_run(count, er_write_buffer_one, jobs);
+
+  for (i = 0; i < count; i++) {
+    if (! jobs[i].todo) {
+      continue;
+    }
+    bytes += jobs[i].size;
+    if (records != NULL) {
+      kvtree* rec = kvtree_set_kv(records, "FILE", jobs[i].file);
+      kvtree_util_set_bytecount(rec, "SIZE", jobs[i].size);
+      kvtree_util_set_unsigned_long(rec, "CRC32C", jobs[i].crc);
+    }
+  }
+  er_free(&jobs);
+
+  if (! er_alltrue(rc == ER_SUCCESS, comm_world)) {
+    rc = ER_FAILURE;
+  }
+  er_stats_end(stats, ER_PHASE_WRITE, start, 0, bytes, 1);
+
+  return rc;
+}
+
+/* compressed copy or delta of an app file made or restored on an I/O thread */
+typedef struct {
+  const char* file;    /* path to app file */
+  const erbuf* buf;    /* contents of app file, if it was added as a buffer */
+  char* shadow;        /* path to compressed copy or delta */
+  const char* base;    /* path to file delta is taken against, NULL for none */
+  int delta;           /* whether shadow is a delta instead of a compressed copy */
+  int todo;            /* whether this file needs work */
+  int level;           /* zlib level to compress with */
+  int has_crc;         /* whether to checksum file while compressing */
+  uint32_t crc;        /* checksum of app file */
+  unsigned long size;  /* number of bytes in app file */
+  unsigned long zsize; /* number of bytes in compressed copy */
+} erzipjob;
+
+static int er_compress_one(int i, void* arg)
+{
+  erzipjob* job = &((erzipjob*) arg)[i];
+  uint32_t* crc = job->has_crc ? &job->crc : NULL;
+
+  /* files added as buffers are taken from memory instead of read back */
+  const void* mem = job->buf->valid ? job->buf->buf : NULL;
+  size_t mem_size = job->buf->size;
+  int rc;
+  if (job->delta) {
+    rc = er_delta_file(job->file, mem, mem_size, job->base, job->shadow, crc, &job->size, &job->zsize);
+  } else {
+    rc = er_compress_file(job->file, mem, mem_size, job->shadow, job->level, crc, &job->size, &job->zsize);
+  }
+  if (rc != ER_SUCCESS) {
+    job->todo = 0;
+    return ER_FAILURE;
+  }
+  return ER_SUCCESS;
+}
+
+/* write a compressed copy of each file of an encode set with metadata
+ * path path, whose names are returned in shadows, which redundancy is
+ * applied to and shuffile moves instead of the files themselves, records
+ * the checksum of each file if CRC_ON_COPY is set, and the name of its
+ * copy under COMPRESSED/<file>/SHADOW in records, if base is not NULL,
+ * it holds the records of the files of a predecessor set, and deltas
+ * against the file at the same position are written instead, which
+ * is recorded under DELTA and BASE next to SHADOW, and the number of
+ * sets in a row that encoded deltas under DELTA_DEPTH, the caller must free
+ * shadows with er_free_shadows,
+ * returns ER_SUCCESS if all procs in comm_world compressed all files */
+static int er_compress_files(MPI_Comm comm_world, const erset* set, const char* path, const kvtree* base, kvtree* records, char*** shadows, er_stats* stats)
+{
+  int rank_world;
+  MPI_Comm_rank(comm_world, &rank_world);
+
+  double start = er_stats_begin();
+
+  int count = set->num_files;
+  char** names = (char**) ER_MALLOC(count * sizeof(char*));
+  erzipjob* jobs = (erzipjob*) ER_MALLOC(count * sizeof(erzipjob));
+
+  /* find the file of the predecessor at each position, a file that was
+   * rewritten in place no longer holds what the predecessor encoded */
+  const char** bases = (const char**) ER_MALLOC(count * sizeof(char*));
+  int i;
+  for (i = 0; i < count; i++) {
+    bases[i] = NULL;
+  }
+  if (base != NULL) {
+    int depth = 0;
+    kvtree_util_get_int(base, "DELTA_DEPTH", &depth);
+    kvtree_util_set_int(records, "DELTA_DEPTH", depth + 1);
+  }
+  kvtree_elem* elem;
+  for (elem = kvtree_elem_first(kvtree_get(base, "FILE"));
+       elem != NULL;
+       elem = kvtree_elem_next(elem))
+  {
+    int index;
+    const char* file = kvtree_elem_key(elem);
+    if (kvtree_util_get_int(kvtree_elem_hash(elem), "INDEX", &index) == KVTREE_SUCCESS &&
+        index >= 0 && index < count && strcmp(file, set->files[index]) != 0 &&
+        access(file, R_OK) == 0)
+    {
+      bases[index] = file;
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    char shadow[ER_MAX_FILENAME];
+    build_shadow_path(shadow, sizeof(shadow), path, rank_world, i);
+    names[i] = strdup(shadow);
+
+    /* files written from buffers were checksummed on the way out */
+    unsigned long known;
+    kvtree* known_hash = kvtree_get_kv(records, "FILE", set->files[i]);
+    erzipjob* job = &jobs[i];
+    job->file    = set->files[i];
+    job->buf     = &set->bufs[i];
+    job->shadow  = names[i];
+    job->base    = bases[i];
+    job->delta   = (base != NULL);
+    job->todo    = 1;
+    job->level   = set->compress;
+    job->has_crc = (er_crc_on_copy &&
+      kvtree_util_get_unsigned_long(known_hash, "CRC32C", &known) != KVTREE_SUCCESS);
+  }
+
+  /* compress files concurrently, then record results on this thread */
+  int rc = er_io_run(count, er_compress_one, jobs);
+
+  unsigned long bytes_read = 0;
+  unsigned long bytes_written = 0;
+  for (i = 0; i < count; i++) {
+    if (! jobs[i].todo) {
+      continue;
+    }
+    bytes_read    += jobs[i].size;
+    bytes_written += jobs[i].zsize;
+    if (jobs[i].has_crc) {
+      kvtree* rec = kvtree_set_kv(records, "FILE", jobs[i].file);
+      kvtree_util_set_unsigned_long(rec, "CRC32C", (unsigned long) jobs[i].crc);
+    }
+    kvtree* zip = kvtree_set_kv(records, "COMPRESSED", jobs[i].file);
+    kvtree_util_set_str(zip, "SHADOW", jobs[i].shadow);
+    if (jobs[i].delta) {
+      kvtree_util_set_int(zip, "DELTA", 1);
+      if (jobs[i].base != NULL) {
+        kvtree_util_set_str(zip, "BASE", jobs[i].base);
+      }
+    }
+  }
+  er_free(&jobs);
+  er_free(&bases);
+
+  if (! er_alltrue(rc == ER_SUCCESS, comm_world)) {
+    rc = ER_FAILURE;
+  }
+  er_stats_end(stats, ER_PHASE_COMPRESS, start, bytes_read, bytes_written, 1);
+
+  er_dbg(2, "%s %lu bytes into %lu bytes for %s", (base != NULL) ? "Took deltas of" : "Compressed",
+    bytes_read, bytes_written, path);
+
+  *shadows = names;
+  return rc;
+}
+
+/* free list of count names returned by er_compress_files */
+static void er_free_shadows(int count, char*** shadows)
+{
+  int i;
+  for (i = 0; i < count; i++) {
+    er_free(&(*shadows)[i]);
+  }
+  er_free(shadows);
+}
+
+static int er_decompress_one(int i, void* arg)
+{
+  erzipjob* job = &((erzipjob*) arg)[i];
+  int rc;
+  if (job->delta) {
+    rc = er_undelta_file(job->shadow, job->base, job->file, &job->size);
+  } else {
+    rc = er_decompress_file(job->shadow, job->file, &job->size);
+  }
+  if (rc != ER_SUCCESS) {
+    job->todo = 0;
+    return ER_FAILURE;
+  }
+  return ER_SUCCESS;
+}
+
+/* restore files listed under COMPRESSED in records that are missing or
+ * don't have their recorded size from their compressed copies or deltas,
+ * files whose copy or the base of whose delta is missing as well are
+ * skipped, so that they show up as missing when records are verified,
+ * deltas are skipped too unless deltas is set, callers on the migration
+ * thread leave them for the progress thread, which may still be
+ * rebuilding their bases, adds time and bytes to stats if
+ * there are compressed files, this only touches files of this proc */
+static void er_decompress_files(const kvtree* records, int deltas, er_stats* stats)
+{
+  kvtree* zips = kvtree_get(records, "COMPRESSED");
+  int count = kvtree_size(zips);
+  if (count == 0) {
+    return;
+  }
+
+  double start = er_stats_begin();
+
+  erzipjob* jobs = (erzipjob*) ER_MALLOC(count * sizeof(erzipjob));
+  int num = 0;
+  kvtree_elem* elem;
+  for (elem = kvtree_elem_first(zips);
+       elem != NULL;
+       elem = kvtree_elem_next(elem))
+  {
+    const char* file = kvtree_elem_key(elem);
+    kvtree* zip = kvtree_elem_hash(elem);
+    char* shadow = NULL;
+    char* base = NULL;
+    int delta = 0;
+    unsigned long expect_size;
+    struct stat st;
+    if (kvtree_util_get_str(zip, "SHADOW", &shadow) != KVTREE_SUCCESS ||
+        access(shadow, R_OK) != 0)
+    {
+      continue;
+    }
+    kvtree_util_get_int(zip, "DELTA", &delta);
+    kvtree_util_get_str(zip, "BASE", &base);
+    if (delta && ! deltas) {
+      continue;
+    }
+    if (kvtree_util_get_bytecount(kvtree_get_kv(records, "FILE", file), "SIZE", &expect_size) == KVTREE_SUCCESS &&
+        stat(file, &st) == 0 && (unsigned long) st.st_size == expect_size)
+    {
+      /* file is still there, records decide whether it is intact */
+      continue;
+    }
+
+    if (base != NULL && access(base, R_OK) != 0) {
+      er_dbg(1, "Base file %s of %s is missing, rebuild the predecessor set first", base, file);
+      continue;
+    }
+
+    erzipjob* job = &jobs[num];
+    job->file   = file;
+    job->shadow = shadow;
+    job->base   = base;
+    job->delta  = delta;
+    job->todo   = 1;
+    num++;
+  }
+
+  /* a file that fails to decompress is left for verification to report */
+  er_io_run(num, er_decompress_one, jobs);
+
+  unsigned long bytes = 0;
+  int i;
+  for (i = 0; i < num; i++) {
+    if (jobs[i].todo) {
+      bytes += jobs[i].size;
+    }
+  }
+  er_free(&jobs);
+
+  er_stats_end(stats, ER_PHASE_DECOMPRESS, start, 0, bytes, 0);
+}
+
+/* delete the compressed copies of files of the set with metadata path
+ * path that are held on our storage, called by rank 0 of comm_store */
+static void er_remove_shadows(const char* path)
+{
+  /* split path into directory and prefix of copies */
+  char dir[ER_MAX_FILENAME];
+  char prefix[ER_MAX_FILENAME];
+  const char* slash = strrchr(path, '/');
+  if (slash == NULL) {
+    snprintf(dir, sizeof(dir), ".");
+    snprintf(prefix, sizeof(prefix), "%s.z.", path);
+  } else {
+    snprintf(dir, sizeof(dir), "%.*s", (int) (slash - path), path);
+    if (dir[0] == '\0') {
+      snprintf(dir, sizeof(dir), "/");
+    }
+    snprintf(prefix, sizeof(prefix), "%s.z.", slash + 1);
+  }
+
+  DIR* dirp = opendir(dir);
+  if (dirp == NULL) {
+    return;
+  }
+
+  size_t len = strlen(prefix);
+  struct dirent* entry;
+  while ((entry = readdir(dirp)) != NULL) {
+    if (strncmp(entry->d_name, prefix, len) == 0) {
+      char file[ER_MAX_FILENAME];
+      snprintf(file, sizeof(file), "%s/%s", dir, entry->d_name);
+      unlink(file);
+    }
+  }
+  closedir(dirp);
+}
+
+/* copy the redundancy files of a predecessor set with metadata
+ * path base_path and descriptor base to the names they would have in
+ * the set with metadata path path, these are copies rather than links,
+ * since redset rewrites files in place when the predecessor is encoded
+ * or rebuilt again, returns ER_SUCCESS on all procs if all procs
+ * copied all of their files */
+static int er_copy_redundancy(MPI_Comm comm_world, const char* base_path, const erdesc* base, const char* path, int levels, const redset* d)
+{
+  int rank_world;
+  MPI_Comm_rank(comm_world, &rank_world);
+
+  int valid = (base->levels == levels);
+
+  int level;
+  for (level = 0; level < levels && valid; level++) {
+    char base_redset_path[1024];
+    build_redset_path(base_redset_path, sizeof(base_redset_path), base_path, rank_world, level);
+
+    char redset_path[1024];
+    build_redset_path(redset_path, sizeof(redset_path), path, rank_world, level);
+
+    redset_filelist base_list = redset_filelist_get(base_redset_path, base->d[level]);
+    redset_filelist red_list  = redset_filelist_get(redset_path, d[level]);
+
+    int count = redset_filelist_count(red_list);
+    if (redset_filelist_count(base_list) != count) {
+      valid = 0;
+    }
+
+    int i;
+    for (i = 0; i < count && valid; i++) {
+      const char* src = redset_filelist_file(base_list, i);
+      const char* dst = redset_filelist_file(red_list, i);
+      unsigned long size;
+      if (er_copy_file(src, dst, &size) != ER_SUCCESS) {
+        valid = 0;
+      }
+    }
+
+    redset_filelist_release(&red_list);
+    redset_filelist_release(&base_list);
+  }
+
+  return er_alltrue(valid, comm_world) ? ER_SUCCESS : ER_FAILURE;
+}
+
+/* apply each level of redundancy to files and register them with shuffile,
+ * if records is not NULL, record size, mtime, and if CRC_ON_COPY is
+ * set, checksum of the app files and redundancy files in it, if base
+ * is not NULL, it is the cached descriptor of a predecessor set with
+ * metadata path base_path encoded with the same scheme, whose
+ * redundancy data is reused if no proc has changed any of its files,
+ * if shadows is not NULL, it lists compressed copies of the files that
+ * redundancy is applied to instead, while the files themselves are
+ * compared with the predecessor, adds time spent in each phase to stats,
+ * caller is responsible for updating the state of the set */
+static int er_encode(MPI_Comm comm_world, MPI_Comm comm_store, int num_files, const char** filenames, const char** shadows, const char* path, erscheme* scheme, const char* base_path, const erdesc* base, kvtree* records, er_stats* stats)
+{
+  int rc = ER_SUCCESS;
+
+  /* get redundancy descriptor of each level */
+  redset d[ER_MAX_LEVELS];
+  int levels = erscheme_descs(scheme, d);
+
+  int rank_world;
+  MPI_Comm_rank(comm_world, &rank_world);
+
+  /* build name of shuffile file */
+  char shuffile_file[1024];
+  build_shuffile_path(shuffile_file, sizeof(shuffile_file), path);
+
+  /* size and mtime of app files, along with checksums of files
+   * we wrote from buffers, let a successor set find out whether
+   * it can reuse our redundancy data */
+  kvtree* app = kvtree_new();
+  if (records != NULL) {
+    kvtree_merge(app, records);
+  }
+  er_records_stat(app, num_files, filenames);
+
+  /* a successor that encodes deltas pairs its files with ours by position */
+  int i;
+  for (i = 0; i < num_files; i++) {
+    kvtree_util_set_int(kvtree_get_kv(app, "FILE", filenames[i]), "INDEX", i);
+  }
+
+  /* if none of the files changed since the predecessor was encoded,
+   * its redundancy data is valid for this set as well, callers pass
+   * no predecessor for sets that encode compressed copies */
+  const char** redfiles = (shadows != NULL) ? shadows : filenames;
+  double start;
+  int reused = 0;
+  if (base != NULL) {
+    start = er_stats_begin();
+    int same = er_records_same(base->files, app, num_files, filenames);
+    if (er_alltrue(same, comm_world)) {
+      reused = (er_copy_redundancy(comm_world, base_path, base, path, levels, d) == ER_SUCCESS);
+    }
+    er_stats_end(stats, ER_PHASE_REUSE, start, 0, 0, reused ? 2 : 1);
+  }
+
+  /* apply each level of redundancy to the app files,
+   * and get list of files recording redundancy data */
+  start = er_stats_begin();
+  int red_count = 0;
+  redset_filelist red_lists[ER_MAX_LEVELS];
+  int level;
+  for (level = 0; level < levels; level++) {
+    /* TODO: read process name from scheme? */
+    char redset_path[1024];
+    build_redset_path(redset_path, sizeof(redset_path), path, rank_world, level);
+
+    if (! reused && redset_apply(num_files, redfiles, redset_path, d[level]) != REDSET_SUCCESS) {
+      /* failed to apply redundancy descriptor */
+      rc = ER_FAILURE;
+    }
+
+    red_lists[level] = redset_filelist_get(redset_path, d[level]);
+    red_count += redset_filelist_count(red_lists[level]);
+  }
+
+  /* allocate space for a new file list to include both app files and redundancy files */
+  int count = num_files + red_count;
+  const char** filenames2 = (const char**) ER_MALLOC(count * sizeof(char*));
+
+  /* fill in list of file names */
+  for (i = 0; i < num_files; i++) {
+    /* application files or their compressed copies */
+    filenames2[i] = redfiles[i];
+  }
+  int j = num_files;
+  for (level = 0; level < levels; level++) {
+    /* redundancy files */
+    int level_count = redset_filelist_count(red_lists[level]);
+    for (i = 0; i < level_count; i++) {
+      filenames2[j++] = redset_filelist_file(red_lists[level], i);
+    }
+  }
+
+  if (! reused) {
+    er_stats_end(stats, ER_PHASE_APPLY, start,
+      er_stats_bytes(num_files, redfiles),
+      er_stats_bytes(red_count, &filenames2[num_files]), (unsigned long) levels);
+
+    /* redset moved these bytes at its own pace, so we make up for it
+     * before we go on */
+    er_io_charge_files(count, filenames2);
+  }
+
+  /* associate list of both app files and redundancy files with calling process */
+  start = er_stats_begin();
+  if (shuffile_create(comm_world, comm_store, count, filenames2, shuffile_file) != SHUFFILE_SUCCESS) {
+    /* failed to register files with shuffile */
+    rc = ER_FAILURE;
+  }
+  er_stats_end(stats, ER_PHASE_CREATE, start, 0, 0, 1);
+
+  /* checksum app and redundancy files, redset has just read or
+   * written all of them, so this is served from the page cache */
+  if (records != NULL) {
+    kvtree_merge(records, app);
+    if (shadows != NULL) {
+      er_records_stat(records, num_files, shadows);
+    }
+    er_records_stat(records, red_count, &filenames2[num_files]);
+  }
+  if (records != NULL && er_crc_on_copy) {
+    start = er_stats_begin();
+    int valid = 0;
+    if (rc == ER_SUCCESS) {
+      valid = (er_records_build(records, count, filenames2) == ER_SUCCESS);
+    }
+    if (! er_alltrue(valid, comm_world)) {
+      rc = ER_FAILURE;
+    }
+    er_stats_end(stats, ER_PHASE_CHECKSUM, start,
+      er_stats_bytes(count, filenames2), 0, 1);
+  }
+
+  /* free the new file list */
+  er_free(&filenames2);
+  for (level = 0; level < levels; level++) {
+    redset_filelist_release(&red_lists[level]);
+  }
+
+  /* remember descriptors so we can delete redundancy data later on,
+   * and the state of our files for a successor set */
+  if (rc == ER_SUCCESS) {
+    erdesc_put(path, levels, d, scheme, comm_world, app);
+  } else {
+    kvtree_delete(&app);
+    erdesc_drop(path);
+  }
+
+  return rc;
+}
+
+/* check the files of this proc in needed, used by a rebuild that only
+ * needs some of the files of its set, restores files missing from
+ * their compressed copies first, and from their deltas if deltas is
+ * set, if unlink_bad is set, deletes files
+ * that don't match their records, adds files that match to ready
+ * (if not NULL), returns 1 on all procs if every proc has every file
+ * it needs */
+static int er_rebuild_needed(MPI_Comm comm_world, const kvtree* needed, int unlink_bad, int deltas, kvtree* ready, er_stats* stats)
+{
+  er_decompress_files(needed, deltas, stats);
+
+  unsigned long bytes = 0;
+  double start = er_stats_begin();
+  kvtree* good = kvtree_new();
+  int have = (er_records_verify(needed, unlink_bad, er_crc_on_copy, NULL, &bytes, good) == ER_SUCCESS);
+
+  if (ready != NULL) {
+    pthread_mutex_lock(&er_async_mutex);
+    kvtree_merge(ready, good);
+    pthread_cond_broadcast(&er_async_cond);
+    pthread_mutex_unlock(&er_async_mutex);
+  }
+  kvtree_delete(&good);
+
+  have = er_alltrue(have, comm_world);
+  er_stats_end(stats, ER_PHASE_CHECKSUM, start, bytes, 0, 1);
+
+  return have;
+}
+
+/* migrate files of set to their owners, deletes files that don't
+ * match their records, files found intact are added to ready (if not
+ * NULL) under FILE/<file>, returns 1 on all procs if every proc holds
+ * all of its files afterwards and there is nothing to recover, if
+ * needed is not NULL, it holds the records of the files this proc
+ * needs, which must be given on all procs, then nothing is moved if
+ * every proc has those files already, and nothing is recovered if
+ * they all arrived intact, files that are not needed are left for a
+ * later rebuild, this may run on a different thread than
+ * er_rebuild_recover as long as it is given its own communicators,
+ * so it must not touch our caches, and with deltas unset, so that
+ * files restored from deltas are left for er_rebuild_recover */
+static int er_rebuild_migrate(MPI_Comm comm_world, MPI_Comm comm_store, const char* path, const kvtree* records, const kvtree* needed, int deltas, kvtree* ready, er_stats* stats)
+{
+  /* the files we need may not have gone anywhere */
+  if (needed != NULL && er_rebuild_needed(comm_world, needed, 0, deltas, ready, stats)) {
+    return 1;
+  }
+
+  /* build name of shuffile file */
+  char shuffile_file[1024];
+  build_shuffile_path(shuffile_file, sizeof(shuffile_file), path);
+
+  /* TODO: update state to SHUFFLE */
+
+  /* migrate files back to ranks in case of new rank-to-node mapping */
+  double start = er_stats_begin();
+  shuffile_migrate(comm_world, comm_store, shuffile_file);
+  er_stats_end(stats, ER_PHASE_MIGRATE, start, 0, 0, 1);
+
+  /* if the files we need arrived intact, we are done */
+  if (needed != NULL && er_rebuild_needed(comm_world, needed, 1, deltas, ready, stats)) {
+    return 1;
+  }
+
+  /* only compressed copies of files move, restore the files we lack */
+  er_decompress_files(records, deltas, stats);
+
+  /* delete files that were damaged at rest or in transit,
+   * so that redset treats them as lost and rebuilds them,
+   * if nobody lost anything, there is nothing to recover,
+   * we can't tell if we don't know which files we should have */
+  unsigned long bytes = 0;
+  start = er_stats_begin();
+  kvtree* good = kvtree_new();
+  int complete = (kvtree_size(kvtree_get(records, "FILE")) > 0 &&
+                  er_records_verify(records, 1, er_crc_on_copy, NULL, &bytes, good) == ER_SUCCESS);
+
+  /* let ER_Wait_file callers use intact files while we recover the rest */
+  if (ready != NULL) {
+    pthread_mutex_lock(&er_async_mutex);
+    kvtree_merge(ready, good);
+    pthread_cond_broadcast(&er_async_cond);
+    pthread_mutex_unlock(&er_async_mutex);
+  }
+  kvtree_delete(&good);
+
+  complete = er_alltrue(complete, comm_world);
+  er_stats_end(stats, ER_PHASE_CHECKSUM, start, bytes, 0, 1);
+
+  return complete;
+}
+
+/* rebuild files of set that migrated with er_rebuild_migrate,
+ * complete is what that returned, if records is not empty,
+ * rebuilt files are verified against it, scheme holds the scheme
+ * metadata from the state file (may be NULL), levels are tried
+ * cheapest first and wider levels only run if files are still
+ * missing, which includes redundancy files of wider levels lost
+ * along with the app files, after a wider level rebuilt the app
+ * files, narrower levels that failed before are tried again to
+ * restore their redundancy files */
+static int er_rebuild_recover(MPI_Comm comm_world, const char* path, const kvtree* records, const kvtree* scheme, int complete, er_stats* stats)
+{
+  int rc = ER_SUCCESS;
+
+  if (complete) {
+    /* we did not recover a descriptor, so drop what we had cached */
+    erdesc_drop(path);
+    return rc;
+  }
+
+  /* TODO: read process name from scheme? */
+  int rank_world;
+  MPI_Comm_rank(comm_world, &rank_world);
+
+  /* TODO: update state to RECOVER */
+
+  /* the first recovery is charged for agreeing on the levels */
+  double start = er_stats_begin();
+  int levels = er_state_levels(comm_world, scheme);
+  unsigned long collectives = 2;
+
+  /* rebuild files, with several levels, a second pass goes back to
+   * levels that failed while a wider level was still missing */
+  redset d[ER_MAX_LEVELS];
+  int have[ER_MAX_LEVELS] = {0};
+  int recovered = 0;
+  int valid = 0;
+  unsigned long bytes = 0;
+  int passes = (levels > 1) ? 2 : 1;
+  int pass, level;
+  for (pass = 0; pass < passes && ! valid; pass++) {
+    for (level = 0; level < levels && ! valid; level++) {
+      if (have[level] || (pass > 0 && ! recovered)) {
+        continue;
+      }
+
+      /* build path to redset file for this process */
+      char redset_path[1024];
+      build_redset_path(redset_path, sizeof(redset_path), path, rank_world, level);
+
+      if (collectives == 1) {
+        start = er_stats_begin();
+      }
+      int recover_rc = redset_recover(comm_world, redset_path, &d[level]);
+      er_stats_end(stats, ER_PHASE_RECOVER, start, 0, 0, collectives);
+      collectives = 1;
+      if (recover_rc != REDSET_SUCCESS) {
+        /* rebuild failed, rc is same value across comm_world */
+        redset_delete(&d[level]);
+        if (level + 1 < levels) {
+          er_dbg(1, "Level %d could not rebuild %s, trying next level", level, path);
+        }
+        continue;
+      }
+      have[level] = 1;
+      recovered++;
+
+      /* restore files whose compressed copy was rebuilt */
+      er_decompress_files(records, 1, stats);
+
+      /* check that we got back what was encoded */
+      start = er_stats_begin();
+      valid = er_alltrue(er_records_verify(records, 0, er_crc_on_copy, NULL, &bytes, NULL) == ER_SUCCESS, comm_world);
+      er_stats_end(stats, ER_PHASE_CHECKSUM, start, bytes, 0, 1);
+      bytes = 0;
+    }
+  }
+
+  if (recovered == 0) {
+    rc = ER_FAILURE;
+  } else if (! valid) {
+    er_err("Rebuilt files do not match their records @ %s:%d",
+      __FILE__, __LINE__);
+    rc = ER_FAILURE;
+  }
+
+  /* hand descriptors to our cache so we can delete redundancy data
+   * later on, we only know how to do that for all levels if we
+   * recovered a descriptor for each of them */
+  if (rc == ER_SUCCESS && recovered == levels) {
+    erdesc_put(path, levels, d, NULL, comm_world, NULL);
+  } else {
+    for (level = 0; level < levels; level++) {
+      if (have[level]) {
+        redset_delete(&d[level]);
+      }
+    }
+    erdesc_drop(path);
+  }
+
+  return rc;
+}
+
+/* migrate files to their owners and rebuild missing files, records
+ * holds what was recorded for our files at encode, files that don't
+ * match their records are rebuilt as well, if after migrating all procs
+ * have all of their files, recovery is skipped, otherwise all files are
+ * verified after recovery, files found intact after migrating are
+ * added to ready (if not NULL) under FILE/<file>, scheme holds the
+ * scheme metadata of the state file (may be NULL), adds time spent in
+ * each phase to stats, caller is responsible for checking and updating
+ * the state of the set */
+static int er_rebuild(MPI_Comm comm_world, MPI_Comm comm_store, const char* path, const kvtree* records, const kvtree* needed, const kvtree* scheme, kvtree* ready, er_stats* stats)
+{
+  int complete = er_rebuild_migrate(comm_world, comm_store, path, records, needed, 1, ready, stats);
+  return er_rebuild_recover(comm_world, path, records, scheme, complete, stats);
+}
+
+/* check that the files of this proc listed in records, which include
+ * the redundancy files of every level, are present with their recorded
+ * sizes and checksums, and that the storage group still has the
+ * shuffile map of the set with metadata path path, reads at most bw
+ * bytes per second (0 for no limit) and never moves or modifies
+ * files, sets bad to the number of procs in comm_world that found a
+ * missing or damaged file, adds time and bytes to stats,
+ * returns ER_SUCCESS if no proc did */
+static int er_verify(MPI_Comm comm_world, MPI_Comm comm_store, const char* path, const kvtree* records, unsigned long bw, int* bad, er_stats* stats)
+{
+  int rank_store;
+  MPI_Comm_rank(comm_store, &rank_store);
+
+  double start = er_stats_begin();
+
+  er_throttle throttle;
+  er_throttle_init(&throttle, bw);
+
+  /* we can't tell if we don't know which files we should have */
+  unsigned long bytes = 0;
+  int valid = (kvtree_size(kvtree_get(records, "FILE")) > 0 &&
+               er_records_verify(records, 0, 1, &throttle, &bytes, NULL) == ER_SUCCESS);
+
+  er_throttle_free(&throttle);
+
+  if (rank_store == 0) {
+    char shuffile_file[1024];
+    build_shuffile_path(shuffile_file, sizeof(shuffile_file), path);
+    if (access(shuffile_file, R_OK) != 0) {
+      er_warn("Missing shuffile map %s @ %s:%d",
+        shuffile_file, __FILE__, __LINE__);
+      valid = 0;
+    }
+  }
+
+  int mine = ! valid;
+  double trace_start = ER_TRACE_BEGIN();
+  MPI_Allreduce(&mine, bad, 1, MPI_INT, MPI_SUM, comm_world);
+  ER_TRACE_END(ER_TRACE_COLL, "er_verify", trace_start, mine);
+  er_stats_end(stats, ER_PHASE_VERIFY, start, bytes, 0, 1);
+
+  er_dbg(2, "Verified %s, %d procs found missing or damaged files", path, *bad);
+
+  return (*bad == 0) ? ER_SUCCESS : ER_FAILURE;
+}
+
+/* migrations of the rebuild sets of a batch, which a helper thread
+ * runs one after another on its own dups of the communicators while
+ * the progress thread recovers the sets whose migration finished,
+ * every proc runs the migrations in the same order on them */
+typedef struct {
+  MPI_Comm comm_world; /* dup of comm_world reserved for migrations */
+  MPI_Comm comm_store; /* dup of comm_store reserved for migrations */
+  int count;           /* number of sets in list */
+  erset** sets;        /* sets to be migrated */
+  char** paths;        /* metadata path of each set */
+  kvtree** records;    /* file records of each set */
+  kvtree** needed;     /* records of the files needed of each set, or NULL */
+  int* complete;       /* result of er_rebuild_migrate for each set */
+  int finished;        /* number of sets that have been migrated */
+  int go;              /* 1 to migrate, 0 to quit, -1 until all procs started their thread */
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} erpipeline;
+
+static void* er_pipeline_main(void* arg)
+{
+  erpipeline* p = (erpipeline*) arg;
+
+  /* wait until we know every proc is running its thread */
+  pthread_mutex_lock(&p->mutex);
+  while (p->go < 0) {
+    pthread_cond_wait(&p->cond, &p->mutex);
+  }
+  int go = p->go;
+  pthread_mutex_unlock(&p->mutex);
+  if (! go) {
+    return NULL;
+  }
+
+  int i;
+  for (i = 0; i < p->count; i++) {
+    erset* set = p->sets[i];
+    /* deltas of a set may be based on files of an earlier set,
+     * which the progress thread may not have rebuilt yet */
+    int complete = er_rebuild_migrate(p->comm_world, p->comm_store,
+      p->paths[i], p->records[i], p->needed[i], 0, set->ready, &set->stats);
+
+    pthread_mutex_lock(&p->mutex);
+    p->complete[i] = complete;
+    p->finished++;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+  }
+
+  return NULL;
+}
+
+/* start migrating count sets in the background on comm_world_aux and
+ * comm_store_aux, which nothing else uses meanwhile, collective over
+ * comm_world, returns NULL if migrations can't be run in the background */
+static erpipeline* er_pipeline_start(MPI_Comm comm_world,
+  MPI_Comm comm_world_aux, MPI_Comm comm_store_aux,
+  int count, erset** sets, char** paths, kvtree** records, kvtree** needed)
+{
+  erpipeline* p = (erpipeline*) ER_MALLOC(sizeof(erpipeline));
+  p->count    = count;
+  p->sets     = sets;
+  p->paths    = paths;
+  p->records  = records;
+  p->needed   = needed;
+  p->complete = (int*) ER_MALLOC(count * sizeof(int));
+  p->finished = 0;
+  p->go       = -1;
+  pthread_mutex_init(&p->mutex, NULL);
+  pthread_cond_init(&p->cond, NULL);
+
+  /* migrations get their own comms so that their collectives
+   * can't match the ones we issue for recovery meanwhile */
+  p->comm_world = comm_world_aux;
+  p->comm_store = comm_store_aux;
+
+  /* all procs have to agree on whether the pipeline runs,
+   * threads wait for the verdict before issuing any collective */
+  int started = (pthread_create(&p->thread, NULL, er_pipeline_main, (void*) p) == 0);
+  int go = er_alltrue(started, comm_world);
+
+  if (started) {
+    pthread_mutex_lock(&p->mutex);
+    p->go = go;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+  }
+
+  if (! go) {
+    er_warn("Failed to start rebuild pipeline, migrating sets one at a time @ %s:%d",
+      __FILE__, __LINE__);
+    if (started) {
+      pthread_join(p->thread, NULL);
+    }
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->mutex);
+    er_free(&p->complete);
+    er_free(&p);
+    return NULL;
+  }
+
+  return p;
+}
+
+/* wait for migration of set i in list to finish, returns its result */
+static int er_pipeline_wait(erpipeline* p, int i)
+{
+  pthread_mutex_lock(&p->mutex);
+  while (p->finished <= i) {
+    pthread_cond_wait(&p->cond, &p->mutex);
+  }
+  int complete = p->complete[i];
+  pthread_mutex_unlock(&p->mutex);
+  return complete;
+}
+
+/* wait for all migrations and free pipeline */
+static void er_pipeline_finish(erpipeline** ptr)
+{
+  erpipeline* p = *ptr;
+  pthread_join(p->thread, NULL);
+  pthread_cond_destroy(&p->cond);
+  pthread_mutex_destroy(&p->mutex);
+  er_free(&p->complete);
+  er_free(ptr);
+}
+
+/* delete copies of the redundancy files of redset descriptor d with
+ * path redset_path from the flush directory dir */
+static void er_remove_flushed(const char* dir, const char* redset_path, redset d)
+{
+  redset_filelist list = redset_filelist_get(redset_path, d);
+  int i;
+  for (i = 0; i < redset_filelist_count(list); i++) {
+    char file[ER_MAX_FILENAME];
+    build_flush_path(file, sizeof(file), dir, redset_filelist_file(list, i), -1);
+    unlink(file);
+  }
+  redset_filelist_release(&list);
+}
+
+/* delete redundancy data of each level and association data along
+ * with the state file, and the copies of all of them in the directory
+ * the set was flushed to, scheme holds the scheme metadata of the state
+ * file (may be NULL), adds time spent in each phase to stats,
+ * caller is responsible for marking the set as CORRUPT beforehand */
+static int er_remove(MPI_Comm comm_world, MPI_Comm comm_store, const char* path, const kvtree* scheme, er_stats* stats)
+{
+  int rc = ER_SUCCESS;
+
+  /* get process name */
+  int rank_world;
+  MPI_Comm_rank(comm_world, &rank_world);
+
+  /* get rank within storage group */
+  int rank_store;
+  MPI_Comm_rank(comm_store, &rank_store);
+
+  /* build name of er state file */
+  char er_file[1024];
+  build_er_path(er_file, sizeof(er_file), path);
+
+  /* build name of shuffile file */
+  char shuffile_file[1024];
+  build_shuffile_path(shuffile_file, sizeof(shuffile_file), path);
+
+  /* delete association information */
+  double start = er_stats_begin();
+  shuffile_remove(comm_world, comm_store, shuffile_file);
+
+  er_stats_end(stats, ER_PHASE_REMOVE, start, 0, 0, 1);
+
+  /* every proc deletes its own flushed redundancy files, but only
+   * the first proc of the storage group read the state file */
+  char flush_dir[ER_MAX_FILENAME];
+  flush_dir[0] = '\0';
+  char* dir;
+  if (rank_store == 0 &&
+      kvtree_util_get_str(kvtree_get(scheme, "SCHEME"), "FLUSH_DIR", &dir) == KVTREE_SUCCESS)
+  {
+    snprintf(flush_dir, sizeof(flush_dir), "%s", dir);
+  }
+  start = er_stats_begin();
+  double trace_start = ER_TRACE_BEGIN();
+  MPI_Bcast(flush_dir, (int) sizeof(flush_dir), MPI_CHAR, 0, comm_store);
+  ER_TRACE_END(ER_TRACE_COLL, "er_remove", trace_start, 1);
+  er_stats_end(stats, ER_PHASE_REMOVE, start, 0, 0, 1);
+  int flushed = (flush_dir[0] != '\0');
+
+  /* delete redundancy data, we only need to recover the
+   * descriptor if we didn't encode or rebuild the set ourselves */
+  erdesc* desc = erdesc_get(path, comm_world);
+  int levels = (desc != NULL) ? desc->levels : er_state_levels(comm_world, scheme);
+  int level;
+  for (level = 0; level < levels; level++) {
+    /* build path to redset file for this process */
+    char redset_path[1024];
+    build_redset_path(redset_path, sizeof(redset_path), path, rank_world, level);
+
+    if (desc != NULL) {
+      if (flushed) {
+        er_remove_flushed(flush_dir, redset_path, desc->d[level]);
+      }
+      start = er_stats_begin();
+      redset_unapply(redset_path, desc->d[level]);
+      er_stats_end(stats, ER_PHASE_UNAPPLY, start, 0, 0, 1);
+    } else {
+      redset d;
+      start = er_stats_begin();
+      redset_recover(comm_world, redset_path, &d);
+      er_stats_end(stats, ER_PHASE_RECOVER, start, 0, 0, 1);
+
+      if (flushed) {
+        er_remove_flushed(flush_dir, redset_path, d);
+      }
+      start = er_stats_begin();
+      redset_unapply(redset_path, d);
+      er_stats_end(stats, ER_PHASE_UNAPPLY, start, 0, 0, 1);
+      redset_delete(&d);
+    }
+  }
+  erdesc_drop(path);
+
+  /* delete compressed copies or deltas of files, if the set had any,
+   * only now that recovering a descriptor can't restore them again */
+  int compress = 0;
+  int delta = 0;
+  if (rank_store == 0) {
+    kvtree_util_get_int(kvtree_get(scheme, "SCHEME"), "COMPRESS", &compress);
+    kvtree_util_get_int(kvtree_get(scheme, "SCHEME"), "DELTA", &delta);
+  }
+  if (compress || delta) {
+    er_remove_shadows(path);
+  }
+
+  /* delete er state file, along with the copies of it and of
+   * the shuffile map the first proc of the group flushed */
+  if (rank_store == 0) {
+    unlink(er_file);
+    kvtree_unset_kv(er_states, "FILE", er_file);
+    if (flushed) {
+      char file[ER_MAX_FILENAME];
+      build_flush_path(file, sizeof(file), flush_dir, shuffile_file, rank_world);
+      unlink(file);
+      build_flush_path(file, sizeof(file), flush_dir, er_file, rank_world);
+      unlink(file);
+    }
+  }
 
-    /* add file to set */
-    kvtree_set_kv(set->files, "FILE", file);
+  return rc;
+}
 
-    /* TODO: capture current working dir? */
-  } else {
-    /* failed to find set id */
-    er_err("ER_Add failed to find set id %d @ %s:%d",
-      set_id, __FILE__, __LINE__);
-    return ER_FAILURE;
-  }
+/* copy of a file to the flush tier made on an I/O thread */
+typedef struct {
+  char* src;          /* path to file on node-local storage */
+  char* dst;          /* path to copy in flush directory */
+  unsigned long size; /* number of bytes copied */
+} erflushjob;
 
-  return ER_SUCCESS;
+static int er_flush_one(int i, void* arg)
+{
+  erflushjob* job = &((erflushjob*) arg)[i];
+  return er_copy_file(job->src, job->dst, &job->size);
 }
 
-static int er_encode(MPI_Comm comm_world, MPI_Comm comm_store, int num_files, const char** filenames, const char* path, redset d)
+/* add job to copy src into dir under the name given by build_flush_path */
+static void er_flush_add(erflushjob* jobs, int* count, const char* dir, const char* src, int suffix)
 {
-  int rc = ER_SUCCESS;
+  char dst[ER_MAX_FILENAME];
+  build_flush_path(dst, sizeof(dst), dir, src, suffix);
+
+  erflushjob* job = &jobs[*count];
+  job->src  = strdup(src);
+  job->dst  = strdup(dst);
+  job->size = 0;
+  (*count)++;
+}
 
+/* copy redundancy files of each level of the set encoded with metadata
+ * path path into dir, along with the shuffile map and the state file
+ * from the first proc of each storage group, must be called after the
+ * state file of the set has been updated to ENCODED, adds time and
+ * bytes to stats, returns ER_SUCCESS if all procs copied all files */
+static int er_flush(MPI_Comm comm_world, MPI_Comm comm_store, const char* path, const char* dir, er_stats* stats)
+{
   int rank_world;
   MPI_Comm_rank(comm_world, &rank_world);
 
   int rank_store;
   MPI_Comm_rank(comm_store, &rank_store);
 
-  /* build name of shuffile file */
-  char shuffile_file[1024];
-  build_shuffile_path(shuffile_file, sizeof(shuffile_file), path);
+  double start = er_stats_begin();
 
-  /* TODO: read process name from scheme? */
-  char redset_path[1024];
-  build_redset_path(redset_path, sizeof(redset_path), path, rank_world);
+  /* the descriptor of each level was cached when the set was encoded */
+  erdesc* desc = erdesc_get(path, comm_world);
+  int valid = (desc != NULL);
 
-  /* update data state to CORRUPT */
-  er_state_write(comm_world, comm_store, path, ER_STATE_CORRUPT);
+  /* the directory is shared by all procs, so whoever gets there first creates it */
+  if (valid && mkdir(dir, S_IRWXU) != 0 && errno != EEXIST) {
+    er_err("Failed to create flush directory %s: %s @ %s:%d",
+      dir, strerror(errno), __FILE__, __LINE__);
+    valid = 0;
+  }
 
-  /* apply redundancy */
-  if (redset_apply(num_files, filenames, redset_path, d) != REDSET_SUCCESS) {
-    /* failed to apply redundancy descriptor */
-    rc = ER_FAILURE;
+  int max = 2;
+  redset_filelist lists[ER_MAX_LEVELS];
+  int levels = valid ? desc->levels : 0;
+  int level;
+  for (level = 0; level < levels; level++) {
+    char redset_path[1024];
+    build_redset_path(redset_path, sizeof(redset_path), path, rank_world, level);
+    lists[level] = redset_filelist_get(redset_path, desc->d[level]);
+    max += redset_filelist_count(lists[level]);
   }
 
-  /* get list of files recording redudancy data */
-  redset_filelist red_list = redset_filelist_get(redset_path, d);
+  erflushjob* jobs = (erflushjob*) ER_MALLOC(max * sizeof(erflushjob));
+  int count = 0;
+  for (level = 0; level < levels; level++) {
+    int i;
+    for (i = 0; i < redset_filelist_count(lists[level]); i++) {
+      er_flush_add(jobs, &count, dir, redset_filelist_file(lists[level], i), -1);
+    }
+    redset_filelist_release(&lists[level]);
+  }
 
-  /* allocate space for a new file list to include both app files and redundancy files */
-  int red_count = redset_filelist_count(red_list);
-  int count = num_files + red_count;
-  const char** filenames2 = (const char**) ER_MALLOC(count * sizeof(char*));
+  if (valid && rank_store == 0) {
+    char shuffile_file[1024];
+    build_shuffile_path(shuffile_file, sizeof(shuffile_file), path);
+    if (access(shuffile_file, R_OK) == 0) {
+      er_flush_add(jobs, &count, dir, shuffile_file, rank_world);
+    }
 
-  /* fill in list of file names */
-  int i;
-  for (i = 0; i < num_files; i++) {
-    /* application files */
-    filenames2[i] = filenames[i];
+    char er_file[1024];
+    build_er_path(er_file, sizeof(er_file), path);
+    er_flush_add(jobs, &count, dir, er_file, rank_world);
   }
-  for (i = 0; i < red_count; i++) {
-    /* redundancy files */
-    filenames2[num_files + i] = redset_filelist_file(red_list, i);
+
+  if (valid && er_io_run(count, er_flush_one, jobs) != ER_SUCCESS) {
+    valid = 0;
   }
 
-  /* associate list of both app files and redundancy files with calling process */
-  if (shuffile_create(comm_world, comm_store, count, filenames2, shuffile_file) != SHUFFILE_SUCCESS) {
-    /* failed to register files with shuffile */
-    rc = ER_FAILURE;
+  unsigned long bytes = 0;
+  int i;
+  for (i = 0; i < count; i++) {
+    bytes += jobs[i].size;
+    er_free(&jobs[i].src);
+    er_free(&jobs[i].dst);
   }
+  er_free(&jobs);
 
-  /* free the new file list */
-  er_free(&filenames2);
-  redset_filelist_release(&red_list);
+  int rc = er_alltrue(valid, comm_world) ? ER_SUCCESS : ER_FAILURE;
+  er_stats_end(stats, ER_PHASE_FLUSH, start, bytes, bytes, 1);
 
-  /* TODO: if successful, update state to ENCODED, otherwise CORRUPT */
-  if (rc == ER_SUCCESS) {
-    er_state_write(comm_world, comm_store, path, ER_STATE_ENCODED);
-  }
+  er_dbg(2, "Flushed %lu bytes of %s to %s", bytes, path, dir);
 
   return rc;
 }
 
-static int er_rebuild(MPI_Comm comm_world, MPI_Comm comm_store, const char* path)
+/* a list of sets dispatched together */
+typedef struct {
+  int count;
+  erset** sets;
+  int async; /* whether the batch runs on the progress thread */
+} erbatch;
+
+/* execute encode/rebuild/remove operations for a batch of sets,
+ * this is collective over the world communicator shared by the sets,
+ * state agreement and state updates are done once for the whole
+ * batch rather than once per set, records result in each set */
+static void er_dispatch_exec(const erbatch* batch)
 {
-  int rc = ER_SUCCESS;
+  int count     = batch->count;
+  erset** sets  = batch->sets;
 
-  /* read state file and ensure data is encoded */
-  int state;
-  er_state_read(comm_world, comm_store, path, &state);
-  if (state != ER_STATE_ENCODED) {
-    /* if it's not encoded, we can't attempt rebuild */
-    return ER_FAILURE;
+  /* all sets in a batch share congruent communicators */
+  MPI_Comm comm_world = sets[0]->world->comm;
+  MPI_Comm comm_store = sets[0]->store->comm;
+
+  /* procs in our storage group share the I/O thread and bandwidth limits */
+  er_io_configure(comm_store, batch->async);
+
+  int rank_store;
+  MPI_Comm_rank(comm_store, &rank_store);
+
+  /* TODO: allow caller to specify this prefix? */
+  /* define prefix to use on all metadata files */
+  char** paths = (char**) ER_MALLOC(count * sizeof(char*));
+  int* rcs     = (int*)   ER_MALLOC(count * sizeof(int));
+  int* states  = (int*)   ER_MALLOC(count * sizeof(int));
+  long* epochs = (long*)  ER_MALLOC(count * sizeof(long));
+  int i;
+  for (i = 0; i < count; i++) {
+    paths[i] = (char*) ER_MALLOC(ER_MAX_FILENAME);
+    snprintf(paths[i], ER_MAX_FILENAME, "%s.er", sets[i]->name);
+    rcs[i] = ER_SUCCESS;
+    epochs[i] = 0;
   }
 
-  /* TODO: read process name from scheme? */
-  int rank_world;
-  MPI_Comm_rank(comm_world, &rank_world);
+  /* size, mtime, and checksum of files of this proc in each set,
+   * which are stored in the state file, so that a rebuild can tell
+   * whether anything was lost or damaged, sets that are found to be
+   * intact on rebuild skip all further work */
+  kvtree** records = (kvtree**) ER_MALLOC(count * sizeof(kvtree*));
+  kvtree** schemes = (kvtree**) ER_MALLOC(count * sizeof(kvtree*));
+  int* intact      = (int*)     ER_MALLOC(count * sizeof(int));
+  int num_encode = 0;
+  for (i = 0; i < count; i++) {
+    records[i] = NULL;
+    schemes[i] = NULL;
+    intact[i]  = 0;
+    if (sets[i]->type == ER_DIRECTION_ENCODE) {
+      records[i] = kvtree_new();
+      schemes[i] = kvtree_new();
+      er_state_scheme(schemes[i], comm_world, sets[i]->scheme, sets[i]->compress,
+        sets[i]->delta && sets[i]->prev != NULL, sets[i]->flush_dir);
+      num_encode++;
+    } else if (sets[i]->type == ER_DIRECTION_REMOVE && rank_store == 0) {
+      /* a remove needs the scheme to find every level of redundancy */
+      char er_file[1024];
+      build_er_path(er_file, sizeof(er_file), paths[i]);
+      kvtree* data = kvtree_new();
+      er_state_load(er_file, data);
+      kvtree* meta = kvtree_get(data, "SCHEME");
+      if (meta != NULL) {
+        schemes[i] = kvtree_new();
+        kvtree_merge(kvtree_set(schemes[i], "SCHEME", kvtree_new()), meta);
+      }
+      kvtree_delete(&data);
+    }
+  }
 
-  /* build name of shuffile file */
-  char shuffile_file[1024];
-  build_shuffile_path(shuffile_file, sizeof(shuffile_file), path);
+  /* pick an epoch newer than any state these sets had before */
+  if (num_encode > 0) {
+    char** encode_paths = (char**) ER_MALLOC(num_encode * sizeof(char*));
+    long* encode_epochs = (long*)  ER_MALLOC(num_encode * sizeof(long));
+    int j = 0;
+    for (i = 0; i < count; i++) {
+      if (sets[i]->type == ER_DIRECTION_ENCODE) {
+        encode_paths[j++] = paths[i];
+      }
+    }
 
-  /* build path to redset file for this process */
-  char redset_path[1024];
-  build_redset_path(redset_path, sizeof(redset_path), path, rank_world);
+    double start = er_stats_begin();
+    int collectives = er_state_next_epoch(comm_world, comm_store, num_encode, encode_paths, encode_epochs);
 
-  /* update data state to CORRUPT */
-  er_state_write(comm_world, comm_store, path, ER_STATE_CORRUPT);
+    j = 0;
+    for (i = 0; i < count; i++) {
+      if (sets[i]->type == ER_DIRECTION_ENCODE) {
+        er_stats_end(&sets[i]->stats, ER_PHASE_STATE_READ, start, 0, 0, (unsigned long) collectives);
+        epochs[i] = encode_epochs[j++];
+      }
+    }
 
-  /* TODO: update state to SHUFFLE */
+    er_free(&encode_epochs);
+    er_free(&encode_paths);
+  }
 
-  /* migrate files back to ranks in case of new rank-to-node mapping */
-  shuffile_migrate(comm_world, comm_store, shuffile_file);
+  /* read state files of sets to be rebuilt or verified and ensure data is encoded */
+  int* bad     = (int*) ER_MALLOC(count * sizeof(int));
+  int* checked = (int*) ER_MALLOC(count * sizeof(int));
+  kvtree** needed = (kvtree**) ER_MALLOC(count * sizeof(kvtree*));
+  int num_rebuild = 0;
+  for (i = 0; i < count; i++) {
+    bad[i]     = 0;
+    checked[i] = 0;
+    needed[i]  = NULL;
+    if (sets[i]->type == ER_DIRECTION_REBUILD || sets[i]->type == ER_DIRECTION_VERIFY) {
+      num_rebuild++;
+    }
+  }
+  if (num_rebuild > 0) {
+    char** rebuild_paths  = (char**)   ER_MALLOC(num_rebuild * sizeof(char*));
+    int* rebuild_states   = (int*)     ER_MALLOC(num_rebuild * sizeof(int));
+    long* rebuild_epochs  = (long*)    ER_MALLOC(num_rebuild * sizeof(long));
+    int* rebuild_intact   = (int*)     ER_MALLOC(num_rebuild * sizeof(int));
+    int* rebuild_named    = (int*)     ER_MALLOC(num_rebuild * sizeof(int));
+    kvtree** rebuild_data = (kvtree**) ER_MALLOC(num_rebuild * sizeof(kvtree*));
+    int j = 0;
+    for (i = 0; i < count; i++) {
+      if (sets[i]->type == ER_DIRECTION_REBUILD || sets[i]->type == ER_DIRECTION_VERIFY) {
+        rebuild_named[j] = (sets[i]->type == ER_DIRECTION_REBUILD && sets[i]->num_files > 0);
+        rebuild_paths[j++] = paths[i];
+      }
+    }
 
-  /* TODO: update state to RECOVER */
+    double start = er_stats_begin();
+    er_state_read(comm_world, comm_store, num_rebuild, rebuild_paths, rebuild_states, rebuild_epochs,
+      rebuild_data, rebuild_intact, rebuild_named);
+
+    j = 0;
+    for (i = 0; i < count; i++) {
+      if (sets[i]->type == ER_DIRECTION_REBUILD || sets[i]->type == ER_DIRECTION_VERIFY) {
+        /* the state of all sets is agreed on at once,
+         * so each set is charged for the whole read */
+        er_stats_end(&sets[i]->stats, ER_PHASE_STATE_READ, start, 0, 0, 1);
+
+        /* a rebuild restores the files of the agreed state,
+         * so the state it writes keeps that epoch and scheme */
+        epochs[i] = rebuild_epochs[j];
+        if (rebuild_data[j] != NULL) {
+          kvtree* meta = kvtree_get(rebuild_data[j], "SCHEME");
+          if (meta != NULL) {
+            schemes[i] = kvtree_new();
+            kvtree_merge(kvtree_set(schemes[i], "SCHEME", kvtree_new()), meta);
+          }
+        }
+
+        if (rebuild_states[j] != ER_STATE_ENCODED) {
+          /* if it's not encoded, we can't attempt rebuild */
+          rcs[i] = ER_FAILURE;
+        } else if (rebuild_intact[j] && ! er_crc_on_copy && sets[i]->type == ER_DIRECTION_REBUILD) {
+          /* every proc has all of its files where they belong, there is
+           * nothing to move or rebuild, with CRC_ON_COPY we still have
+           * to check the contents of the files */
+          intact[i] = 1;
+        } else {
+          /* fetch the records of our files saved at encode */
+          records[i] = er_records_scatter(comm_world, rebuild_data[j]);
+
+          /* if the caller named the files it needs on any proc,
+           * procs that named none need none of their files, and
+           * procs that named files the set doesn't have need all */
+          if (rebuild_named[j]) {
+            needed[i] = kvtree_new();
+            if (er_records_select(records[i], sets[i]->num_files, sets[i]->files, needed[i]) > 0) {
+              kvtree_unset_all(needed[i]);
+              kvtree_merge(needed[i], records[i]);
+            }
+          }
+        }
+        kvtree_delete(&rebuild_data[j]);
+        j++;
+      }
+    }
 
-  /* rebuild files */
-  redset d;
-  if (redset_recover(comm_world, redset_path, &d) != REDSET_SUCCESS) {
-    /* rebuild failed, rc is same value across comm_world */
-    rc = ER_FAILURE;
+    er_free(&rebuild_data);
+    er_free(&rebuild_named);
+    er_free(&rebuild_intact);
+    er_free(&rebuild_epochs);
+    er_free(&rebuild_states);
+    er_free(&rebuild_paths);
   }
-  redset_delete(&d);
 
-  /* if successful, update state to ENCODED, otherwise leave as CORRUPT */
-  if (rc == ER_SUCCESS) {
-    er_state_write(comm_world, comm_store, path, ER_STATE_ENCODED);
+  /* update data state to CORRUPT on every set we're about to modify,
+   * keeping the scheme so that an interrupted operation can still be
+   * cleaned up by a remove, we wait for the storage group whenever
+   * the batch holds a set that is not just verified, all procs
+   * dispatched the same sets, so this does not depend on what
+   * their own state files said */
+  int wait = 0;
+  for (i = 0; i < count; i++) {
+    int modify = (rcs[i] == ER_SUCCESS && ! intact[i] && sets[i]->type != ER_DIRECTION_VERIFY);
+    states[i] = modify ? ER_STATE_CORRUPT : ER_STATE_NULL;
+    if (sets[i]->type != ER_DIRECTION_VERIFY) {
+      wait = 1;
+    }
+  }
+  double start = er_stats_begin();
+  er_state_write(comm_store, count, paths, states, epochs, schemes, wait);
+  for (i = 0; i < count; i++) {
+    if (states[i] != ER_STATE_NULL) {
+      er_stats_end(&sets[i]->stats, ER_PHASE_STATE_WRITE, start, 0, 0, 1);
+    }
   }
 
-  return rc;
-}
+  /* with several sets to rebuild, migrate them in the background,
+   * so that we recover one set while the next one migrates */
+  erpipeline* pipeline = NULL;
+  erset** pipe_sets    = (erset**)  ER_MALLOC(count * sizeof(erset*));
+  char** pipe_paths    = (char**)   ER_MALLOC(count * sizeof(char*));
+  kvtree** pipe_recs   = (kvtree**) ER_MALLOC(count * sizeof(kvtree*));
+  kvtree** pipe_needs  = (kvtree**) ER_MALLOC(count * sizeof(kvtree*));
+  int num_pipe = 0;
+  for (i = 0; i < count; i++) {
+    if (sets[i]->type == ER_DIRECTION_REBUILD && rcs[i] == ER_SUCCESS && ! intact[i]) {
+      pipe_sets[num_pipe]  = sets[i];
+      pipe_paths[num_pipe] = paths[i];
+      pipe_recs[num_pipe]  = records[i];
+      pipe_needs[num_pipe] = needed[i];
+      num_pipe++;
+    }
+  }
+  if (er_pipeline_rebuild && er_async && num_pipe > 1) {
+    pipeline = er_pipeline_start(comm_world, sets[0]->world->comm_aux, sets[0]->store->comm_aux, num_pipe, pipe_sets, pipe_paths, pipe_recs, pipe_needs);
+  }
 
-static int er_remove(MPI_Comm comm_world, MPI_Comm comm_store, const char* path)
-{
-  int rc = ER_SUCCESS;
+  /* execute the operation of each set */
+  int pipe_index = 0;
+  for (i = 0; i < count; i++) {
+    if (rcs[i] != ER_SUCCESS || intact[i]) {
+      continue;
+    }
 
-  /* get process name */
-  int rank_world;
-  MPI_Comm_rank(comm_world, &rank_world);
+    /* hold off while the application asked us to keep quiet */
+    er_io_wait_resumed();
+
+    erset* set = sets[i];
+    if (set->type == ER_DIRECTION_ENCODE) {
+      /* list of file names */
+      int num_files = set->num_files;
+      const char** filenames = (const char**) set->files;
+
+      /* find predecessor whose redundancy data we may reuse, this must
+       * have been encoded on the same procs with the same scheme */
+      char* base_path = NULL;
+      erdesc* base = NULL;
+      if (set->prev != NULL) {
+        base_path = (char*) ER_MALLOC(ER_MAX_FILENAME);
+        snprintf(base_path, ER_MAX_FILENAME, "%s.er", set->prev);
+        base = erdesc_get(base_path, comm_world);
+        if (base != NULL && (base->scheme != set->scheme || base->files == NULL)) {
+          base = NULL;
+        }
+      }
 
-  /* get rank within storage group */
-  int rank_store;
-  MPI_Comm_rank(comm_store, &rank_store);
+      /* write out files given as buffers, then apply redundancy to files */
+      int checksum = (er_crc_on_copy || set->prev != NULL);
+      rcs[i] = er_write_buffers(comm_world, set, checksum ? records[i] : NULL, &set->stats);
+
+      /* with DELTA, redundancy is applied to deltas against the files
+       * of the predecessor, whose redundancy data doesn't cover those,
+       * unless the chain of deltas is as long as we allow, then this
+       * set is encoded in full, all procs cached the same depth */
+      const kvtree* delta_base = NULL;
+      if (set->delta && base != NULL) {
+        int depth = 0;
+        kvtree_util_get_int(base->files, "DELTA_DEPTH", &depth);
+        if (depth < ER_MAX_DELTA_DEPTH) {
+          delta_base = base->files;
+        }
+        base = NULL;
+      }
 
-  /* build name of er state file */
-  char er_file[1024];
-  build_er_path(er_file, sizeof(er_file), path);
+      /* redset computed the parity of the predecessor over its own
+       * compressed copies, which are named after it and may use another
+       * level, so that parity doesn't cover the copies of this set */
+      if (set->compress) {
+        base = NULL;
+      }
 
-  /* build name of shuffile file */
-  char shuffile_file[1024];
-  build_shuffile_path(shuffile_file, sizeof(shuffile_file), path);
+      /* redundancy is applied to compressed copies of files instead */
+      char** shadows = NULL;
+      if (rcs[i] == ER_SUCCESS && (set->compress || delta_base != NULL)) {
+        rcs[i] = er_compress_files(comm_world, set, paths[i], delta_base, records[i], &shadows, &set->stats);
+      }
 
-  /* build path to redset file for this process */
-  char redset_path[1024];
-  build_redset_path(redset_path, sizeof(redset_path), path, rank_world);
+      if (rcs[i] == ER_SUCCESS) {
+        rcs[i] = er_encode(comm_world, comm_store, num_files, filenames, (const char**) shadows,
+          paths[i], set->scheme, base_path, base, records[i], &set->stats);
+      }
 
-  /* update data state to CORRUPT */
-  er_state_write(comm_world, comm_store, path, ER_STATE_CORRUPT);
+      if (shadows != NULL) {
+        er_free_shadows(num_files, &shadows);
+      }
+      er_free(&base_path);
+    } else if (set->type == ER_DIRECTION_REBUILD) {
+      /* migrate files to new rank locations (if needed),
+       * and rebuild missing files (if needed) */
+      if (pipeline != NULL) {
+        int complete = er_pipeline_wait(pipeline, pipe_index);
+        rcs[i] = er_rebuild_recover(comm_world, paths[i], records[i], schemes[i], complete, &set->stats);
+      } else {
+        rcs[i] = er_rebuild(comm_world, comm_store, paths[i], records[i], needed[i], schemes[i], set->ready, &set->stats);
+      }
+      pipe_index++;
+    } else if (set->type == ER_DIRECTION_VERIFY) {
+      /* check files in place, the set stays ENCODED either way,
+       * since a rebuild can still restore what was found missing */
+      rcs[i] = er_verify(comm_world, comm_store, paths[i], records[i], set->verify_bw, &bad[i], &set->stats);
+      checked[i] = 1;
+    } else {
+      /* delete metadata added when encoding files */
+      rcs[i] = er_remove(comm_world, comm_store, paths[i], schemes[i], &set->stats);
+    }
+  }
 
-  /* delete association information */
-  shuffile_remove(comm_world, comm_store, shuffile_file);
+  if (pipeline != NULL) {
+    er_pipeline_finish(&pipeline);
+  }
+  er_free(&pipe_needs);
+  er_free(&pipe_recs);
+  er_free(&pipe_paths);
+  er_free(&pipe_sets);
+
+  /* if successful, update state to ENCODED, otherwise leave as CORRUPT,
+   * removed sets no longer have a state file, file records go
+   * into the state file of whichever storage group now holds the
+   * files, so that the next rebuild can check them again, verified
+   * sets are still encoded and keep the result of the check */
+  kvtree** gathered = (kvtree**) ER_MALLOC(count * sizeof(kvtree*));
+  start = er_stats_begin();
+  for (i = 0; i < count; i++) {
+    states[i]   = ER_STATE_NULL;
+    gathered[i] = NULL;
+    if ((rcs[i] == ER_SUCCESS || checked[i]) && ! intact[i] && sets[i]->type != ER_DIRECTION_REMOVE) {
+      states[i] = ER_STATE_ENCODED;
+      if (records[i] != NULL) {
+        gathered[i] = er_records_gather(comm_world, comm_store, records[i]);
+      }
+      if (gathered[i] != NULL && schemes[i] != NULL) {
+        kvtree_merge(gathered[i], schemes[i]);
+      }
+      if (gathered[i] != NULL && checked[i]) {
+        kvtree* verify = kvtree_set(gathered[i], "VERIFY", kvtree_new());
+        kvtree_util_set_int(verify, "BAD", bad[i]);
+        kvtree_util_set_unsigned_long(verify, "TIME", (unsigned long) time(NULL));
+      }
+    }
+  }
+  er_state_write(comm_store, count, paths, states, epochs, gathered, 0);
+  for (i = 0; i < count; i++) {
+    if (states[i] != ER_STATE_NULL) {
+      unsigned long collectives = (records[i] != NULL) ? 1 : 0;
+      er_stats_end(&sets[i]->stats, ER_PHASE_STATE_WRITE, start, 0, 0, collectives);
+
+      /* the next encode of the set can pick its epoch from this one */
+      erdesc* desc = erdesc_get(paths[i], comm_world);
+      if (desc != NULL) {
+        desc->epoch = epochs[i];
+      }
+    }
+  }
 
-  /* delete redundancy data, could avoid recover step if
-   * the descriptor is cached somewhere */
-  redset d;
-  redset_recover(comm_world, redset_path, &d);
-  redset_unapply(redset_path, d);
-  redset_delete(&d);
+  /* files of encoded sets are committed to node-local storage now,
+   * let the application know before we start flushing */
+  pthread_mutex_lock(&er_async_mutex);
+  for (i = 0; i < count; i++) {
+    if (sets[i]->type == ER_DIRECTION_ENCODE && rcs[i] == ER_SUCCESS) {
+      sets[i]->tier = ER_TIER_LOCAL;
+    }
+  }
+  pthread_cond_broadcast(&er_async_cond);
+  pthread_mutex_unlock(&er_async_mutex);
+
+  /* drain redundancy of encoded sets to the slower tier, procs of a
+   * set agree on whether it has a flush directory, since they
+   * created it with the same config */
+  for (i = 0; i < count; i++) {
+    erset* set = sets[i];
+    if (set->type != ER_DIRECTION_ENCODE || rcs[i] != ER_SUCCESS || set->flush_dir == NULL) {
+      continue;
+    }
 
-  /* delete er state file */
-  if (rank_store == 0) {
-    unlink(er_file);
+    er_io_wait_resumed();
+    if (er_flush(comm_world, comm_store, paths[i], set->flush_dir, &set->stats) == ER_SUCCESS) {
+      pthread_mutex_lock(&er_async_mutex);
+      set->tier = ER_TIER_FLUSHED;
+      pthread_mutex_unlock(&er_async_mutex);
+    } else {
+      /* the local copy is still good, so the encode succeeded, but the
+       * set is not as durable as asked for, which ER_Get_tier reports */
+      er_err("Failed to flush %s to %s @ %s:%d",
+        set->name, set->flush_dir, __FILE__, __LINE__);
+    }
   }
 
-  return rc;
+  /* save rc for TEST and WAIT calls */
+  for (i = 0; i < count; i++) {
+    sets[i]->rc = rcs[i];
+    er_free(&paths[i]);
+    kvtree_delete(&records[i]);
+    kvtree_delete(&needed[i]);
+    kvtree_delete(&schemes[i]);
+    kvtree_delete(&gathered[i]);
+  }
+
+  er_free(&gathered);
+  er_free(&needed);
+  er_free(&checked);
+  er_free(&bad);
+  er_free(&intact);
+  er_free(&schemes);
+  er_free(&records);
+
+  er_free(&epochs);
+  er_free(&states);
+  er_free(&rcs);
+  er_free(&paths);
 }
 
-/* initiate encode/rebuild operation on specified set id */
-int ER_Dispatch(int set_id)
+/* executes the operations of a batch of sets and marks the sets as
+ * done, this runs on the progress thread when dispatching
+ * asynchronously, and frees the batch */
+static void er_dispatch_progress(void* arg)
 {
-  int rc = ER_SUCCESS;
+  erbatch* batch = (erbatch*) arg;
 
-  /* lookup set id */
-  erset* set = erset_get(set_id);
-  if (set) {
-    /* check that we're in the right state */
-    if (set->api_state != ER_API_STATE_CREATED) {
-      /* wrong state */
-      er_err("ER_Dispatch called in wrong state @ %s:%d",
-        __FILE__, __LINE__);
-      return ER_FAILURE;
-    }
+  /* execute the operations */
+  er_dispatch_exec(batch);
+
+  /* mark sets as complete and wake anyone waiting on them */
+  pthread_mutex_lock(&er_async_mutex);
+  int i;
+  for (i = 0; i < batch->count; i++) {
+    batch->sets[i]->done = 1;
+  }
+  pthread_cond_broadcast(&er_async_cond);
+  pthread_mutex_unlock(&er_async_mutex);
 
-    /* get name of set */
-    const char* name = set->name;
+  er_free(&batch->sets);
+  er_free(&batch);
+}
 
-    /* TODO: allow caller to specify this prefix? */
-    /* define prefix to use on all metadata files */
-    char path[1024];
-    snprintf(path, sizeof(path), "%s.er", name);
+/* initiate encode/rebuild/remove operations on a list of set ids */
+int ER_Dispatch_all(int count, const int* set_ids)
+{
+  if (count < 1 || set_ids == NULL) {
+    er_err("ER_Dispatch_all called with empty list of set ids @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
 
-    /* get operation (encode, rebuild, remove) */
-    int direction = set->type;
+  /* lookup and check each set before we change the state of any */
+  erbatch* batch = (erbatch*) ER_MALLOC(sizeof(erbatch));
+  batch->count = count;
+  batch->sets  = (erset**) ER_MALLOC(count * sizeof(erset*));
+  batch->async = 0;
 
-    /* get world and store communicators */
-    MPI_Comm comm_world = set->comm_world;
-    MPI_Comm comm_store = set->comm_store;
+  int i;
+  for (i = 0; i < count; i++) {
+    /* lookup set id */
+    erset* set = erset_get(set_ids[i]);
+    if (! set) {
+      /* failed to find set id */
+      er_err("ER_Dispatch failed to find set id %d @ %s:%d",
+        set_ids[i], __FILE__, __LINE__);
+      break;
+    }
 
-    if (direction == ER_DIRECTION_ENCODE) {
-      /* determine number of files */
-      kvtree* files_hash = kvtree_get(set->files, "FILE");
-      int num_files = kvtree_size(files_hash);
+    /* check that we're in the right state */
+    if (set->api_state != ER_API_STATE_CREATED) {
+      /* wrong state */
+      er_err("ER_Dispatch called in wrong state for set id %d @ %s:%d",
+        set_ids[i], __FILE__, __LINE__);
+      break;
+    }
 
-      /* allocate space for file names */
-      const char** filenames = (const char**) ER_MALLOC(num_files * sizeof(char*));
+    /* a set may only appear once */
+    int j;
+    for (j = 0; j < i; j++) {
+      if (batch->sets[j] == set) {
+        break;
+      }
+    }
+    if (j < i) {
+      er_err("ER_Dispatch_all set id %d listed more than once @ %s:%d",
+        set_ids[i], __FILE__, __LINE__);
+      break;
+    }
 
-      /* copy pointers to filenames */
-      int i = 0;
-      kvtree_elem* elem;
-      for (elem = kvtree_elem_first(files_hash);
-           elem != NULL;
-           elem = kvtree_elem_next(elem))
+    /* collectives for the batch are issued on the comms of the
+     * first set, so all sets must have been created on the same comms,
+     * sets created on the same application comms share our dups */
+    if (i > 0) {
+      int result_world, result_store;
+      MPI_Comm_compare(set->world->comm, batch->sets[0]->world->comm, &result_world);
+      MPI_Comm_compare(set->store->comm, batch->sets[0]->store->comm, &result_store);
+      if ((result_world != MPI_IDENT && result_world != MPI_CONGRUENT) ||
+          (result_store != MPI_IDENT && result_store != MPI_CONGRUENT))
       {
-        const char* file = kvtree_elem_key(elem);
-        filenames[i] = file;
-        i++;
+        er_err("ER_Dispatch_all set id %d uses different communicators than set id %d @ %s:%d",
+          set_ids[i], set_ids[0], __FILE__, __LINE__);
+        break;
       }
+    }
 
-      /* get scheme id */
-      int scheme_id = set->scheme_id;
-
-      /* get scheme */
-      redset* dptr = erscheme_get(scheme_id);
-      if (dptr) {
-        /* apply redundancy to files */
-        rc = er_encode(comm_world, comm_store, num_files, filenames, path, *dptr);
-      } else {
-        /* failed to find scheme id for this set */
-        rc = ER_FAILURE;
-      }
+    batch->sets[i] = set;
+  }
 
-      /* free list of file names */
-      er_free(&filenames);
-    } else if (direction == ER_DIRECTION_REBUILD) {
-      /* migrate files to new rank locations (if needed),
-       * and rebuild missing files (if needed) */
-      rc = er_rebuild(comm_world, comm_store, path);
-    } else {
-      /* delete metadata added when encoding files */
-      rc = er_remove(comm_world, comm_store, path);
-    }
+  if (i < count) {
+    /* some set was invalid, dispatch none of them */
+    er_free(&batch->sets);
+    er_free(&batch);
+    return ER_FAILURE;
+  }
 
-    /* update our state */
-    set->api_state = ER_API_STATE_DISPATCHED;
+  /* update our state, no more files can be added after this */
+  for (i = 0; i < count; i++) {
+    batch->sets[i]->api_state = ER_API_STATE_DISPATCHED;
+    ER_TRACE_MARK(ER_TRACE_STATE, "DISPATCHED", set_ids[i]);
+  }
 
-    /* save rc for TEST and WAIT calls */
-    set->rc = rc;
-  } else {
-    /* failed to find set id */
-    er_err("ER_Dispatch failed to find set id @ %s:%d",
-      __FILE__, __LINE__);
-    rc = ER_FAILURE;
+  /* hand the operations off to the progress thread, which executes
+   * operations in the order they were dispatched */
+  batch->async = 1;
+  if (er_async && er_progress_post(er_dispatch_progress, (void*) batch) == ER_SUCCESS) {
+    return ER_SUCCESS;
   }
 
+  /* no progress thread, so execute the operations right here */
+  int rc = ER_SUCCESS;
+  batch->async = 0;
+  er_dispatch_progress((void*) batch);
+  for (i = 0; i < count; i++) {
+    erset* set = erset_get(set_ids[i]);
+    if (set->rc != ER_SUCCESS) {
+      rc = ER_FAILURE;
+    }
+  }
   return rc;
 }
 
+/* initiate encode/rebuild operation on specified set id */
+int ER_Dispatch(int set_id)
+{
+  return ER_Dispatch_all(1, &set_id);
+}
+
 /* tests whether ongoing dispatch operation to finish,
  * returns 1 if done, 0 otherwise */
 int ER_Test(int set_id)
@@ -897,10 +4178,17 @@ int ER_Test(int set_id)
       return 0;
     }
 
-    /* TODO: test if done */
+    /* check whether the operation has finished */
+    pthread_mutex_lock(&er_async_mutex);
+    int done = set->done;
+    pthread_mutex_unlock(&er_async_mutex);
+    if (! done) {
+      return 0;
+    }
 
     /* update our state to completed */
     set->api_state = ER_API_STATE_COMPLETED;
+    ER_TRACE_MARK(ER_TRACE_STATE, "COMPLETED", set_id);
   } else {
     /* failed to find set id */
     return 0;
@@ -925,10 +4213,22 @@ int ER_Wait(int set_id)
       return ER_FAILURE;
     }
 
-    /* TODO: wait on operation */
+    /* block until the progress thread has finished the operation */
+    pthread_mutex_lock(&er_async_mutex);
+    while (! set->done) {
+      if (er_progress_poll) {
+        pthread_mutex_unlock(&er_async_mutex);
+        sched_yield();
+        pthread_mutex_lock(&er_async_mutex);
+      } else {
+        pthread_cond_wait(&er_async_cond, &er_async_mutex);
+      }
+    }
+    pthread_mutex_unlock(&er_async_mutex);
 
     /* update our state to completed */
     set->api_state = ER_API_STATE_COMPLETED;
+    ER_TRACE_MARK(ER_TRACE_STATE, "COMPLETED", set_id);
 
     /* pass return code back to caller */
     rc = set->rc;
@@ -942,6 +4242,116 @@ int ER_Wait(int set_id)
   return rc;
 }
 
+int ER_Wait_file(int set_id, const char* file)
+{
+  if (file == NULL) {
+    er_err("ER_Wait_file file parameter is NULL @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* lookup our set */
+  erset* set = erset_get(set_id);
+  if (set == NULL) {
+    er_err("ER_Wait_file failed to find set id %d @ %s:%d",
+      set_id, __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* check that we're in the right state */
+  if (set->type != ER_DIRECTION_REBUILD ||
+      (set->api_state != ER_API_STATE_DISPATCHED &&
+       set->api_state != ER_API_STATE_COMPLETED))
+  {
+    er_err("ER_Wait_file called in wrong order or on a set that is not rebuilt @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* block until the file is known to be intact or the rebuild is done */
+  pthread_mutex_lock(&er_async_mutex);
+  while (! set->done && kvtree_get_kv(set->ready, "FILE", file) == NULL) {
+    if (er_progress_poll) {
+      pthread_mutex_unlock(&er_async_mutex);
+      sched_yield();
+      pthread_mutex_lock(&er_async_mutex);
+    } else {
+      pthread_cond_wait(&er_async_cond, &er_async_mutex);
+    }
+  }
+  int ready = (kvtree_get_kv(set->ready, "FILE", file) != NULL);
+  int done  = set->done;
+  int rc    = set->rc;
+  pthread_mutex_unlock(&er_async_mutex);
+
+  if (ready) {
+    return ER_SUCCESS;
+  }
+
+  /* once the rebuild succeeded, every file of the set is in place */
+  if (done && rc == ER_SUCCESS && access(file, F_OK) == 0) {
+    return ER_SUCCESS;
+  }
+
+  return ER_FAILURE;
+}
+
+/* hold operations running in the background */
+int ER_Pause(void)
+{
+  er_io_pause();
+  return ER_SUCCESS;
+}
+
+/* let operations held by ER_Pause continue */
+int ER_Resume(void)
+{
+  er_io_resume();
+  return ER_SUCCESS;
+}
+
+/* returns the storage tier the files of a dispatched encode set have reached */
+int ER_Get_tier(int set_id)
+{
+  /* lookup our set */
+  erset* set = erset_get(set_id);
+  if (! set) {
+    er_err("ER_Get_tier failed to find set id %d @ %s:%d",
+      set_id, __FILE__, __LINE__);
+    return -1;
+  }
+
+  pthread_mutex_lock(&er_async_mutex);
+  int tier = set->tier;
+  pthread_mutex_unlock(&er_async_mutex);
+
+  return tier;
+}
+
+/* returns counters of the last operation of a completed set as a new kvtree */
+kvtree* ER_Get_Stats(int set_id, int global)
+{
+  /* lookup our set */
+  erset* set = erset_get(set_id);
+  if (set == NULL) {
+    er_err("ER_Get_Stats failed to find set id %d @ %s:%d",
+      set_id, __FILE__, __LINE__);
+    return NULL;
+  }
+
+  /* stats are only complete once the operation has finished */
+  if (set->api_state != ER_API_STATE_COMPLETED) {
+    er_err("ER_Get_Stats called in wrong order @ %s:%d",
+      __FILE__, __LINE__);
+    return NULL;
+  }
+
+  /* use the dup kept for the application thread, an operation
+   * of another set may be running on the progress thread */
+  MPI_Comm comm = global ? set->world->comm_app : MPI_COMM_NULL;
+  return er_stats_kvtree(&set->stats, comm);
+}
+
 /* free internal resources associated with set id */
 int ER_Free(int set_id)
 {
@@ -966,7 +4376,7 @@ int ER_Free(int set_id)
   }
 
   /* delete the set from our list */
-  kvtree_unset_kv_int(er_sets, "SETS", set_id);
+  erhandles_remove(&er_sets, set_id);
 
   return ER_SUCCESS;
 }
@@ -1,6 +1,8 @@
 #ifndef ER_H
 #define ER_H
 
+#include <stddef.h>
+
 #include "mpi.h"
 
 /** \defgroup er ER
@@ -29,11 +31,35 @@ extern "C" {
 #define ER_DIRECTION_ENCODE  (1)
 #define ER_DIRECTION_REBUILD (2)
 #define ER_DIRECTION_REMOVE  (3)
+#define ER_DIRECTION_VERIFY  (4)
+
+#define ER_TIER_NONE    (0)
+#define ER_TIER_LOCAL   (1)
+#define ER_TIER_FLUSHED (2)
 
 #define ER_KEY_CONFIG_DEBUG "DEBUG"
 #define ER_KEY_CONFIG_SET_SIZE "SET_SIZE"
 #define ER_KEY_CONFIG_MPI_BUF_SIZE "MPI_BUF_SIZE"
 #define ER_KEY_CONFIG_CRC_ON_COPY "CRC_ON_COPY"
+#define ER_KEY_CONFIG_STATS "STATS"
+#define ER_KEY_CONFIG_BUF_HUGEPAGE "BUF_HUGEPAGE"
+#define ER_KEY_CONFIG_PIPELINE_REBUILD "PIPELINE_REBUILD"
+#define ER_KEY_CONFIG_IO_THREADS "IO_THREADS"
+#define ER_KEY_CONFIG_COMPRESS "COMPRESS"
+#define ER_KEY_CONFIG_DELTA "DELTA"
+#define ER_KEY_CONFIG_MMAP "MMAP"
+#define ER_KEY_CONFIG_FLUSH_DIR "FLUSH_DIR"
+#define ER_KEY_CONFIG_VERIFY_BW "VERIFY_BW"
+#define ER_KEY_CONFIG_MAX_BW "MAX_BW"
+#define ER_KEY_CONFIG_MAX_CHUNKS "MAX_CHUNKS"
+#define ER_KEY_CONFIG_PROGRESS "PROGRESS"
+#define ER_KEY_CONFIG_PROGRESS_CPUS "PROGRESS_CPUS"
+#define ER_KEY_CONFIG_PROGRESS_POLL "PROGRESS_POLL"
+#define ER_KEY_CONFIG_TRACE_FILE "TRACE_FILE"
+#define ER_KEY_CONFIG_AUTO_SCHEME_TYPE "AUTO_SCHEME_TYPE"
+#define ER_KEY_CONFIG_AUTO_SCHEME_SET_SIZE "AUTO_SCHEME_SET_SIZE"
+#define ER_KEY_CONFIG_AUTO_SCHEME_ERASURE "AUTO_SCHEME_ERASURE"
+#define ER_KEY_CONFIG_AUTO_SCHEME_DOMAINS "AUTO_SCHEME_DOMAINS"
 
 int ER_Init(
   const char* conf_file /**< [IN] - path to configuration file (can be NULL for default) */
@@ -49,6 +75,31 @@ int ER_Create_Scheme(
   int erasure_blocks          /**< [IN] - number of erasure blocks to be generated */
 );
 
+/** defines a redundancy scheme that survives the loss of tolerance
+ * failure domains of comm and stores at most overhead bytes of
+ * redundancy data per byte of file data, picks the type and set size
+ * that needs the least encode traffic based on how many failure domains
+ * there are, the choice is reported by ER_Config,
+ * returns scheme id as integer, or -1 if no scheme fits */
+int ER_Create_Scheme_auto(
+  MPI_Comm comm,              /**< [IN] - communicator of processes participating in scheme */
+  const char* failure_domain, /**< [IN] - processes with same value of failure_domain are assumed to fail at the same time */
+  int tolerance,              /**< [IN] - number of failure domains that may be lost */
+  double overhead             /**< [IN] - maximum ratio of redundancy data to file data */
+);
+
+/** defines a redundancy scheme that applies both given schemes to a
+ * set, the local scheme should be the cheap one, for example PARTNER
+ * within a rack, and the global scheme one that spans wider failure
+ * domains, a rebuild first tries the local scheme and only falls back
+ * to the global one if files are still missing, both schemes must
+ * have been created on the same comm, they may be freed afterwards,
+ * returns scheme id as integer */
+int ER_Compose_Scheme(
+  int local_scheme_id, /**< [IN] - scheme applied and tried first */
+  int global_scheme_id /**< [IN] - scheme applied and tried if local one can't rebuild */
+);
+
 /* needs to be above doxygen comment to get association right */
 typedef struct kvtree_struct kvtree;
 
@@ -61,6 +112,107 @@ typedef struct kvtree_struct kvtree;
  *   * "SETSIZE" (int) - set size for ER to use.
  *   * "MPI_BUF_SIZE" (byte count [IN], int [OUT]) - MPI buffer size to chunk
  *     file transfer. Must not exceed INT_MAX.
+ *   * "CRC_ON_COPY" (int) - if non-zero, record size and CRC32C checksum
+ *     of each file in the state of a set when encoding, and on rebuild
+ *     rebuild files that no longer match in addition to missing ones.
+ *     Rebuild fails if rebuilt files don't match either. Despite the
+ *     name, files redset and shuffile read or write are checksummed in
+ *     a pass of their own right after them (the CHECKSUM phase of
+ *     ER_Get_Stats), while the files are likely still in the page cache,
+ *     only files ER writes itself, from ER_Add_buffer, COMPRESS, or
+ *     DELTA, are checksummed in the same pass.
+ *   * "STATS" (int) - if non-zero, record time, bytes, and collective
+ *     operations per phase of each dispatched set, see ER_Get_Stats.
+ *   * "BUF_HUGEPAGE" (int) - if non-zero, align transfer buffers of at
+ *     least 2MB to huge pages and ask the kernel to back them with huge
+ *     pages. ER keeps its transfer buffers across dispatches.
+ *   * "PIPELINE_REBUILD" (int) - if non-zero, when several sets are
+ *     rebuilt with ER_Dispatch_all, migrate files of later sets on a
+ *     helper thread while earlier sets are recovered, files restored
+ *     from deltas are left until their set is recovered, since
+ *     their bases may belong to an earlier set. Requires
+ *     MPI_THREAD_MULTIPLE.
+ *   * "IO_THREADS" (int) - number of threads to use on a node to read,
+ *     checksum, and write files concurrently, split among the procs in
+ *     comm_store, each proc uses at least one, 0 (default) uses one
+ *     thread per proc.
+ *   * "COMPRESS" (int) - zlib level from 1 (fastest) to 9 (smallest) to
+ *     compress files of encode sets created while it is set, 0 (default)
+ *     disables compression. Redundancy is computed from compressed copies
+ *     of the files, which shuffile moves instead of the files themselves,
+ *     and which are decompressed on rebuild. The copies are kept next to
+ *     the redundancy files, in addition to the files, until the set is
+ *     removed, so this trades node-local storage for less redundancy data
+ *     to compute and send, it does not shrink what a set occupies.
+ *     Requires ER to be built with zlib.
+ *   * "DELTA" (int) - if non-zero, files of encode sets created while
+ *     it is set whose predecessor from ER_Set_predecessor was encoded
+ *     by this job are encoded as the blocks in which they differ from the file added at
+ *     the same position to the predecessor, instead of being compressed.
+ *     Redundancy is computed from these deltas, so its cost follows the
+ *     fraction of blocks that changed. A rebuild restores files from the
+ *     files of the predecessor, which must be kept and be rebuilt first
+ *     if they were lost as well, e.g. by listing the sets oldest first in
+ *     ER_Dispatch_all. After 8 sets in a row that encoded deltas, the
+ *     next one is encoded in full, so a set depends on the files of at
+ *     most 8 predecessors, which must not be removed while it may still
+ *     need to be rebuilt. 0 (default) disables deltas.
+ *   * "MMAP" (int) - if non-zero, files on memory-backed storage such as
+ *     tmpfs (/dev/shm) or file systems mounted for DAX are read through
+ *     memory maps instead of being copied into transfer buffers when ER
+ *     copies them, which saves a copy of every byte. Only files ER owns are
+ *     mapped, i.e. the redundancy, shuffile and state files it flushes or
+ *     copies into a set that reuses their redundancy. Files of the app are
+ *     always read with read(), since a map of a file truncated while ER
+ *     reads it would raise SIGBUS. Redundancy itself is computed by redset,
+ *     which reads files on its own. 0 (default) reads all files with read().
+ *   * "FLUSH_DIR" (string) - directory on a slower, more durable tier
+ *     such as a burst buffer or parallel file system, to which the
+ *     redundancy files, shuffile map, and state file of encode sets
+ *     created while it is set are copied once they are committed to
+ *     node-local storage, empty (default) disables the flush. ER_Test
+ *     and ER_Wait report the set as done once the flush has finished,
+ *     ER_Get_tier reports the local commit before that. ER_Test and
+ *     ER_Wait report the result of the encode, a failed flush only
+ *     leaves ER_Get_tier at ER_TIER_LOCAL. A remove deletes the
+ *     copies as well. A rebuild only uses node-local storage, ER
+ *     does not restore sets from this tier, copying the files back
+ *     before a rebuild, less the rank suffix on the names of the
+ *     shuffile map and state file, is left to the application.
+ *   * "VERIFY_BW" (byte count) - limit on the number of bytes per
+ *     second each process reads to checksum files of verify sets
+ *     created while it is set, 0 (default) does not limit the rate.
+ *   * "MAX_BW" (byte count) - limit on the number of bytes per second
+ *     a node moves for operations running on the progress thread,
+ *     split among the procs in comm_store, 0 (default) does not limit
+ *     the rate. File I/O of ER itself is paced chunk by chunk, bytes
+ *     moved by redset are made up for before the next step.
+ *   * "MAX_CHUNKS" (int) - number of MPI_BUF_SIZE transfer buffers
+ *     each process may have in use at once for operations running on
+ *     the progress thread, at least 2, 0 (default) does not limit it.
+ *   * "PROGRESS" (int) - if non-zero (default), execute dispatched
+ *     operations on a background progress thread. Requires
+ *     MPI_THREAD_MULTIPLE.
+ *   * "PROGRESS_CPUS" (string) - list of cpus like "0,4-7" to bind the
+ *     progress thread to, empty (default) leaves it unbound.
+ *   * "PROGRESS_POLL" (int) - if non-zero, the progress thread and
+ *     ER_Wait spin while waiting instead of blocking, which reduces
+ *     latency when the progress thread has a core to itself.
+ *   * "TRACE_FILE" (string) - prefix of a Chrome trace (JSON) that each
+ *     process writes to <prefix>.<rank>.json during ER_Finalize, with
+ *     the phases of dispatched operations, the collectives ER issues,
+ *     and the state changes of sets, timed by MPI_Wtime. Only has an
+ *     effect if ER was configured with -DER_TRACE=ON, which compiles
+ *     in the trace points, empty (default) records nothing. The newest
+ *     65536 events of each process are kept.
+ *   .
+ * The following values are reported but can not be set, they are only
+ * present after ER_Create_Scheme_auto created a scheme and describe
+ * the last scheme it picked:
+ *   * "AUTO_SCHEME_TYPE" (string) - one of SINGLE, XOR, RS, PARTNER.
+ *   * "AUTO_SCHEME_SET_SIZE" (int) - failure domains per redundancy set.
+ *   * "AUTO_SCHEME_ERASURE" (int) - erasure blocks per redundancy set.
+ *   * "AUTO_SCHEME_DOMAINS" (int) - failure domains found in comm.
  *   .
  * Symbolic names ER_KEY_CONFIG_FOO are defined in er.h and should
  * be used instead of the strings whenever possible to guard against typos in
@@ -81,7 +233,17 @@ int ER_Free_Scheme(
   int scheme_id /**< [IN] - release resources associated with specified scheme id */
 );
 
-/** create a named set, and specify whether it should be encoded, recovered, or unencoded */
+/** create a named set, and specify whether it should be encoded, recovered, or unencoded,
+ * or with ER_DIRECTION_VERIFY, whether its data and redundancy files are
+ * still present with the sizes and checksums recorded when it was encoded,
+ * which reads files of each process in place without moving or modifying
+ * them, records the result in the state of the set, and makes ER_Wait
+ * return ER_FAILURE if any process found a missing or damaged file,
+ * in which case a rebuild will restore it,
+ * the set uses duplicates of comm_world and comm_store, which are made
+ * when the first set is created on them and shared by later sets, so they
+ * are created in the same order on all processes, and the application
+ * may free its communicators before it frees the set */
 int ER_Create(
   MPI_Comm comm_world, /**< [IN] - communicator of processes participating in operation */
   MPI_Comm comm_store, /**< [IN] - communicator of processes that share access to storage holding files */
@@ -90,28 +252,169 @@ int ER_Create(
   int scheme_id        /**< [IN] - redundancy scheme to be applied to this set */
 );
 
-/** adds file to specified set id */
+/** adds file to specified set id, on a rebuild set this names a file
+ * the process needs, using the path it was encoded under, if any process
+ * names files, the rebuild neither moves nor recovers anything when every
+ * process has the files it named, and does not recover anything when
+ * they all arrived intact after moving files, other files of the set are
+ * left for a later rebuild, processes that name no files need none */
 int ER_Add(
   int set_id,      /**< [IN] - set id to add file to */
   const char* file /**< [IN] - path to file */
 );
 
-/** initiate encode/rebuild operation on specified set id */
+/** adds count files to specified set id in a single call,
+ * same as calling ER_Add on each file in order, fails without
+ * adding any file if any entry of the list is NULL or empty */
+int ER_Add_files(
+  int set_id,        /**< [IN] - set id to add files to */
+  int count,         /**< [IN] - number of files in list */
+  const char** files /**< [IN] - list of paths to files */
+);
+
+/** declares the encode set id to be the successor of the set with the
+ * given name, if that set was encoded by this job on the same procs
+ * with the same scheme, and none of the files of the set changed
+ * in size and mtime or checksum on any proc since then, its
+ * redundancy data is reused instead of computing it again, unless
+ * the set was created with COMPRESS set, otherwise the set is
+ * encoded as usual, or with DELTA set, from the
+ * blocks in which its files differ from those of the predecessor,
+ * the predecessor must not be removed before this set is dispatched,
+ * only sets encoded by this job are known, so the first set
+ * encoded after a restart computes its redundancy data again */
+int ER_Set_predecessor(
+  int set_id,      /**< [IN] - set id of encode set */
+  const char* name /**< [IN] - name of predecessor set */
+);
+
+/** adds file to specified encode set id whose contents are taken
+ * from a buffer, the file is written from the buffer during
+ * ER_Dispatch, checksummed in the same pass if CRC_ON_COPY is set,
+ * and with COMPRESS or DELTA its copy is made from the buffer too,
+ * so ER itself never reads the file back, but without COMPRESS or
+ * DELTA redset and shuffile still read the file to encode and migrate
+ * it, the buffer must not be
+ * modified or freed until ER_Test or ER_Wait report the operation
+ * as complete */
+int ER_Add_buffer(
+  int set_id,       /**< [IN] - set id to add file to */
+  const char* file, /**< [IN] - path to file holding buffer contents */
+  const void* buf,  /**< [IN] - contents of file */
+  size_t size       /**< [IN] - number of bytes in buf */
+);
+
+/** initiate encode/rebuild operation on specified set id,
+ * if MPI was initialized with MPI_THREAD_MULTIPLE, the operation
+ * is queued to the progress thread and this returns right away,
+ * otherwise this blocks until the operation is complete,
+ * the result of the operation is returned by ER_Wait,
+ * all procs must dispatch their sets in the same order */
 int ER_Dispatch(
   int set_id           /**< [IN] - set id to dispatch */
 );
 
+/** initiate encode/rebuild operations on a list of set ids,
+ * this costs a single round of state agreement and state updates
+ * for the whole list instead of one per set, all sets must have
+ * been created on the same comm_world and comm_store, sets are
+ * processed in list order, so rebuild sets encoded with DELTA must
+ * come after the sets of their predecessors, whose files their
+ * deltas are restored from, call ER_Test or ER_Wait on each set
+ * id to complete its operation */
+int ER_Dispatch_all(
+  int count,           /**< [IN] - number of set ids in list */
+  const int* set_ids   /**< [IN] - list of set ids to dispatch */
+);
+
 /** tests whether ongoing dispatch operation to finish,
  * returns 1 if done, 0 otherwise */
 int ER_Test(
   int set_id
 );
 
-/** wait for ongoing dispatch operation to finish */
+/** wait for ongoing dispatch operation to finish,
+ * returns the result of the operation */
 int ER_Wait(
   int set_id
 );
 
+/** wait until file of a dispatched rebuild set id can be used,
+ * returns as soon as the file is found intact on this process after
+ * shuffling, while files lost elsewhere may still be rebuilt in the
+ * background, otherwise waits for the rebuild to finish,
+ * returns ER_SUCCESS if the file is available, ER_Wait must still
+ * be called on the set id before it is freed */
+int ER_Wait_file(
+  int set_id,      /**< [IN] - set id of rebuild set */
+  const char* file /**< [IN] - path to file */
+);
+
+/** hold operations running on the progress thread at their next chunk
+ * of file I/O or step until ER_Resume is called, for example around a
+ * latency sensitive phase of the application, operations that are in
+ * the middle of a collective step finish that step first, calls nest,
+ * this is local to the calling process, but a process that is held
+ * delays collective steps of the other processes as well */
+int ER_Pause(void);
+
+/** undo one call to ER_Pause, operations continue once every call
+ * has been undone */
+int ER_Resume(void);
+
+/** returns the storage tier the files of a dispatched encode set
+ * id have reached without blocking, ER_TIER_NONE until they are
+ * committed to node-local storage, ER_TIER_LOCAL once they are, so
+ * the application may continue while redundancy is flushed to
+ * FLUSH_DIR, and ER_TIER_FLUSHED after the flush has finished on
+ * all procs, returns -1 if set id is not found */
+int ER_Get_tier(
+  int set_id /**< [IN] - set id of encode set */
+);
+
+/** returns a new kvtree with time, bytes, and collective operations
+ * this process spent in each phase of the operation of a completed set,
+ * under PHASE/<name>/{TIME,BYTES_READ,BYTES_WRITTEN,CALLS,COLLECTIVES},
+ * values are zero unless the STATS option was enabled during dispatch,
+ * phases shared by sets dispatched together are charged to each set,
+ * if global is non-zero, this is collective over comm_world of the set
+ * and MIN, MAX, and AVG subtrees with the same layout hold the values
+ * across all procs, call after ER_Wait and before ER_Free,
+ * the caller must kvtree_delete() the result */
+kvtree* ER_Get_Stats(
+  int set_id, /**< [IN] - set id to get stats for */
+  int global  /**< [IN] - whether to aggregate stats across comm_world */
+);
+
+/** returns a new kvtree with what encoding a set of num_files files
+ * holding bytes_per_rank bytes on each process with scheme id would
+ * cost, without encoding anything, the caller must kvtree_delete() it:
+ *   * TYPE (string) - type of the scheme, or of its first level
+ *   * LEVELS (int) - levels of redundancy applied
+ *   * DOMAINS (int) - failure domains the scheme spans if it was picked
+ *     by ER_Create_Scheme_auto, which counts them, otherwise the number
+ *     of procs it was created over, which bounds them
+ *   * PARITY_BYTES - bytes of redundancy data each process stores
+ *   * NETWORK_BYTES - bytes each process sends to compute it
+ *   * REBUILD_BYTES - bytes moved to rebuild the files of a lost process
+ *   * STORAGE_BYTES - bytes each process adds to node-local storage
+ *   * FILES (int) - files each process adds to node-local storage
+ *   * STEPS - steps of the encode that synchronize procs if the set has
+ *     no predecessor, each of which ER_Get_Stats counts once under
+ *     COLLECTIVES, redset and shuffile issue more collectives within them
+ *   .
+ * and LEVEL/<level>/{TYPE,SET_SIZE,ERASURE,PARITY_BYTES,NETWORK_BYTES,
+ * REBUILD_BYTES} for each level. Costs follow the set size redset
+ * uses, which is capped at DOMAINS, they are
+ * upper bounds when COMPRESS is set, and depend on the options
+ * set at the time of the call, this is local to the calling process,
+ * returns NULL if scheme id is not found */
+kvtree* ER_Estimate(
+  int scheme_id,               /**< [IN] - scheme id to encode with */
+  int num_files,               /**< [IN] - number of files each process adds */
+  unsigned long bytes_per_rank /**< [IN] - bytes of those files on each process */
+);
+
 /** free internal resources associated with set id */
 int ER_Free(
   int set_id
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mpi.h"
+
+#include "er.h"
+#include "er_util.h"
+#include "er_comm.h"
+
+/* keyval of the attribute that caches our entry on an application
+ * communicator, entries are only touched on the application thread */
+static int er_comm_keyval = MPI_KEYVAL_INVALID;
+
+/* entries currently cached, in the order they were created */
+static er_comm* er_comm_head = NULL;
+static er_comm* er_comm_tail = NULL;
+
+#if MPI_VERSION >= 4
+/* a persistent reduction kept with each of our duplicates, it is
+ * initialized on the first reduction, which every proc of the comm
+ * reaches at the same point since the reduction is collective */
+typedef struct {
+  MPI_Request req;
+  int flag;
+  int all_true;
+} er_comm_coll;
+
+/* keyval of the attribute that holds the persistent reduction of a duplicate */
+static int er_comm_coll_keyval = MPI_KEYVAL_INVALID;
+
+static int er_comm_coll_delete(MPI_Comm comm, int keyval, void* attr, void* extra)
+{
+  (void) comm;
+  (void) keyval;
+  (void) extra;
+  er_comm_coll* coll = (er_comm_coll*) attr;
+  if (coll->req != MPI_REQUEST_NULL) {
+    MPI_Request_free(&coll->req);
+  }
+  er_free(&coll);
+  return MPI_SUCCESS;
+}
+#endif
+
+/* duplicate comm into newcomm and mark it as one of ours */
+static int er_comm_dup(MPI_Comm comm, MPI_Comm* newcomm)
+{
+  if (MPI_Comm_dup(comm, newcomm) != MPI_SUCCESS) {
+    *newcomm = MPI_COMM_NULL;
+    return ER_FAILURE;
+  }
+
+#if MPI_VERSION >= 4
+  er_comm_coll* coll = (er_comm_coll*) ER_MALLOC(sizeof(er_comm_coll));
+  coll->req = MPI_REQUEST_NULL;
+  MPI_Comm_set_attr(*newcomm, er_comm_coll_keyval, (void*) coll);
+#endif
+
+  return ER_SUCCESS;
+}
+
+static void er_comm_unlink(er_comm* c)
+{
+  if (c->prev != NULL) {
+    c->prev->next = c->next;
+  } else {
+    er_comm_head = c->next;
+  }
+  if (c->next != NULL) {
+    c->next->prev = c->prev;
+  } else {
+    er_comm_tail = c->prev;
+  }
+  c->next = NULL;
+  c->prev = NULL;
+}
+
+/* called by MPI when the application frees its communicator,
+ * or by er_comm_finalize, drops the reference held by the cache */
+static int er_comm_delete(MPI_Comm comm, int keyval, void* attr, void* extra)
+{
+  (void) comm;
+  (void) keyval;
+  (void) extra;
+  er_comm* c = (er_comm*) attr;
+  er_comm_unlink(c);
+  c->parent = MPI_COMM_NULL;
+  er_comm_release(&c);
+  return MPI_SUCCESS;
+}
+
+int er_comm_init(void)
+{
+  if (MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, er_comm_delete,
+    &er_comm_keyval, NULL) != MPI_SUCCESS)
+  {
+    return ER_FAILURE;
+  }
+
+#if MPI_VERSION >= 4
+  if (MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, er_comm_coll_delete,
+    &er_comm_coll_keyval, NULL) != MPI_SUCCESS)
+  {
+    MPI_Comm_free_keyval(&er_comm_keyval);
+    return ER_FAILURE;
+  }
+#endif
+
+  return ER_SUCCESS;
+}
+
+void er_comm_finalize(void)
+{
+  /* entries were created in the same order on all procs, so we
+   * free their duplicates in the same order */
+  while (er_comm_head != NULL) {
+    MPI_Comm_delete_attr(er_comm_head->parent, er_comm_keyval);
+  }
+
+  if (er_comm_keyval != MPI_KEYVAL_INVALID) {
+    MPI_Comm_free_keyval(&er_comm_keyval);
+  }
+#if MPI_VERSION >= 4
+  if (er_comm_coll_keyval != MPI_KEYVAL_INVALID) {
+    MPI_Comm_free_keyval(&er_comm_coll_keyval);
+  }
+#endif
+}
+
+er_comm* er_comm_acquire(MPI_Comm comm)
+{
+  /* reuse the duplicates of an earlier set if comm has them */
+  er_comm* c = NULL;
+  int found = 0;
+  MPI_Comm_get_attr(comm, er_comm_keyval, (void*) &c, &found);
+  if (found) {
+    c->refs++;
+    return c;
+  }
+
+  c = (er_comm*) ER_MALLOC(sizeof(er_comm));
+  c->comm     = MPI_COMM_NULL;
+  c->comm_aux = MPI_COMM_NULL;
+  c->comm_app = MPI_COMM_NULL;
+  c->refs     = 0;
+  c->parent   = comm;
+  c->next     = NULL;
+  c->prev     = NULL;
+
+  /* duplicate comm once for each role */
+  if (er_comm_dup(comm, &c->comm)     != ER_SUCCESS ||
+      er_comm_dup(comm, &c->comm_aux) != ER_SUCCESS ||
+      er_comm_dup(comm, &c->comm_app) != ER_SUCCESS)
+  {
+    er_err("Failed to duplicate communicator @ %s:%d",
+      __FILE__, __LINE__);
+    if (c->comm != MPI_COMM_NULL) {
+      MPI_Comm_free(&c->comm);
+    }
+    if (c->comm_aux != MPI_COMM_NULL) {
+      MPI_Comm_free(&c->comm_aux);
+    }
+    er_free(&c);
+    return NULL;
+  }
+
+  /* cache entry on comm, so the next set created on it finds it,
+   * the cache holds a reference until comm is freed or we finalize */
+  MPI_Comm_set_attr(comm, er_comm_keyval, (void*) c);
+  c->refs++;
+  c->prev = er_comm_tail;
+  if (er_comm_tail != NULL) {
+    er_comm_tail->next = c;
+  } else {
+    er_comm_head = c;
+  }
+  er_comm_tail = c;
+
+  c->refs++;
+  return c;
+}
+
+void er_comm_release(er_comm** ptr)
+{
+  er_comm* c = *ptr;
+  if (c == NULL) {
+    return;
+  }
+  *ptr = NULL;
+
+  c->refs--;
+  if (c->refs > 0) {
+    return;
+  }
+
+  MPI_Comm_free(&c->comm_app);
+  MPI_Comm_free(&c->comm_aux);
+  MPI_Comm_free(&c->comm);
+  er_free(&c);
+}
+
+int er_comm_alltrue(int flag, MPI_Comm comm, int* all_true)
+{
+#if MPI_VERSION >= 4
+  /* only our duplicates carry a persistent reduction */
+  er_comm_coll* coll = NULL;
+  int found = 0;
+  MPI_Comm_get_attr(comm, er_comm_coll_keyval, (void*) &coll, &found);
+  if (found) {
+    if (coll->req == MPI_REQUEST_NULL) {
+      MPI_Allreduce_init(&coll->flag, &coll->all_true, 1, MPI_INT, MPI_LAND,
+        comm, MPI_INFO_NULL, &coll->req);
+    }
+    coll->flag = flag;
+    MPI_Start(&coll->req);
+    MPI_Wait(&coll->req, MPI_STATUS_IGNORE);
+    *all_true = coll->all_true;
+    return ER_SUCCESS;
+  }
+#else
+  (void) flag;
+  (void) comm;
+  (void) all_true;
+#endif
+
+  return ER_FAILURE;
+}
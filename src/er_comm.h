@@ -0,0 +1,45 @@
+#ifndef ER_COMM_H
+#define ER_COMM_H
+
+#include "mpi.h"
+
+/** \file er_comm.h
+ *  \ingroup er
+ *  \brief duplicates of application communicators shared by sets */
+
+/** duplicates of one application communicator, which are cached on
+ * it so that every set created on it reuses them */
+typedef struct er_comm_struct {
+  MPI_Comm comm;     /* for the operations of sets, which may run on the progress thread */
+  MPI_Comm comm_aux; /* for helpers running next to an operation, like rebuild migrations */
+  MPI_Comm comm_app; /* for calls on the application thread while an operation may run */
+  int refs;          /* number of holders, the cache on the application comm is one of them */
+  MPI_Comm parent;   /* application communicator, MPI_COMM_NULL once it is gone */
+  struct er_comm_struct* next; /* links entries that are still cached */
+  struct er_comm_struct* prev;
+} er_comm;
+
+/** prepare the cache, called from ER_Init */
+int er_comm_init(void);
+
+/** drop the entries still cached on application communicators,
+ * called from ER_Finalize after all sets were freed */
+void er_comm_finalize(void);
+
+/** return the duplicates of comm, which are created on the first
+ * call for comm, that is collective over comm, so procs must call
+ * this in the same order like they would call MPI_Comm_dup,
+ * returns NULL on failure, release with er_comm_release */
+er_comm* er_comm_acquire(MPI_Comm comm);
+
+/** release an entry obtained from er_comm_acquire and set the pointer
+ * to NULL, the duplicates are freed with the last holder */
+void er_comm_release(er_comm** ptr);
+
+/** compute the logical and of flag over one of our duplicates, using a
+ * persistent collective kept with it when MPI provides them, returns
+ * ER_SUCCESS and sets all_true if it did, ER_FAILURE if the caller has
+ * to reduce on its own */
+int er_comm_alltrue(int flag, MPI_Comm comm, int* all_true);
+
+#endif
@@ -0,0 +1,615 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifdef HAVE_LIBZ
+#include "zlib.h"
+#endif
+
+#include "er.h"
+#include "er_util.h"
+#include "er_pool.h"
+#include "er_io.h"
+#include "er_compress.h"
+
+/* write all n bytes of buf to fd, returns ER_SUCCESS on success */
+static int er_compress_write(int fd, const char* file, const void* buf, size_t n)
+{
+  const char* p = (const char*) buf;
+  size_t written = 0;
+  while (written < n) {
+    ssize_t w = write(fd, p + written, n - written);
+    if (w < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      er_err("Failed to write file %s: %s @ %s:%d",
+        file, strerror(errno), __FILE__, __LINE__);
+      return ER_FAILURE;
+    }
+    written += (size_t) w;
+  }
+  er_io_charge((unsigned long) n);
+  return ER_SUCCESS;
+}
+
+/* open src for reading, unless its contents are in memory (mem is
+ * not NULL), in which case fd_src is -1, and dst for writing, and get
+ * one transfer buffer for each direction,
+ * returns ER_SUCCESS if all of it worked */
+static int er_compress_open(const char* src, const void* mem, const char* dst, int* fd_src, int* fd_dst, er_poolbuf* in, er_poolbuf* out)
+{
+  *fd_src = (mem == NULL) ? open(src, O_RDONLY) : -1;
+  if (mem == NULL && *fd_src < 0) {
+    er_err("Failed to open file %s: %s @ %s:%d",
+      src, strerror(errno), __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  *fd_dst = open(dst, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (*fd_dst < 0) {
+    er_err("Failed to open file %s: %s @ %s:%d",
+      dst, strerror(errno), __FILE__, __LINE__);
+    if (*fd_src >= 0) {
+      close(*fd_src);
+    }
+    return ER_FAILURE;
+  }
+
+  if (er_pool_get_pair(in, out) != ER_SUCCESS) {
+    close(*fd_dst);
+    if (*fd_src >= 0) {
+      close(*fd_src);
+    }
+    return ER_FAILURE;
+  }
+
+  return ER_SUCCESS;
+}
+
+/* give back what er_compress_open got, returns ER_FAILURE if dst
+ * could not be closed */
+static int er_compress_close(const char* dst, int fd_src, int fd_dst, er_poolbuf* in, er_poolbuf* out)
+{
+  int rc = ER_SUCCESS;
+  er_pool_put(out);
+  er_pool_put(in);
+  if (fd_src >= 0) {
+    close(fd_src);
+  }
+  if (close(fd_dst) != 0) {
+    er_err("Failed to close file %s: %s @ %s:%d",
+      dst, strerror(errno), __FILE__, __LINE__);
+    rc = ER_FAILURE;
+  }
+  return rc;
+}
+
+#ifdef HAVE_LIBZ
+
+int er_compress_file(const char* src, const void* mem, size_t mem_size, const char* dst, int level, uint32_t* crc, unsigned long* size_src, unsigned long* size_dst)
+{
+  int fd_src, fd_dst;
+  er_poolbuf in, out;
+  if (er_compress_open(src, mem, dst, &fd_src, &fd_dst, &in, &out) != ER_SUCCESS) {
+    return ER_FAILURE;
+  }
+
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  if (deflateInit(&z, level) != Z_OK) {
+    er_err("Failed to initialize compression of %s @ %s:%d",
+      src, __FILE__, __LINE__);
+    er_compress_close(dst, fd_src, fd_dst, &in, &out);
+    unlink(dst);
+    return ER_FAILURE;
+  }
+
+  int rc = ER_SUCCESS;
+  uint32_t c = 0;
+  unsigned long total_src = 0;
+  unsigned long total_dst = 0;
+  int flush = Z_NO_FLUSH;
+  while (rc == ER_SUCCESS && flush != Z_FINISH) {
+    /* read next chunk, the last one finishes the stream,
+     * contents we have in memory are compressed where they are */
+    const char* next = (const char*) in.buf;
+    ssize_t n;
+    if (mem != NULL) {
+      size_t left = mem_size - (size_t) total_src;
+      next = (const char*) mem + total_src;
+      n = (ssize_t) ((left < in.size) ? left : in.size);
+    } else {
+      n = read(fd_src, in.buf, in.size);
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      er_err("Failed to read file %s: %s @ %s:%d",
+        src, strerror(errno), __FILE__, __LINE__);
+      rc = ER_FAILURE;
+      break;
+    }
+    if (n == 0) {
+      flush = Z_FINISH;
+    }
+    if (crc != NULL) {
+      c = er_crc32c(c, next, (size_t) n);
+    }
+    total_src += (unsigned long) n;
+    if (mem == NULL) {
+      er_io_charge((unsigned long) n);
+    }
+
+    /* compress it while it is in cache */
+    z.next_in  = (Bytef*) next;
+    z.avail_in = (uInt) n;
+    do {
+      z.next_out  = (Bytef*) out.buf;
+      z.avail_out = (uInt) out.size;
+      deflate(&z, flush);
+      size_t have = out.size - z.avail_out;
+      if (er_compress_write(fd_dst, dst, out.buf, have) != ER_SUCCESS) {
+        rc = ER_FAILURE;
+        break;
+      }
+      total_dst += (unsigned long) have;
+    } while (z.avail_out == 0);
+  }
+  deflateEnd(&z);
+
+  if (er_compress_close(dst, fd_src, fd_dst, &in, &out) != ER_SUCCESS) {
+    rc = ER_FAILURE;
+  }
+  if (rc != ER_SUCCESS) {
+    unlink(dst);
+  }
+
+  if (crc != NULL) {
+    *crc = c;
+  }
+  *size_src = total_src;
+  *size_dst = total_dst;
+  return rc;
+}
+
+int er_decompress_file(const char* src, const char* dst, unsigned long* size)
+{
+  int fd_src, fd_dst;
+  er_poolbuf in, out;
+  if (er_compress_open(src, NULL, dst, &fd_src, &fd_dst, &in, &out) != ER_SUCCESS) {
+    return ER_FAILURE;
+  }
+
+  z_stream z;
+  memset(&z, 0, sizeof(z));
+  if (inflateInit(&z) != Z_OK) {
+    er_err("Failed to initialize decompression of %s @ %s:%d",
+      src, __FILE__, __LINE__);
+    er_compress_close(dst, fd_src, fd_dst, &in, &out);
+    unlink(dst);
+    return ER_FAILURE;
+  }
+
+  int rc = ER_SUCCESS;
+  int zrc = Z_OK;
+  unsigned long total = 0;
+  while (rc == ER_SUCCESS && zrc != Z_STREAM_END) {
+    ssize_t n = read(fd_src, in.buf, in.size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      er_err("Failed to read file %s: %s @ %s:%d",
+        src, strerror(errno), __FILE__, __LINE__);
+      rc = ER_FAILURE;
+      break;
+    }
+    if (n == 0) {
+      /* stream ended before it was complete */
+      er_err("Compressed file %s is truncated @ %s:%d",
+        src, __FILE__, __LINE__);
+      rc = ER_FAILURE;
+      break;
+    }
+
+    z.next_in  = (Bytef*) in.buf;
+    z.avail_in = (uInt) n;
+    do {
+      z.next_out  = (Bytef*) out.buf;
+      z.avail_out = (uInt) out.size;
+      zrc = inflate(&z, Z_NO_FLUSH);
+      if (zrc != Z_OK && zrc != Z_STREAM_END && zrc != Z_BUF_ERROR) {
+        er_err("Compressed file %s is damaged @ %s:%d",
+          src, __FILE__, __LINE__);
+        rc = ER_FAILURE;
+        break;
+      }
+      size_t have = out.size - z.avail_out;
+      if (er_compress_write(fd_dst, dst, out.buf, have) != ER_SUCCESS) {
+        rc = ER_FAILURE;
+        break;
+      }
+      total += (unsigned long) have;
+    } while (z.avail_out == 0 && zrc != Z_STREAM_END);
+  }
+  inflateEnd(&z);
+
+  if (er_compress_close(dst, fd_src, fd_dst, &in, &out) != ER_SUCCESS) {
+    rc = ER_FAILURE;
+  }
+  if (rc != ER_SUCCESS) {
+    unlink(dst);
+  }
+
+  *size = total;
+  return rc;
+}
+
+#else
+
+int er_compress_file(const char* src, const void* mem, size_t mem_size, const char* dst, int level, uint32_t* crc, unsigned long* size_src, unsigned long* size_dst)
+{
+  (void) mem;
+  (void) mem_size;
+  (void) dst;
+  (void) level;
+  (void) crc;
+  (void) size_src;
+  (void) size_dst;
+  er_err("Can't compress %s, ER was built without zlib @ %s:%d",
+    src, __FILE__, __LINE__);
+  return ER_FAILURE;
+}
+
+int er_decompress_file(const char* src, const char* dst, unsigned long* size)
+{
+  (void) dst;
+  (void) size;
+  er_err("Can't decompress %s, ER was built without zlib @ %s:%d",
+    src, __FILE__, __LINE__);
+  return ER_FAILURE;
+}
+
+#endif
+
+/* a delta starts with this header, followed by each block of the file
+ * that differs from its base, preceded by the index of the block */
+#define ER_DELTA_MAGIC "ERDELTA1"
+
+/* granularity at which files are compared with their base */
+#define ER_DELTA_BLOCK (64 * 1024)
+
+typedef struct {
+  char magic[8];
+  uint64_t block;    /* number of bytes per block */
+  uint64_t size;     /* number of bytes in file */
+  uint32_t base_crc; /* CRC32C of the base the delta applies to */
+  uint32_t reserved;
+} er_delta_header;
+
+/* read up to n bytes of fd into buf, fewer only at the end of the
+ * file, sets got to the number of bytes read, returns ER_SUCCESS on success */
+static int er_compress_read(int fd, const char* file, void* buf, size_t n, size_t* got)
+{
+  char* p = (char*) buf;
+  size_t total = 0;
+  while (total < n) {
+    ssize_t r = read(fd, p + total, n - total);
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      er_err("Failed to read file %s: %s @ %s:%d",
+        file, strerror(errno), __FILE__, __LINE__);
+      return ER_FAILURE;
+    }
+    if (r == 0) {
+      break;
+    }
+    total += (size_t) r;
+  }
+  er_io_charge((unsigned long) total);
+  *got = total;
+  return ER_SUCCESS;
+}
+
+/* open the base of a delta for reading, sets fd to -1 if there is no base */
+static int er_delta_open_base(const char* base, int* fd)
+{
+  *fd = -1;
+  if (base == NULL) {
+    return ER_SUCCESS;
+  }
+  *fd = open(base, O_RDONLY);
+  if (*fd < 0) {
+    er_err("Failed to open file %s: %s @ %s:%d",
+      base, strerror(errno), __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+  return ER_SUCCESS;
+}
+
+/* read what is left of base to finish its checksum */
+static int er_delta_drain_base(int fd, const char* base, void* buf, size_t n, uint32_t* crc)
+{
+  size_t got = n;
+  while (fd >= 0 && got > 0) {
+    if (er_compress_read(fd, base, buf, n, &got) != ER_SUCCESS) {
+      return ER_FAILURE;
+    }
+    *crc = er_crc32c(*crc, buf, got);
+  }
+  return ER_SUCCESS;
+}
+
+/* point buf_in and buf_cmp at buffers of buf_size bytes that hold at
+ * least one block, the pool buffers if they are large enough, otherwise
+ * buffers of one block allocated into own, which the caller frees with
+ * er_align_free, so the block size we write does not depend on
+ * MPI_BUF_SIZE and deltas can be restored by a job with other settings */
+static void er_delta_bufs(const er_poolbuf* in, const er_poolbuf* cmp,
+  char** buf_in, char** buf_cmp, size_t* buf_size, char** own)
+{
+  *own = NULL;
+  if (in->size >= ER_DELTA_BLOCK && cmp->size >= ER_DELTA_BLOCK) {
+    *buf_in   = (char*) in->buf;
+    *buf_cmp  = (char*) cmp->buf;
+    *buf_size = (in->size < cmp->size) ? in->size : cmp->size;
+    return;
+  }
+  *own = (char*) er_align_malloc(2 * ER_DELTA_BLOCK, er_page_size);
+  if (*own == NULL) {
+    er_abort(-1, "Failed to allocate %d bytes for delta @ %s:%d",
+      2 * ER_DELTA_BLOCK, __FILE__, __LINE__);
+  }
+  *buf_in   = *own;
+  *buf_cmp  = *own + ER_DELTA_BLOCK;
+  *buf_size = ER_DELTA_BLOCK;
+}
+
+int er_delta_file(const char* src, const void* mem, size_t mem_size, const char* base, const char* dst, uint32_t* crc, unsigned long* size_src, unsigned long* size_dst)
+{
+  int fd_src, fd_dst, fd_base;
+  er_poolbuf in, cmp;
+  if (er_compress_open(src, mem, dst, &fd_src, &fd_dst, &in, &cmp) != ER_SUCCESS) {
+    return ER_FAILURE;
+  }
+  if (er_delta_open_base(base, &fd_base) != ER_SUCCESS) {
+    er_compress_close(dst, fd_src, fd_dst, &in, &cmp);
+    unlink(dst);
+    return ER_FAILURE;
+  }
+
+  char* buf_in;
+  char* buf_cmp;
+  char* own;
+  size_t buf_size;
+  er_delta_bufs(&in, &cmp, &buf_in, &buf_cmp, &buf_size, &own);
+
+  /* compare whole blocks of each chunk we read */
+  size_t block = ER_DELTA_BLOCK;
+  size_t chunk = (buf_size / block) * block;
+
+  /* size and checksum of base are filled in once we know them */
+  er_delta_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, ER_DELTA_MAGIC, sizeof(h.magic));
+  h.block = (uint64_t) block;
+  int rc = er_compress_write(fd_dst, dst, &h, sizeof(h));
+
+  uint32_t c  = 0;
+  uint32_t bc = 0;
+  unsigned long total_src = 0;
+  unsigned long total_dst = sizeof(h);
+  uint64_t index = 0;
+  size_t n = chunk;
+  while (rc == ER_SUCCESS && n == chunk) {
+    const char* p = (const char*) buf_in;
+    const char* q = (const char*) buf_cmp;
+    size_t nb = 0;
+    if (mem != NULL) {
+      /* compare contents we already have in memory where they are,
+       * files are always read, the app may truncate a mapped file */
+      size_t pos = (size_t) total_src;
+      n = (mem_size - pos < chunk) ? mem_size - pos : chunk;
+      p = (const char*) mem + pos;
+      if (fd_base >= 0 && er_compress_read(fd_base, base, buf_cmp, chunk, &nb) != ER_SUCCESS) {
+        rc = ER_FAILURE;
+        break;
+      }
+    } else if (er_compress_read(fd_src, src, buf_in, chunk, &n) != ER_SUCCESS ||
+               (fd_base >= 0 && er_compress_read(fd_base, base, buf_cmp, chunk, &nb) != ER_SUCCESS))
+    {
+      rc = ER_FAILURE;
+      break;
+    }
+    if (crc != NULL) {
+      c = er_crc32c(c, p, n);
+    }
+    bc = er_crc32c(bc, q, nb);
+    total_src += (unsigned long) n;
+
+    /* keep blocks that are not in base as they are */
+    size_t off;
+    for (off = 0; off < n && rc == ER_SUCCESS; off += block, index++) {
+      size_t len = (n - off < block) ? n - off : block;
+      if (off + len <= nb && memcmp(p + off, q + off, len) == 0) {
+        continue;
+      }
+      if (er_compress_write(fd_dst, dst, &index, sizeof(index)) != ER_SUCCESS ||
+          er_compress_write(fd_dst, dst, p + off, len) != ER_SUCCESS)
+      {
+        rc = ER_FAILURE;
+      }
+      total_dst += (unsigned long) (sizeof(index) + len);
+    }
+  }
+  if (rc == ER_SUCCESS) {
+    rc = er_delta_drain_base(fd_base, base, buf_cmp, chunk, &bc);
+  }
+
+  if (rc == ER_SUCCESS) {
+    h.size     = (uint64_t) total_src;
+    h.base_crc = bc;
+    if (pwrite(fd_dst, &h, sizeof(h), 0) != (ssize_t) sizeof(h)) {
+      er_err("Failed to write file %s: %s @ %s:%d",
+        dst, strerror(errno), __FILE__, __LINE__);
+      rc = ER_FAILURE;
+    }
+  }
+
+  if (own != NULL) {
+    er_align_free(&own);
+  }
+  if (fd_base >= 0) {
+    close(fd_base);
+  }
+  if (er_compress_close(dst, fd_src, fd_dst, &in, &cmp) != ER_SUCCESS) {
+    rc = ER_FAILURE;
+  }
+  if (rc != ER_SUCCESS) {
+    unlink(dst);
+  }
+
+  if (crc != NULL) {
+    *crc = c;
+  }
+  *size_src = total_src;
+  *size_dst = total_dst;
+  return rc;
+}
+
+int er_undelta_file(const char* src, const char* base, const char* dst, unsigned long* size)
+{
+  int fd_src, fd_dst, fd_base;
+  er_poolbuf in, cmp;
+  if (er_compress_open(src, NULL, dst, &fd_src, &fd_dst, &in, &cmp) != ER_SUCCESS) {
+    return ER_FAILURE;
+  }
+  if (er_delta_open_base(base, &fd_base) != ER_SUCCESS) {
+    er_compress_close(dst, fd_src, fd_dst, &in, &cmp);
+    unlink(dst);
+    return ER_FAILURE;
+  }
+
+  char* buf_in;
+  char* buf_cmp;
+  char* own;
+  size_t buf_size;
+  er_delta_bufs(&in, &cmp, &buf_in, &buf_cmp, &buf_size, &own);
+
+  int rc = ER_SUCCESS;
+  int damaged = 0;
+
+  er_delta_header h;
+  size_t got;
+  if (er_compress_read(fd_src, src, &h, sizeof(h), &got) != ER_SUCCESS) {
+    rc = ER_FAILURE;
+  } else if (got != sizeof(h) || memcmp(h.magic, ER_DELTA_MAGIC, sizeof(h.magic)) != 0 ||
+             h.block == 0 || h.block > (uint64_t) buf_size)
+  {
+    damaged = 1;
+  }
+
+  /* index of the next block stored in the delta, if any */
+  uint64_t next = 0;
+  int have_next = 0;
+  if (rc == ER_SUCCESS && ! damaged) {
+    if (er_compress_read(fd_src, src, &next, sizeof(next), &got) != ER_SUCCESS) {
+      rc = ER_FAILURE;
+    }
+    have_next = (got == sizeof(next));
+    damaged = (got != 0 && got != sizeof(next));
+  }
+
+  /* write each block from the delta or from base */
+  uint32_t bc = 0;
+  unsigned long total = 0;
+  uint64_t k;
+  for (k = 0; rc == ER_SUCCESS && ! damaged && total < h.size; k++) {
+    size_t len = (h.size - total < h.block) ? (size_t) (h.size - total) : (size_t) h.block;
+
+    /* read base at the same offset, so its checksum covers all of it */
+    size_t nb = 0;
+    if (fd_base >= 0 && er_compress_read(fd_base, base, buf_cmp, len, &nb) != ER_SUCCESS) {
+      rc = ER_FAILURE;
+      break;
+    }
+    bc = er_crc32c(bc, buf_cmp, nb);
+
+    const void* out = buf_cmp;
+    if (have_next && next == k) {
+      if (er_compress_read(fd_src, src, buf_in, len, &got) != ER_SUCCESS) {
+        rc = ER_FAILURE;
+        break;
+      }
+      if (got != len) {
+        damaged = 1;
+        break;
+      }
+      out = buf_in;
+
+      uint64_t prev = next;
+      if (er_compress_read(fd_src, src, &next, sizeof(next), &got) != ER_SUCCESS) {
+        rc = ER_FAILURE;
+        break;
+      }
+      have_next = (got == sizeof(next));
+      damaged = ((got != 0 && got != sizeof(next)) || (have_next && next <= prev));
+    } else if (nb != len) {
+      /* base is shorter than it was when the delta was written */
+      damaged = 1;
+      break;
+    }
+
+    if (er_compress_write(fd_dst, dst, out, len) != ER_SUCCESS) {
+      rc = ER_FAILURE;
+      break;
+    }
+    total += (unsigned long) len;
+  }
+  if (have_next) {
+    /* delta holds blocks past the end of the file */
+    damaged = 1;
+  }
+
+  if (rc == ER_SUCCESS && ! damaged) {
+    rc = er_delta_drain_base(fd_base, base, buf_cmp, buf_size, &bc);
+    if (rc == ER_SUCCESS && bc != h.base_crc) {
+      er_err("Base file %s of delta %s changed since the delta was written @ %s:%d",
+        (base != NULL) ? base : "", src, __FILE__, __LINE__);
+      rc = ER_FAILURE;
+    }
+  }
+  if (damaged) {
+    er_err("Delta file %s is damaged @ %s:%d",
+      src, __FILE__, __LINE__);
+    rc = ER_FAILURE;
+  }
+
+  if (own != NULL) {
+    er_align_free(&own);
+  }
+  if (fd_base >= 0) {
+    close(fd_base);
+  }
+  if (er_compress_close(dst, fd_src, fd_dst, &in, &cmp) != ER_SUCCESS) {
+    rc = ER_FAILURE;
+  }
+  if (rc != ER_SUCCESS) {
+    unlink(dst);
+  }
+
+  *size = total;
+  return rc;
+}
@@ -0,0 +1,66 @@
+#ifndef ER_COMPRESS_H
+#define ER_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \file er_compress.h
+ *  \ingroup er
+ *  \brief compressed copies of files that stand in for them in redundancy */
+
+/** write a zlib compressed copy of file src to dst at the given level
+ * (1 fastest to 9 smallest), taking the contents from the mem_size
+ * bytes at mem instead of reading src if mem is not NULL, sets size_src and size_dst to the number
+ * of bytes read from src and written to dst, if crc is not NULL, also computes the CRC32C
+ * of the contents of src in the same pass,
+ * returns ER_SUCCESS if the whole file could be compressed */
+int er_compress_file(
+  const char* src,
+  const void* mem,
+  size_t mem_size,
+  const char* dst,
+  int level,
+  uint32_t* crc,
+  unsigned long* size_src,
+  unsigned long* size_dst
+);
+
+/** restore file dst from its compressed copy src written by
+ * er_compress_file, sets size to the number of bytes written to dst,
+ * deletes dst and returns ER_FAILURE if src is damaged or incomplete */
+int er_decompress_file(
+  const char* src,
+  const char* dst,
+  unsigned long* size
+);
+
+/** write the blocks of file src that differ from file base to dst,
+ * comparing them at the same offsets, blocks past the end of base
+ * differ, as do all blocks if base is NULL, takes the contents of src
+ * from the mem_size bytes at mem instead if mem is not NULL, sets size_src and size_dst
+ * to the number of bytes read from src and written to dst, if crc is
+ * not NULL, also computes the CRC32C of the contents of src in the
+ * same pass, returns ER_SUCCESS if the whole file could be compared */
+int er_delta_file(
+  const char* src,
+  const void* mem,
+  size_t mem_size,
+  const char* base,
+  const char* dst,
+  uint32_t* crc,
+  unsigned long* size_src,
+  unsigned long* size_dst
+);
+
+/** restore file dst from file base (may be NULL) and the delta src
+ * written against it by er_delta_file, sets size to the number of bytes
+ * written to dst, deletes dst and returns ER_FAILURE if src is damaged
+ * or incomplete, or if base changed since src was written */
+int er_undelta_file(
+  const char* src,
+  const char* base,
+  const char* dst,
+  unsigned long* size
+);
+
+#endif
@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "mpi.h"
+
+#include "er.h"
+#include "er_util.h"
+#include "er_io.h"
+#include "er_pool.h"
+
+/* number of threads, including the caller, each process uses */
+static int er_io_width = 1;
+
+/* list of items being worked on by a team of threads */
+typedef struct {
+  er_io_fn fn;
+  void* arg;
+  int count;
+  int next; /* index of next item to be picked up */
+  int rc;   /* ER_FAILURE if any item failed */
+  pthread_mutex_t mutex;
+} er_io_team;
+
+/* whether the current dispatch runs in the background,
+ * only then do MAX_BW, MAX_CHUNKS, and ER_Pause apply */
+static int er_io_async = 0;
+
+/* rate limit of the current dispatch */
+static er_throttle er_io_throttle;
+static int er_io_throttle_ready = 0;
+
+/* number of outstanding calls to er_io_pause */
+static int er_io_paused = 0;
+static pthread_mutex_t er_io_pause_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  er_io_pause_cond  = PTHREAD_COND_INITIALIZER;
+
+void er_io_configure(MPI_Comm comm_store, int async)
+{
+  int ranks;
+  MPI_Comm_size(comm_store, &ranks);
+
+  /* split the limit for the node among its procs, but every proc
+   * gets at least its own thread */
+  int width = (er_io_threads > 0) ? er_io_threads / ranks : 1;
+  if (width < 1) {
+    width = 1;
+  }
+  er_io_width = width;
+
+  /* no I/O threads are running between dispatches,
+   * so we can reset the limits without racing them */
+  unsigned long rate = 0;
+  if (async && er_max_bw > 0) {
+    rate = er_max_bw / (unsigned long) ranks;
+    if (rate == 0) {
+      rate = 1;
+    }
+  }
+  if (er_io_throttle_ready) {
+    er_throttle_free(&er_io_throttle);
+  }
+  er_throttle_init(&er_io_throttle, rate);
+  er_io_throttle_ready = 1;
+
+  er_pool_limit(async ? er_max_chunks : 0);
+
+  er_io_async = async;
+}
+
+void er_io_charge(unsigned long bytes)
+{
+  if (! er_io_async) {
+    return;
+  }
+  er_io_wait_resumed();
+  er_throttle_charge(&er_io_throttle, bytes);
+}
+
+void er_io_charge_files(int count, const char** files)
+{
+  if (! er_io_async || er_max_bw == 0) {
+    return;
+  }
+
+  unsigned long bytes = 0;
+  int i;
+  for (i = 0; i < count; i++) {
+    struct stat st;
+    if (stat(files[i], &st) == 0) {
+      bytes += (unsigned long) st.st_size;
+    }
+  }
+  er_io_charge(bytes);
+}
+
+void er_io_wait_resumed(void)
+{
+  if (! er_io_async) {
+    return;
+  }
+  pthread_mutex_lock(&er_io_pause_mutex);
+  while (er_io_paused > 0) {
+    pthread_cond_wait(&er_io_pause_cond, &er_io_pause_mutex);
+  }
+  pthread_mutex_unlock(&er_io_pause_mutex);
+}
+
+void er_io_pause(void)
+{
+  pthread_mutex_lock(&er_io_pause_mutex);
+  er_io_paused++;
+  pthread_mutex_unlock(&er_io_pause_mutex);
+}
+
+void er_io_resume(void)
+{
+  pthread_mutex_lock(&er_io_pause_mutex);
+  if (er_io_paused > 0) {
+    er_io_paused--;
+  }
+  if (er_io_paused == 0) {
+    pthread_cond_broadcast(&er_io_pause_cond);
+  }
+  pthread_mutex_unlock(&er_io_pause_mutex);
+}
+
+/* pick up items until the list is done */
+static void* er_io_work(void* arg)
+{
+  er_io_team* team = (er_io_team*) arg;
+
+  while (1) {
+    pthread_mutex_lock(&team->mutex);
+    int i = team->next;
+    if (i < team->count) {
+      team->next++;
+    }
+    pthread_mutex_unlock(&team->mutex);
+
+    if (i >= team->count) {
+      break;
+    }
+
+    if (team->fn(i, team->arg) != ER_SUCCESS) {
+      pthread_mutex_lock(&team->mutex);
+      team->rc = ER_FAILURE;
+      pthread_mutex_unlock(&team->mutex);
+    }
+  }
+
+  return NULL;
+}
+
+int er_io_run(int count, er_io_fn fn, void* arg)
+{
+  er_io_team team;
+  team.fn    = fn;
+  team.arg   = arg;
+  team.count = count;
+  team.next  = 0;
+  team.rc    = ER_SUCCESS;
+  pthread_mutex_init(&team.mutex, NULL);
+
+  /* no point in having more threads than items */
+  int helpers = er_io_width - 1;
+  if (helpers > count - 1) {
+    helpers = count - 1;
+  }
+
+  /* threads that fail to start just leave more items for the others */
+  pthread_t* threads = NULL;
+  int started = 0;
+  if (helpers > 0) {
+    threads = (pthread_t*) ER_MALLOC(helpers * sizeof(pthread_t));
+    while (started < helpers &&
+           pthread_create(&threads[started], NULL, er_io_work, &team) == 0)
+    {
+      started++;
+    }
+  }
+
+  er_io_work(&team);
+
+  int i;
+  for (i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  er_free(&threads);
+
+  pthread_mutex_destroy(&team.mutex);
+
+  return team.rc;
+}
@@ -0,0 +1,49 @@
+#ifndef ER_IO_H
+#define ER_IO_H
+
+#include "mpi.h"
+
+/** \file er_io.h
+ *  \ingroup er
+ *  \brief concurrent execution of per-file I/O */
+
+/** work on item i of a list, returns ER_SUCCESS or ER_FAILURE */
+typedef int (*er_io_fn)(int i, void* arg);
+
+/** set the number of threads each process uses for file I/O from
+ * the IO_THREADS limit, which is shared by the procs in comm_store
+ * since they access the same storage, if async is set, the operations
+ * run in the background and are held to the MAX_BW limit, which is
+ * shared the same way, the MAX_CHUNKS limit, and ER_Pause,
+ * called before each dispatch */
+void er_io_configure(MPI_Comm comm_store, int async);
+
+/** charge bytes of file I/O to the MAX_BW limit, sleeps until the
+ * rate of the operations dispatched in the background is within the
+ * limit, and waits while they are paused, call between chunks,
+ * safe to call from any thread */
+void er_io_charge(unsigned long bytes);
+
+/** charge the sizes of count files that a library call read or
+ * wrote on our behalf, which paces the steps that follow it */
+void er_io_charge_files(int count, const char** files);
+
+/** wait while operations dispatched in the background are paused */
+void er_io_wait_resumed(void);
+
+/** hold operations dispatched in the background at their next
+ * chunk of file I/O or step, calls nest */
+void er_io_pause(void);
+
+/** undo one call to er_io_pause, operations continue when the
+ * last one is undone */
+void er_io_resume(void);
+
+/** call fn on each of count items, using as many threads as
+ * er_io_configure allowed, including the calling thread, fn must not
+ * call into MPI, so that the team may run whatever thread level MPI
+ * provides, nor modify shared data without locking,
+ * returns ER_SUCCESS if fn succeeded on every item */
+int er_io_run(int count, er_io_fn fn, void* arg);
+
+#endif
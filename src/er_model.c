@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "er.h"
+#include "er_util.h"
+#include "er_model.h"
+
+/* how much a byte moved during rebuild counts against a byte moved
+ * during encode, sets are encoded at every checkpoint but rebuilt
+ * only on restart, so we assume about one rebuild per ten encodes */
+#define ER_MODEL_REBUILD_WEIGHT (0.1)
+
+/* slack when comparing costs and overheads computed in floating point */
+#define ER_MODEL_EPS (1e-9)
+
+const char* er_model_name(int type)
+{
+  switch (type) {
+  case ER_MODEL_SINGLE:  return "SINGLE";
+  case ER_MODEL_XOR:     return "XOR";
+  case ER_MODEL_RS:      return "RS";
+  case ER_MODEL_PARTNER: return "PARTNER";
+  }
+  return "UNKNOWN";
+}
+
+void er_model_eval(er_model* m)
+{
+  double n = (double) m->set_size;
+  double k = (double) m->erasure;
+
+  switch (m->type) {
+  case ER_MODEL_XOR:
+    /* each proc holds one share of parity over n-1 shares of data,
+     * a reduce-scatter around the set sends one data size per proc,
+     * a lost proc is rebuilt from all n-1 others */
+    m->overhead = 1.0 / (n - 1.0);
+    m->encode   = 1.0;
+    m->rebuild  = n - 1.0;
+    break;
+  case ER_MODEL_RS:
+    /* data is split into n-k shares and k parity shares are computed,
+     * each proc sends its shares to the n-1 others for every parity
+     * block, a lost proc is rebuilt from n-k others */
+    m->overhead = k / (n - k);
+    m->encode   = k * (n - 1.0) / (n - k);
+    m->rebuild  = n - k;
+    break;
+  case ER_MODEL_PARTNER:
+    /* a full copy of data is sent to each of k partners,
+     * a lost proc gets its copy back from one of them */
+    m->overhead = k;
+    m->encode   = k;
+    m->rebuild  = 1.0;
+    break;
+  default:
+    /* nothing is stored and nothing can be rebuilt */
+    m->overhead = 0.0;
+    m->encode   = 0.0;
+    m->rebuild  = 0.0;
+    break;
+  }
+}
+
+/* returns weighted cost of a scheme used to rank candidates */
+static double er_model_cost(const er_model* m)
+{
+  return m->encode + ER_MODEL_REBUILD_WEIGHT * m->rebuild;
+}
+
+/* replace best with candidate if candidate fits and is cheaper,
+ * ties go to the scheme that stores less */
+static void er_model_consider(er_model* best, int* found, int type, int set_size, int erasure, double overhead)
+{
+  er_model m;
+  m.type     = type;
+  m.set_size = set_size;
+  m.erasure  = erasure;
+  er_model_eval(&m);
+
+  if (m.overhead > overhead + ER_MODEL_EPS) {
+    return;
+  }
+
+  if (*found) {
+    double cost = er_model_cost(&m);
+    double best_cost = er_model_cost(best);
+    if (cost > best_cost + ER_MODEL_EPS) {
+      return;
+    }
+    if (cost > best_cost - ER_MODEL_EPS && m.overhead >= best->overhead) {
+      return;
+    }
+  }
+
+  *best  = m;
+  *found = 1;
+}
+
+int er_model_pick(int domains, int tolerance, double overhead, er_model* m)
+{
+  int found = 0;
+
+  /* nothing to tolerate, so nothing to store */
+  if (tolerance == 0) {
+    m->type     = ER_MODEL_SINGLE;
+    m->set_size = 1;
+    m->erasure  = 0;
+    er_model_eval(m);
+    return ER_SUCCESS;
+  }
+
+  /* members of a set must be in distinct failure domains */
+  if (tolerance + 1 <= domains) {
+    er_model_consider(m, &found, ER_MODEL_PARTNER, tolerance + 1, tolerance, overhead);
+  }
+
+  int n;
+  if (tolerance == 1) {
+    for (n = 2; n <= domains; n++) {
+      er_model_consider(m, &found, ER_MODEL_XOR, n, 1, overhead);
+    }
+  } else {
+    /* we only support Reed-Solomon with fewer erasure than data blocks */
+    for (n = 2 * tolerance + 1; n <= domains; n++) {
+      er_model_consider(m, &found, ER_MODEL_RS, n, tolerance, overhead);
+    }
+  }
+
+  return found ? ER_SUCCESS : ER_FAILURE;
+}
@@ -0,0 +1,37 @@
+#ifndef ER_MODEL_H
+#define ER_MODEL_H
+
+/** \file er_model.h
+ *  \ingroup er
+ *  \brief cost model of redundancy schemes */
+
+/** types of redundancy schemes */
+#define ER_MODEL_SINGLE  (0)
+#define ER_MODEL_XOR     (1)
+#define ER_MODEL_RS      (2)
+#define ER_MODEL_PARTNER (3)
+
+/** a redundancy scheme and what it costs, costs are in bytes per
+ * byte of data of a proc, so they scale with the size of a set */
+typedef struct {
+  int type;        /* one of ER_MODEL constants */
+  int set_size;    /* number of failure domains in a redundancy set */
+  int erasure;     /* number of domains of a set that may fail, replicas for PARTNER */
+  double overhead; /* bytes of redundancy data stored */
+  double encode;   /* bytes sent over the network by each proc to encode */
+  double rebuild;  /* bytes sent over the network to rebuild a lost proc */
+} er_model;
+
+/** returns name of scheme type like "XOR" */
+const char* er_model_name(int type);
+
+/** fill in costs for type, set_size, and erasure of m */
+void er_model_eval(er_model* m);
+
+/** pick the scheme that tolerates the loss of tolerance failure domains
+ * per set and stores at most overhead bytes of redundancy data per
+ * byte of data at the lowest cost, given the number of failure domains,
+ * returns ER_SUCCESS if some scheme fits */
+int er_model_pick(int domains, int tolerance, double overhead, er_model* m);
+
+#endif
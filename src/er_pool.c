@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <pthread.h>
+
+#include "mpi.h"
+
+#include "er.h"
+#include "er_util.h"
+#include "er_pool.h"
+
+/* number of returned buffers we hold on to, enough for the progress
+ * thread and a few I/O threads to each keep one */
+#define ER_POOL_MAX (16)
+
+/* size of huge pages we align buffers to when asked to */
+#define ER_POOL_HUGEPAGE (2 * 1024 * 1024)
+
+/* buffers that were returned to the pool */
+static er_poolbuf er_pool_free[ER_POOL_MAX];
+static int er_pool_count = 0;
+
+/* protects the list of returned buffers */
+static pthread_mutex_t er_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* number of buffers lent at once, and the limit on it, 0 if none */
+static int er_pool_lent = 0;
+static int er_pool_max  = 0;
+static pthread_cond_t er_pool_cond = PTHREAD_COND_INITIALIZER;
+
+/* size of buffers we hand out */
+static size_t er_pool_size(void)
+{
+  return (er_mpi_buf_size > 0) ? (size_t) er_mpi_buf_size : 1024 * 1024;
+}
+
+static int er_pool_alloc(er_poolbuf* b, size_t size)
+{
+  b->buf  = NULL;
+  b->size = size;
+
+  /* align large buffers to huge pages so the kernel can back them
+   * with huge pages, which saves page faults and TLB misses */
+  size_t align = er_page_size;
+  if (er_buf_hugepage && size >= ER_POOL_HUGEPAGE) {
+    align = ER_POOL_HUGEPAGE;
+  }
+
+  b->buf = er_align_malloc(size, align);
+  if (b->buf == NULL) {
+    er_err("Failed to allocate %lu byte transfer buffer @ %s:%d",
+      (unsigned long) size, __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+#ifdef MADV_HUGEPAGE
+  if (align == ER_POOL_HUGEPAGE) {
+    madvise(b->buf, size, MADV_HUGEPAGE);
+  }
+#endif
+
+  return ER_SUCCESS;
+}
+
+static void er_pool_release(er_poolbuf* b)
+{
+  if (b->buf == NULL) {
+    return;
+  }
+  er_align_free(&b->buf);
+}
+
+int er_pool_init(void)
+{
+  pthread_mutex_lock(&er_pool_mutex);
+  er_pool_count = 0;
+  pthread_mutex_unlock(&er_pool_mutex);
+  return ER_SUCCESS;
+}
+
+void er_pool_finalize(void)
+{
+  pthread_mutex_lock(&er_pool_mutex);
+  while (er_pool_count > 0) {
+    er_pool_count--;
+    er_pool_release(&er_pool_free[er_pool_count]);
+  }
+  pthread_mutex_unlock(&er_pool_mutex);
+}
+
+void er_pool_limit(int max)
+{
+  /* er_pool_get_pair needs room for two */
+  if (max > 0 && max < 2) {
+    max = 2;
+  }
+
+  pthread_mutex_lock(&er_pool_mutex);
+  er_pool_max = (max > 0) ? max : 0;
+  pthread_cond_broadcast(&er_pool_cond);
+  pthread_mutex_unlock(&er_pool_mutex);
+}
+
+/* wait until count more buffers may be lent and count them as lent */
+static void er_pool_reserve(int count)
+{
+  pthread_mutex_lock(&er_pool_mutex);
+  while (er_pool_max > 0 && er_pool_lent + count > er_pool_max) {
+    pthread_cond_wait(&er_pool_cond, &er_pool_mutex);
+  }
+  er_pool_lent += count;
+  pthread_mutex_unlock(&er_pool_mutex);
+}
+
+/* undo er_pool_reserve of count buffers */
+static void er_pool_unreserve(int count)
+{
+  pthread_mutex_lock(&er_pool_mutex);
+  er_pool_lent -= count;
+  pthread_cond_broadcast(&er_pool_cond);
+  pthread_mutex_unlock(&er_pool_mutex);
+}
+
+/* lend a buffer that was reserved with er_pool_reserve */
+static int er_pool_take(er_poolbuf* b)
+{
+  size_t size = er_pool_size();
+
+  /* take the most recently returned buffer, it is the most likely
+   * to still be in cache, drop buffers left from an older config */
+  pthread_mutex_lock(&er_pool_mutex);
+  while (er_pool_count > 0) {
+    er_pool_count--;
+    er_poolbuf* cached = &er_pool_free[er_pool_count];
+    if (cached->size == size) {
+      *b = *cached;
+      pthread_mutex_unlock(&er_pool_mutex);
+      return ER_SUCCESS;
+    }
+    er_pool_release(cached);
+  }
+  pthread_mutex_unlock(&er_pool_mutex);
+
+  return er_pool_alloc(b, size);
+}
+
+int er_pool_get(er_poolbuf* b)
+{
+  er_pool_reserve(1);
+  if (er_pool_take(b) != ER_SUCCESS) {
+    er_pool_unreserve(1);
+    return ER_FAILURE;
+  }
+  return ER_SUCCESS;
+}
+
+int er_pool_get_pair(er_poolbuf* a, er_poolbuf* b)
+{
+  er_pool_reserve(2);
+  if (er_pool_take(a) != ER_SUCCESS) {
+    er_pool_unreserve(2);
+    return ER_FAILURE;
+  }
+  if (er_pool_take(b) != ER_SUCCESS) {
+    er_pool_put(a);
+    er_pool_unreserve(1);
+    return ER_FAILURE;
+  }
+  return ER_SUCCESS;
+}
+
+void er_pool_put(er_poolbuf* b)
+{
+  if (b->buf == NULL) {
+    return;
+  }
+  er_pool_unreserve(1);
+
+  /* keep buffer for the next caller, unless we have enough already
+   * or the buffer no longer matches the current config */
+  pthread_mutex_lock(&er_pool_mutex);
+  if (er_pool_count < ER_POOL_MAX && b->size == er_pool_size()) {
+    er_pool_free[er_pool_count] = *b;
+    er_pool_count++;
+    b->buf = NULL;
+  }
+  pthread_mutex_unlock(&er_pool_mutex);
+
+  er_pool_release(b);
+}
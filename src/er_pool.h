@@ -0,0 +1,41 @@
+#ifndef ER_POOL_H
+#define ER_POOL_H
+
+#include <stddef.h>
+
+/** \file er_pool.h
+ *  \ingroup er
+ *  \brief pool of reusable transfer buffers */
+
+/** a buffer lent from the pool */
+typedef struct {
+  void* buf;   /* page-aligned memory of size bytes */
+  size_t size; /* number of bytes in buf, MPI_BUF_SIZE at the time it was lent */
+} er_poolbuf;
+
+/** prepare the pool, called from ER_Init */
+int er_pool_init(void);
+
+/** free all buffers held by the pool, called from ER_Finalize,
+ * all lent buffers must have been returned */
+void er_pool_finalize(void);
+
+/** limit the number of buffers lent at once to max, at least two,
+ * callers wait for a buffer to be returned when the limit is
+ * reached, 0 for no limit */
+void er_pool_limit(int max);
+
+/** lend a buffer of MPI_BUF_SIZE bytes, reusing one that was
+ * returned earlier when possible, safe to call from any thread,
+ * returns ER_SUCCESS if b holds a buffer */
+int er_pool_get(er_poolbuf* b);
+
+/** lend two buffers at once, so that callers that need two can't
+ * wait on each other under the limit of er_pool_limit,
+ * returns ER_SUCCESS if a and b hold a buffer */
+int er_pool_get_pair(er_poolbuf* a, er_poolbuf* b);
+
+/** return a buffer obtained from er_pool_get to the pool */
+void er_pool_put(er_poolbuf* b);
+
+#endif
@@ -0,0 +1,261 @@
+/* for cpu_set_t and pthread_setaffinity_np */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "er.h"
+#include "er_util.h"
+#include "er_progress.h"
+
+/* an operation waiting in the queue */
+typedef struct er_progress_item_struct {
+  er_progress_fn fn;
+  void* arg;
+  struct er_progress_item_struct* next;
+} er_progress_item;
+
+static pthread_mutex_t er_progress_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  er_progress_cond  = PTHREAD_COND_INITIALIZER;
+
+/* FIFO of queued operations */
+static er_progress_item* er_progress_head = NULL;
+static er_progress_item* er_progress_tail = NULL;
+
+static int er_progress_enabled = 0; /* set by er_progress_init */
+static int er_progress_running = 0; /* whether thread has been started */
+static int er_progress_stop    = 0; /* asks thread to exit once queue is empty */
+static int er_progress_spin    = 0; /* er_progress_poll as of the last update, protected by er_progress_mutex */
+static pthread_t er_progress_thread;
+
+/* parses a cpu list like "0,4-7" into a count of cpus and
+ * optionally sets them in mask, returns -1 on a syntax error */
+static int er_progress_parse_cpus(const char* cpus, void* mask)
+{
+  int count = 0;
+  const char* p = cpus;
+  while (*p != '\0') {
+    /* parse first cpu of range */
+    char* end;
+    errno = 0;
+    long first = strtol(p, &end, 10);
+    if (end == p || errno != 0 || first < 0) {
+      return -1;
+    }
+    p = end;
+
+    /* parse last cpu of range, if any */
+    long last = first;
+    if (*p == '-') {
+      p++;
+      last = strtol(p, &end, 10);
+      if (end == p || errno != 0 || last < first) {
+        return -1;
+      }
+      p = end;
+    }
+
+    long cpu;
+    for (cpu = first; cpu <= last; cpu++) {
+#ifdef __linux__
+      if (cpu >= CPU_SETSIZE) {
+        return -1;
+      }
+      if (mask != NULL) {
+        CPU_SET((int) cpu, (cpu_set_t*) mask);
+      }
+#endif
+      count++;
+    }
+
+    /* step over separator */
+    if (*p == ',') {
+      p++;
+      if (*p == '\0') {
+        return -1;
+      }
+    } else if (*p != '\0') {
+      return -1;
+    }
+  }
+
+  return count;
+}
+
+int er_progress_check_cpus(const char* cpus)
+{
+  if (cpus == NULL || er_progress_parse_cpus(cpus, NULL) < 0) {
+    return ER_FAILURE;
+  }
+  return ER_SUCCESS;
+}
+
+/* binds progress thread to cpus listed in er_progress_cpus,
+ * an empty list leaves the thread to run wherever the OS puts it */
+static void er_progress_bind(void)
+{
+  if (er_progress_cpus == NULL || strcmp(er_progress_cpus, "") == 0) {
+    return;
+  }
+
+#ifdef __linux__
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  if (er_progress_parse_cpus(er_progress_cpus, &mask) <= 0) {
+    er_err("Invalid progress thread cpu list '%s' @ %s:%d",
+      er_progress_cpus, __FILE__, __LINE__);
+    return;
+  }
+
+  int rc = pthread_setaffinity_np(er_progress_thread, sizeof(mask), &mask);
+  if (rc != 0) {
+    er_warn("Failed to bind progress thread to cpus '%s': %s @ %s:%d",
+      er_progress_cpus, strerror(rc), __FILE__, __LINE__);
+  }
+#else
+  er_warn("Binding progress thread is not supported on this platform @ %s:%d",
+    __FILE__, __LINE__);
+#endif
+}
+
+/* body of progress thread, executes queued operations in order */
+static void* er_progress_main(void* arg)
+{
+  (void) arg;
+  pthread_mutex_lock(&er_progress_mutex);
+  while (1) {
+    /* wait for something to do */
+    while (er_progress_head == NULL && ! er_progress_stop) {
+      if (er_progress_spin) {
+        /* spin on the queue, cheapest when we own a dedicated core */
+        pthread_mutex_unlock(&er_progress_mutex);
+        sched_yield();
+        pthread_mutex_lock(&er_progress_mutex);
+      } else {
+        pthread_cond_wait(&er_progress_cond, &er_progress_mutex);
+      }
+    }
+
+    /* only exit after the queue has been drained */
+    if (er_progress_head == NULL) {
+      break;
+    }
+
+    /* dequeue next item */
+    er_progress_item* item = er_progress_head;
+    er_progress_head = item->next;
+    if (er_progress_head == NULL) {
+      er_progress_tail = NULL;
+    }
+
+    /* execute it without holding the lock */
+    pthread_mutex_unlock(&er_progress_mutex);
+    item->fn(item->arg);
+    er_free(&item);
+    pthread_mutex_lock(&er_progress_mutex);
+  }
+  pthread_mutex_unlock(&er_progress_mutex);
+
+  return NULL;
+}
+
+/* start the progress thread */
+static int er_progress_start(void)
+{
+  er_progress_stop = 0;
+  er_progress_spin = er_progress_poll;
+  if (pthread_create(&er_progress_thread, NULL, er_progress_main, NULL) != 0) {
+    er_err("Failed to start progress thread @ %s:%d",
+      __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+  er_progress_running = 1;
+
+  er_progress_bind();
+
+  return ER_SUCCESS;
+}
+
+/* drain queue and join the progress thread */
+static void er_progress_join(void)
+{
+  pthread_mutex_lock(&er_progress_mutex);
+  er_progress_stop = 1;
+  pthread_cond_signal(&er_progress_cond);
+  pthread_mutex_unlock(&er_progress_mutex);
+
+  pthread_join(er_progress_thread, NULL);
+  er_progress_running = 0;
+}
+
+int er_progress_init(void)
+{
+  er_progress_enabled = 1;
+  return er_progress_update();
+}
+
+int er_progress_finalize(void)
+{
+  if (er_progress_running) {
+    er_progress_join();
+  }
+  er_progress_enabled = 0;
+  return ER_SUCCESS;
+}
+
+int er_progress_update(void)
+{
+  /* nothing to do until MPI has been confirmed to support threads */
+  if (! er_progress_enabled) {
+    return ER_SUCCESS;
+  }
+
+  if (er_progress && ! er_progress_running) {
+    return er_progress_start();
+  }
+
+  if (! er_progress && er_progress_running) {
+    er_progress_join();
+    return ER_SUCCESS;
+  }
+
+  if (er_progress_running) {
+    /* pick up a changed cpu list, and wake the thread in case
+     * it should switch between polling and blocking */
+    er_progress_bind();
+    pthread_mutex_lock(&er_progress_mutex);
+    er_progress_spin = er_progress_poll;
+    pthread_cond_signal(&er_progress_cond);
+    pthread_mutex_unlock(&er_progress_mutex);
+  }
+
+  return ER_SUCCESS;
+}
+
+int er_progress_post(er_progress_fn fn, void* arg)
+{
+  if (! er_progress_running) {
+    return ER_FAILURE;
+  }
+
+  er_progress_item* item = (er_progress_item*) ER_MALLOC(sizeof(er_progress_item));
+  item->fn   = fn;
+  item->arg  = arg;
+  item->next = NULL;
+
+  pthread_mutex_lock(&er_progress_mutex);
+  if (er_progress_tail != NULL) {
+    er_progress_tail->next = item;
+  } else {
+    er_progress_head = item;
+  }
+  er_progress_tail = item;
+  pthread_cond_signal(&er_progress_cond);
+  pthread_mutex_unlock(&er_progress_mutex);
+
+  return ER_SUCCESS;
+}
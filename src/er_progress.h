@@ -0,0 +1,31 @@
+#ifndef ER_PROGRESS_H
+#define ER_PROGRESS_H
+
+/** \file er_progress.h
+ *  \ingroup er
+ *  \brief background progress engine that executes queued operations */
+
+/** function executed by the progress thread on behalf of a caller */
+typedef void (*er_progress_fn)(void* arg);
+
+/** enables the progress engine and starts its thread if
+ * er_progress is set, call once MPI_THREAD_MULTIPLE is confirmed */
+int er_progress_init(void);
+
+/** drains the queue, stops and joins the progress thread */
+int er_progress_finalize(void);
+
+/** applies changes in er_progress, er_progress_cpus, and
+ * er_progress_poll to the engine, starting or stopping the
+ * thread as needed */
+int er_progress_update(void);
+
+/** returns ER_SUCCESS if cpus is a valid cpu list like "0,4-7" */
+int er_progress_check_cpus(const char* cpus);
+
+/** queues fn(arg) for execution on the progress thread,
+ * items execute one at a time in the order they are posted,
+ * returns ER_FAILURE if the progress thread is not running */
+int er_progress_post(er_progress_fn fn, void* arg);
+
+#endif
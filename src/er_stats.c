@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "mpi.h"
+
+#include "kvtree.h"
+#include "kvtree_util.h"
+
+#include "er.h"
+#include "er_util.h"
+#include "er_stats.h"
+#include "er_trace.h"
+
+/* names of phases as they appear in the stats kvtree */
+static const char* er_phase_names[ER_PHASE_COUNT] = {
+  "STATE_READ",
+  "STATE_WRITE",
+  "WRITE",
+  "REUSE",
+  "APPLY",
+  "CREATE",
+  "MIGRATE",
+  "RECOVER",
+  "UNAPPLY",
+  "REMOVE",
+  "CHECKSUM",
+  "COMPRESS",
+  "DECOMPRESS",
+  "FLUSH",
+  "VERIFY",
+};
+
+void er_stats_clear(er_stats* stats)
+{
+  memset(stats, 0, sizeof(er_stats));
+}
+
+double er_stats_begin(void)
+{
+  /* a phase begun while stats are disabled is only traced, which
+   * end tells from the sign of its start time */
+  if (! er_collect_stats) {
+    return - ER_TRACE_BEGIN();
+  }
+  return MPI_Wtime();
+}
+
+void er_stats_end(er_stats* stats, er_phase phase, double start,
+  unsigned long bytes_read, unsigned long bytes_written,
+  unsigned long collectives)
+{
+  ER_TRACE_END(ER_TRACE_PHASE, er_phase_names[phase], (start < 0.0) ? - start : start,
+    (long) (bytes_read + bytes_written));
+
+  if (start <= 0.0 || stats == NULL) {
+    return;
+  }
+
+  stats->time[phase]          += MPI_Wtime() - start;
+  stats->bytes_read[phase]    += bytes_read;
+  stats->bytes_written[phase] += bytes_written;
+  stats->calls[phase]         += 1;
+  stats->collectives[phase]   += collectives;
+}
+
+unsigned long er_stats_bytes(int count, const char** files)
+{
+  if (! er_collect_stats) {
+    return 0;
+  }
+
+  unsigned long bytes = 0;
+  int i;
+  for (i = 0; i < count; i++) {
+    struct stat st;
+    if (stat(files[i], &st) == 0) {
+      bytes += (unsigned long) st.st_size;
+    }
+  }
+  return bytes;
+}
+
+/* number of values we record per phase */
+#define ER_STATS_FIELDS (5)
+
+static const char* er_stats_field_names[ER_STATS_FIELDS] = {
+  "TIME",
+  "BYTES_READ",
+  "BYTES_WRITTEN",
+  "CALLS",
+  "COLLECTIVES",
+};
+
+/* flatten stats into an array of doubles, phase-major */
+static void er_stats_pack(const er_stats* stats, double* vals)
+{
+  int i;
+  for (i = 0; i < ER_PHASE_COUNT; i++) {
+    double* v = &vals[i * ER_STATS_FIELDS];
+    v[0] = stats->time[i];
+    v[1] = (double) stats->bytes_read[i];
+    v[2] = (double) stats->bytes_written[i];
+    v[3] = (double) stats->calls[i];
+    v[4] = (double) stats->collectives[i];
+  }
+}
+
+/* record flattened values under PHASE/<name>/<field> in hash */
+static void er_stats_set(kvtree* hash, const double* vals)
+{
+  int i, j;
+  for (i = 0; i < ER_PHASE_COUNT; i++) {
+    kvtree* phase = kvtree_set_kv(hash, "PHASE", er_phase_names[i]);
+    for (j = 0; j < ER_STATS_FIELDS; j++) {
+      kvtree_util_set_double(phase, er_stats_field_names[j], vals[i * ER_STATS_FIELDS + j]);
+    }
+  }
+}
+
+kvtree* er_stats_kvtree(const er_stats* stats, MPI_Comm comm)
+{
+  int n = ER_PHASE_COUNT * ER_STATS_FIELDS;
+  double* vals = (double*) ER_MALLOC(n * sizeof(double));
+  er_stats_pack(stats, vals);
+
+  /* values of the calling proc */
+  kvtree* hash = kvtree_new();
+  er_stats_set(hash, vals);
+
+  if (comm != MPI_COMM_NULL) {
+    int ranks;
+    MPI_Comm_size(comm, &ranks);
+
+    double* mins = (double*) ER_MALLOC(n * sizeof(double));
+    double* maxs = (double*) ER_MALLOC(n * sizeof(double));
+    double* sums = (double*) ER_MALLOC(n * sizeof(double));
+    double trace_start = ER_TRACE_BEGIN();
+    MPI_Allreduce(vals, mins, n, MPI_DOUBLE, MPI_MIN, comm);
+    MPI_Allreduce(vals, maxs, n, MPI_DOUBLE, MPI_MAX, comm);
+    MPI_Allreduce(vals, sums, n, MPI_DOUBLE, MPI_SUM, comm);
+    ER_TRACE_END(ER_TRACE_COLL, "er_stats_kvtree", trace_start, n);
+
+    int i;
+    for (i = 0; i < n; i++) {
+      sums[i] /= (double) ranks;
+    }
+
+    er_stats_set(kvtree_set(hash, "MIN", kvtree_new()), mins);
+    er_stats_set(kvtree_set(hash, "MAX", kvtree_new()), maxs);
+    er_stats_set(kvtree_set(hash, "AVG", kvtree_new()), sums);
+
+    er_free(&sums);
+    er_free(&maxs);
+    er_free(&mins);
+  }
+
+  er_free(&vals);
+
+  return hash;
+}
@@ -0,0 +1,63 @@
+#ifndef ER_STATS_H
+#define ER_STATS_H
+
+#include "mpi.h"
+#include "kvtree.h"
+
+/** \file er_stats.h
+ *  \ingroup er
+ *  \brief per-phase timing and byte counts of dispatched operations */
+
+/** phases of encode, rebuild, and remove that we keep stats for */
+typedef enum {
+  ER_PHASE_STATE_READ = 0,
+  ER_PHASE_STATE_WRITE,
+  ER_PHASE_WRITE,
+  ER_PHASE_REUSE,
+  ER_PHASE_APPLY,
+  ER_PHASE_CREATE,
+  ER_PHASE_MIGRATE,
+  ER_PHASE_RECOVER,
+  ER_PHASE_UNAPPLY,
+  ER_PHASE_REMOVE,
+  ER_PHASE_CHECKSUM,
+  ER_PHASE_COMPRESS,
+  ER_PHASE_DECOMPRESS,
+  ER_PHASE_FLUSH,
+  ER_PHASE_VERIFY,
+  ER_PHASE_COUNT
+} er_phase;
+
+/** accumulated stats of one set, fields are indexed by phase */
+typedef struct {
+  double time[ER_PHASE_COUNT];                /* wall time in seconds */
+  unsigned long bytes_read[ER_PHASE_COUNT];    /* bytes of files read */
+  unsigned long bytes_written[ER_PHASE_COUNT]; /* bytes of files written */
+  unsigned long calls[ER_PHASE_COUNT];         /* number of times phase ran */
+  unsigned long collectives[ER_PHASE_COUNT];   /* collective operations issued */
+} er_stats;
+
+/** zero all counters */
+void er_stats_clear(er_stats* stats);
+
+/** returns start time of a phase, negated if stats are disabled,
+ * or 0.0 if stats and tracing are disabled */
+double er_stats_begin(void);
+
+/** adds time since start of a phase and the given byte and collective
+ * counts to stats, does nothing if stats is NULL or stats were disabled
+ * when start was taken, records the phase as a trace event if tracing
+ * is on */
+void er_stats_end(er_stats* stats, er_phase phase, double start,
+  unsigned long bytes_read, unsigned long bytes_written,
+  unsigned long collectives);
+
+/** returns sum of sizes of count files, or 0 if stats are disabled */
+unsigned long er_stats_bytes(int count, const char** files);
+
+/** returns stats as a new kvtree, if comm is not MPI_COMM_NULL, also
+ * adds the min, max, and average over the procs in comm,
+ * which is collective over comm */
+kvtree* er_stats_kvtree(const er_stats* stats, MPI_Comm comm);
+
+#endif
@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mpi.h"
+
+#include "er.h"
+#include "er_util.h"
+#include "er_trace.h"
+
+#ifdef ER_TRACE
+
+/* number of events we hold, the oldest are overwritten once it
+ * fills up, must be a power of two */
+#define ER_TRACE_EVENTS (1 << 16)
+
+/* one recorded event */
+typedef struct {
+  unsigned long seq; /* index of the event plus one once it is complete, 0 while it is written */
+  double start;      /* MPI_Wtime when the event started */
+  double end;        /* MPI_Wtime when it ended, start for a mark */
+  const char* name;  /* string constant naming the event */
+  long arg;          /* set id or value the event is about */
+  int kind;          /* er_trace_kind */
+  int tid;           /* thread that recorded the event */
+  int mark;          /* whether the event takes no time */
+} er_trace_event;
+
+/* events are claimed with an atomic increment of the next index, so
+ * threads never wait for each other, a slot is published by storing
+ * its sequence number after the event was filled in */
+static er_trace_event er_trace_ring[ER_TRACE_EVENTS];
+static unsigned long er_trace_next = 0;
+
+/* threads are numbered in the order they record their first event */
+static int er_trace_threads = 0;
+static __thread int er_trace_tid = -1;
+
+static const char* er_trace_kind_names[ER_TRACE_KINDS] = {
+  "PHASE",
+  "COLL",
+  "STATE",
+};
+
+static void er_trace_record(er_trace_kind kind, const char* name,
+  double start, double end, long arg, int mark)
+{
+  if (er_trace_tid < 0) {
+    er_trace_tid = __atomic_fetch_add(&er_trace_threads, 1, __ATOMIC_RELAXED);
+  }
+
+  unsigned long idx = __atomic_fetch_add(&er_trace_next, 1, __ATOMIC_RELAXED);
+  er_trace_event* e = &er_trace_ring[idx & (ER_TRACE_EVENTS - 1)];
+
+  __atomic_store_n(&e->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  e->start = start;
+  e->end   = end;
+  e->name  = name;
+  e->arg   = arg;
+  e->kind  = (int) kind;
+  e->tid   = er_trace_tid;
+  e->mark  = mark;
+  __atomic_store_n(&e->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+double er_trace_begin(void)
+{
+  if (er_trace_file == NULL) {
+    return 0.0;
+  }
+  return MPI_Wtime();
+}
+
+void er_trace_end(er_trace_kind kind, const char* name, double start, long arg)
+{
+  /* skip events that began before tracing was turned on */
+  if (er_trace_file == NULL || start == 0.0) {
+    return;
+  }
+  er_trace_record(kind, name, start, MPI_Wtime(), arg, 0);
+}
+
+void er_trace_mark(er_trace_kind kind, const char* name, long arg)
+{
+  if (er_trace_file == NULL) {
+    return;
+  }
+  double now = MPI_Wtime();
+  er_trace_record(kind, name, now, now, arg, 1);
+}
+
+int er_trace_write(void)
+{
+  unsigned long next = __atomic_load_n(&er_trace_next, __ATOMIC_ACQUIRE);
+  if (er_trace_file == NULL || next == 0) {
+    return ER_SUCCESS;
+  }
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  char file[ER_MAX_FILENAME];
+  snprintf(file, sizeof(file), "%s.%d.json", er_trace_file, rank);
+
+  FILE* fp = fopen(file, "w");
+  if (fp == NULL) {
+    er_err("Failed to open trace file %s @ %s:%d",
+      file, __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* the ring holds the newest events */
+  unsigned long first = 0;
+  if (next > ER_TRACE_EVENTS) {
+    first = next - ER_TRACE_EVENTS;
+  }
+
+  /* one process per rank, so traces of all ranks can be loaded together,
+   * timestamps are MPI_Wtime in microseconds */
+  fprintf(fp, "{\"traceEvents\":[\n");
+  fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,"
+    "\"args\":{\"name\":\"rank %d on %s\"}}",
+    rank, rank, (er_hostname != NULL) ? er_hostname : "");
+
+  unsigned long idx;
+  for (idx = first; idx < next; idx++) {
+    const er_trace_event* e = &er_trace_ring[idx & (ER_TRACE_EVENTS - 1)];
+
+    /* skip a slot whose writer did not finish */
+    if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != idx + 1) {
+      continue;
+    }
+
+    fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,",
+      e->name, er_trace_kind_names[e->kind], rank, e->tid, e->start * 1.0e6);
+    if (e->mark) {
+      fprintf(fp, "\"ph\":\"i\",\"s\":\"t\",");
+    } else {
+      fprintf(fp, "\"ph\":\"X\",\"dur\":%.3f,", (e->end - e->start) * 1.0e6);
+    }
+    fprintf(fp, "\"args\":{\"arg\":%ld}}", e->arg);
+  }
+
+  fprintf(fp, "\n],\n\"displayTimeUnit\":\"ms\",\n"
+    "\"otherData\":{\"version\":\"%s\",\"dropped\":%lu}}\n",
+    ER_VERSION, first);
+
+  int rc = ER_SUCCESS;
+  if (fclose(fp) != 0) {
+    er_err("Failed to write trace file %s @ %s:%d",
+      file, __FILE__, __LINE__);
+    rc = ER_FAILURE;
+  }
+
+  /* start over in case ER is initialized again */
+  __atomic_store_n(&er_trace_next, 0, __ATOMIC_RELEASE);
+
+  return rc;
+}
+
+#endif
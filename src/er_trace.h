@@ -0,0 +1,54 @@
+#ifndef ER_TRACE_H
+#define ER_TRACE_H
+
+#include "config.h"
+
+/** \file er_trace.h
+ *  \ingroup er
+ *  \brief optional trace points written as a Chrome trace
+ *
+ * Trace points are only compiled in if ER is configured with
+ * -DER_TRACE=ON, otherwise the macros below expand to nothing.
+ * Events are recorded while TRACE_FILE is set. */
+
+/** kinds of events, they appear as categories in the trace */
+typedef enum {
+  ER_TRACE_PHASE = 0, /* phase of an operation, as counted in er_stats */
+  ER_TRACE_COLL,      /* collective issued by ER itself */
+  ER_TRACE_STATE,     /* change of the state of a set */
+  ER_TRACE_KINDS
+} er_trace_kind;
+
+#ifdef ER_TRACE
+
+/** returns start time of an event, or 0.0 if tracing is off */
+double er_trace_begin(void);
+
+/** records an event of kind that started at start and ends now, name
+ * must be a string constant since only its address is kept, arg
+ * identifies the set or value the event is about, safe to call from
+ * any thread, does nothing if tracing is off */
+void er_trace_end(er_trace_kind kind, const char* name, double start, long arg);
+
+/** records an event of kind that takes no time */
+void er_trace_mark(er_trace_kind kind, const char* name, long arg);
+
+/** writes the events still held to <TRACE_FILE>.<rank>.json,
+ * called from ER_Finalize after operations have stopped */
+int er_trace_write(void);
+
+#define ER_TRACE_BEGIN() er_trace_begin()
+#define ER_TRACE_END(kind, name, start, arg) er_trace_end(kind, name, start, arg)
+#define ER_TRACE_MARK(kind, name, arg) er_trace_mark(kind, name, arg)
+#define ER_TRACE_WRITE() er_trace_write()
+
+#else
+
+#define ER_TRACE_BEGIN() (0.0)
+#define ER_TRACE_END(kind, name, start, arg) ((void) (start))
+#define ER_TRACE_MARK(kind, name, arg) ((void) 0)
+#define ER_TRACE_WRITE() (ER_SUCCESS)
+
+#endif
+
+#endif
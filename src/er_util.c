@@ -1,3 +1,6 @@
+/* for statx */
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -11,15 +14,31 @@
 #include <unistd.h>
 
 #include <limits.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/vfs.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
 
 #include "mpi.h"
 #include "kvtree.h"
 
 #include "er.h"
 #include "er_util.h"
+#include "er_pool.h"
+#include "er_io.h"
+#include "er_comm.h"
+#include "er_trace.h"
 
 int er_debug = 1;
 
@@ -29,8 +48,36 @@ char* er_hostname = NULL;
 int er_mpi_buf_size = 1024 * 1024;
 size_t er_page_size;
 
+int er_buf_hugepage = 0;
+
 int er_set_size = 8;
 
+int er_crc_on_copy = 0;
+
+int er_collect_stats = 0;
+
+int er_pipeline_rebuild = 0;
+
+int er_io_threads = 0;
+
+int er_compress = 0;
+int er_delta = 0;
+
+int er_mmap = 0;
+
+char* er_flush_dir = NULL;
+
+char* er_trace_file = NULL;
+
+unsigned long er_max_bw = 0;
+int er_max_chunks = 0;
+
+unsigned long er_verify_bw = 0;
+
+int er_progress = 1;
+char* er_progress_cpus = NULL;
+int er_progress_poll = 0;
+
 
 /* print error message to stdout */
 void er_err(const char *fmt, ...)
@@ -54,17 +101,51 @@ void er_warn(const char *fmt, ...)
   fprintf(stdout, "\n");
 }
 
-/* print message to stdout if er_debug is set and it is >= level */
-void er_dbg(int level, const char *fmt, ...)
+/* print message to stdout, er_dbg has checked its level already,
+ * the line is formatted first and written with a single call, so
+ * lines of the progress and application threads do not interleave */
+void er_dbg_print(const char *fmt, ...)
 {
   va_list argp;
-  if (level == 0 || (er_debug > 0 && er_debug >= level)) {
-    fprintf(stdout, "ER %s: rank %d on %s: ", ER_VERSION, er_rank, er_hostname);
+  char line[1024];
+  int len = snprintf(line, sizeof(line), "ER %s: rank %d on %s: ", ER_VERSION, er_rank, er_hostname);
+  int msg = -1;
+  if (len >= 0 && len < (int) sizeof(line)) {
     va_start(argp, fmt);
-    vfprintf(stdout, fmt, argp);
+    msg = vsnprintf(line + len, sizeof(line) - len, fmt, argp);
     va_end(argp);
-    fprintf(stdout, "\n");
+    if (msg >= 0 && msg < (int) sizeof(line) - len) {
+      fprintf(stdout, "%s\n", line);
+      return;
+    }
+  }
+
+  /* longer lines are formatted on the heap instead */
+  if (len >= 0 && msg < 0) {
+    va_start(argp, fmt);
+    msg = vsnprintf(NULL, 0, fmt, argp);
+    va_end(argp);
+  }
+  if (len >= 0 && msg >= 0) {
+    size_t size = (size_t) len + (size_t) msg + 1;
+    char* buf = (char*) malloc(size);
+    if (buf != NULL) {
+      snprintf(buf, size, "ER %s: rank %d on %s: ", ER_VERSION, er_rank, er_hostname);
+      va_start(argp, fmt);
+      vsnprintf(buf + len, size - len, fmt, argp);
+      va_end(argp);
+      fprintf(stdout, "%s\n", buf);
+      free(buf);
+      return;
+    }
   }
+
+  /* out of memory, write the line in pieces */
+  fprintf(stdout, "ER %s: rank %d on %s: ", ER_VERSION, er_rank, er_hostname);
+  va_start(argp, fmt);
+  vfprintf(stdout, fmt, argp);
+  va_end(argp);
+  fprintf(stdout, "\n");
 }
 
 /* print abort message and call MPI_Abort to kill run */
@@ -94,6 +175,15 @@ void* er_malloc(size_t size, const char* file, int line)
   return ptr;
 }
 
+void* er_realloc(void* ptr, size_t size, const char* file, int line)
+{
+  void* newptr = realloc(ptr, size);
+  if (newptr == NULL && size > 0) {
+    er_abort(-1, "Failed to reallocate %lu bytes @ %s:%d", (unsigned long) size, file, line);
+  }
+  return newptr;
+}
+
 /* caller really passes in a void**, but we define it as just void* to avoid printing
  * a bunch of warnings */
 void er_free(void* p)
@@ -119,51 +209,12 @@ void* er_align_malloc(size_t size, size_t align)
     return NULL;
   }
   return buf;
-
-#if 0
-  /* allocate size + one block + room to store our starting address */
-  size_t bytes = size + align + sizeof(void*);
-
-  /* allocate memory */
-  void* start = ER_MALLOC(bytes);
-  if (start == NULL) {
-    return NULL;
-  }
-
-  /* make room to store our starting address */
-  void* buf = start + sizeof(void*);
-
-  /* TODO: Compilers don't like modulo division on pointers */
-  /* now align the buffer address to a block boundary */
-  unsigned long long mask = (unsigned long long) (align - 1);
-  unsigned long long addr = (unsigned long long) buf;
-  unsigned long long offset = addr & mask;
-  if (offset != 0) {
-    buf = buf + (align - offset);
-  }
-
-  /* store the starting address in the bytes immediately before the buffer */
-  void** tmp = buf - sizeof(void*);
-  *tmp = start;
-
-  /* finally, return the buffer address to the user */
-  return buf;
-#endif
 }
 
 /* frees a blocked allocated with a call to er_align_malloc */
 void er_align_free(void* p)
 {
   er_free(p);
-
-#if 0
-  /* first lookup the starting address from the bytes immediately before the buffer */
-  void** tmp = buf - sizeof(void*);
-  void* start = *tmp;
-
-  /* now free the memory */
-  free(start);
-#endif
 }
 
 /* sends a NUL-terminated string to a process,
@@ -212,6 +263,459 @@ int er_str_sendrecv(
 int er_alltrue(int flag, MPI_Comm comm)
 {
   int all_true;
-  MPI_Allreduce(&flag, &all_true, 1, MPI_INT, MPI_LAND, comm);
+  double trace_start = ER_TRACE_BEGIN();
+  if (er_comm_alltrue(flag, comm, &all_true) != ER_SUCCESS) {
+    MPI_Allreduce(&flag, &all_true, 1, MPI_INT, MPI_LAND, comm);
+  }
+  ER_TRACE_END(ER_TRACE_COLL, "er_alltrue", trace_start, flag);
   return all_true;
 }
+
+/* CRC32C (Castagnoli) polynomial, reflected */
+#define ER_CRC32C_POLY (0x82f63b78)
+
+/* lookup tables for software CRC32C, slicing 8 bytes at a time */
+static uint32_t er_crc32c_table[8][256];
+static pthread_once_t er_crc32c_once = PTHREAD_ONCE_INIT;
+
+static void er_crc32c_init(void)
+{
+  uint32_t i;
+  for (i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    int j;
+    for (j = 0; j < 8; j++) {
+      crc = (crc & 1) ? (crc >> 1) ^ ER_CRC32C_POLY : (crc >> 1);
+    }
+    er_crc32c_table[0][i] = crc;
+  }
+  for (i = 0; i < 256; i++) {
+    uint32_t crc = er_crc32c_table[0][i];
+    int k;
+    for (k = 1; k < 8; k++) {
+      crc = er_crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+      er_crc32c_table[k][i] = crc;
+    }
+  }
+}
+
+/* portable CRC32C, operates on the pre-inverted crc value */
+static uint32_t er_crc32c_sw(uint32_t crc, const unsigned char* p, size_t len)
+{
+  pthread_once(&er_crc32c_once, er_crc32c_init);
+
+  while (len >= 8) {
+    uint32_t lo = crc ^ ((uint32_t) p[0] | (uint32_t) p[1] << 8 |
+                         (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+    uint32_t hi = (uint32_t) p[4] | (uint32_t) p[5] << 8 |
+                  (uint32_t) p[6] << 16 | (uint32_t) p[7] << 24;
+    crc = er_crc32c_table[7][lo & 0xff] ^
+          er_crc32c_table[6][(lo >> 8) & 0xff] ^
+          er_crc32c_table[5][(lo >> 16) & 0xff] ^
+          er_crc32c_table[4][lo >> 24] ^
+          er_crc32c_table[3][hi & 0xff] ^
+          er_crc32c_table[2][(hi >> 8) & 0xff] ^
+          er_crc32c_table[1][(hi >> 16) & 0xff] ^
+          er_crc32c_table[0][hi >> 24];
+    p   += 8;
+    len -= 8;
+  }
+  while (len > 0) {
+    crc = er_crc32c_table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+    p++;
+    len--;
+  }
+  return crc;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+/* CRC32C using the SSE4.2 crc32 instruction */
+__attribute__((target("sse4.2")))
+static uint32_t er_crc32c_hw(uint32_t crc, const unsigned char* p, size_t len)
+{
+  uint64_t crc64 = crc;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    crc64 = __builtin_ia32_crc32di(crc64, word);
+    p   += 8;
+    len -= 8;
+  }
+  crc = (uint32_t) crc64;
+  while (len > 0) {
+    crc = __builtin_ia32_crc32qi(crc, *p);
+    p++;
+    len--;
+  }
+  return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+/* CRC32C using the ARMv8 crc32c instructions */
+static uint32_t er_crc32c_hw(uint32_t crc, const unsigned char* p, size_t len)
+{
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    crc = __crc32cd(crc, word);
+    p   += 8;
+    len -= 8;
+  }
+  while (len > 0) {
+    crc = __crc32cb(crc, *p);
+    p++;
+    len--;
+  }
+  return crc;
+}
+#endif
+
+uint32_t er_crc32c(uint32_t crc, const void* buf, size_t len)
+{
+  const unsigned char* p = (const unsigned char*) buf;
+  crc = ~crc;
+#if defined(__GNUC__) && defined(__x86_64__)
+  if (__builtin_cpu_supports("sse4.2")) {
+    crc = er_crc32c_hw(crc, p, len);
+  } else {
+    crc = er_crc32c_sw(crc, p, len);
+  }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+  crc = er_crc32c_hw(crc, p, len);
+#else
+  crc = er_crc32c_sw(crc, p, len);
+#endif
+  return ~crc;
+}
+
+double er_wtime(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec * 1.0e-9;
+}
+
+void er_throttle_init(er_throttle* t, unsigned long rate)
+{
+  pthread_mutex_init(&t->mutex, NULL);
+  t->rate  = (double) rate;
+  t->start = 0.0;
+  t->bytes = 0.0;
+}
+
+void er_throttle_free(er_throttle* t)
+{
+  pthread_mutex_destroy(&t->mutex);
+}
+
+void er_throttle_charge(er_throttle* t, unsigned long bytes)
+{
+  if (t->rate <= 0.0) {
+    return;
+  }
+
+  /* the bytes may not be done before all bytes charged so far
+   * could have been read at the given rate */
+  pthread_mutex_lock(&t->mutex);
+  double now = er_wtime();
+  if (t->bytes == 0.0) {
+    t->start = now;
+  }
+  t->bytes += (double) bytes;
+  double due = t->start + t->bytes / t->rate;
+  pthread_mutex_unlock(&t->mutex);
+
+  if (due > now) {
+    usleep((useconds_t) ((due - now) * 1000000.0));
+  }
+}
+
+/* f_type of tmpfs in statfs, from linux/magic.h */
+#define ER_TMPFS_MAGIC (0x01021994)
+
+const void* er_mmap_file(int fd, size_t size)
+{
+  if (! er_mmap || size == 0) {
+    return NULL;
+  }
+
+  /* only memory-backed files are worth mapping, elsewhere page faults
+   * would read the file in small pieces */
+  int in_memory = 0;
+  struct statfs sfs;
+  if (fstatfs(fd, &sfs) == 0 && (unsigned long) sfs.f_type == ER_TMPFS_MAGIC) {
+    in_memory = 1;
+  }
+#ifdef STATX_ATTR_DAX
+  struct statx stx;
+  if (! in_memory && statx(fd, "", AT_EMPTY_PATH, STATX_BASIC_STATS, &stx) == 0 &&
+      (stx.stx_attributes & STATX_ATTR_DAX))
+  {
+    in_memory = 1;
+  }
+#endif
+  if (! in_memory) {
+    return NULL;
+  }
+
+  void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    er_dbg(2, "Failed to map %lu bytes, reading file instead: %s",
+      (unsigned long) size, strerror(errno));
+    return NULL;
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+  return map;
+}
+
+void er_munmap_file(const void* map, size_t size)
+{
+  if (map != NULL) {
+    munmap((void*) map, size);
+  }
+}
+
+/* size of the file open at fd, 0 if it can't be determined */
+static size_t er_fd_size(int fd)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 0) {
+    return 0;
+  }
+  return (size_t) st.st_size;
+}
+
+int er_crc32c_file(const char* file, uint32_t* crc, unsigned long* size, er_throttle* throttle)
+{
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    return ER_FAILURE;
+  }
+
+  /* read file in chunks using one of our transfer buffers */
+  er_poolbuf pb;
+  if (er_pool_get(&pb) != ER_SUCCESS) {
+    close(fd);
+    return ER_FAILURE;
+  }
+  void* buf = pb.buf;
+  size_t bufsize = pb.size;
+
+  int rc = ER_SUCCESS;
+  uint32_t c = 0;
+  unsigned long total = 0;
+  while (1) {
+    ssize_t n = read(fd, buf, bufsize);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      er_err("Failed to read file %s: %s @ %s:%d",
+        file, strerror(errno), __FILE__, __LINE__);
+      rc = ER_FAILURE;
+      break;
+    }
+    if (n == 0) {
+      break;
+    }
+    c = er_crc32c(c, buf, (size_t) n);
+    total += (unsigned long) n;
+
+    if (throttle != NULL) {
+      er_throttle_charge(throttle, (unsigned long) n);
+    }
+    er_io_charge((unsigned long) n);
+  }
+
+  er_pool_put(&pb);
+  close(fd);
+
+  *crc  = c;
+  *size = total;
+  return rc;
+}
+
+int er_write_buffer(const char* file, const void* buf, size_t size, uint32_t* crc)
+{
+  int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    er_err("Failed to open file %s: %s @ %s:%d",
+      file, strerror(errno), __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  /* write in chunks the size of our transfer buffers, checksumming
+   * each chunk right before writing it while it is still in cache */
+  size_t chunk = (er_mpi_buf_size > 0) ? (size_t) er_mpi_buf_size : 1024 * 1024;
+
+  int rc = ER_SUCCESS;
+  uint32_t c = 0;
+  const char* p = (const char*) buf;
+  size_t left = size;
+  while (left > 0) {
+    size_t n = (left < chunk) ? left : chunk;
+    if (crc != NULL) {
+      c = er_crc32c(c, p, n);
+    }
+
+    size_t written = 0;
+    while (written < n) {
+      ssize_t w = write(fd, p + written, n - written);
+      if (w < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        er_err("Failed to write file %s: %s @ %s:%d",
+          file, strerror(errno), __FILE__, __LINE__);
+        rc = ER_FAILURE;
+        break;
+      }
+      written += (size_t) w;
+    }
+    if (rc != ER_SUCCESS) {
+      break;
+    }
+
+    er_io_charge((unsigned long) n);
+
+    p    += n;
+    left -= n;
+  }
+
+  if (close(fd) != 0) {
+    er_err("Failed to close file %s: %s @ %s:%d",
+      file, strerror(errno), __FILE__, __LINE__);
+    rc = ER_FAILURE;
+  }
+
+  if (crc != NULL) {
+    *crc = c;
+  }
+  return rc;
+}
+
+/* copy the file open at fd_src named src to the file open at fd_dst
+ * named tmp in chunks, using one of our transfer buffers, or straight
+ * from its pages if it lives in memory, sets total to the number of
+ * bytes copied */
+static int er_copy_fd(int fd_src, int fd_dst, const char* src, const char* tmp, unsigned long* total)
+{
+  *total = 0;
+
+  size_t mapsize = er_fd_size(fd_src);
+  const char* map = (const char*) er_mmap_file(fd_src, mapsize);
+  er_poolbuf pb;
+  if (map == NULL && er_pool_get(&pb) != ER_SUCCESS) {
+    return ER_FAILURE;
+  }
+
+  int rc = ER_SUCCESS;
+  while (rc == ER_SUCCESS) {
+    const char* buf;
+    ssize_t n;
+    if (map != NULL) {
+      size_t chunk = (er_mpi_buf_size > 0) ? (size_t) er_mpi_buf_size : 1024 * 1024;
+      size_t left = mapsize - (size_t) *total;
+      buf = map + *total;
+      n = (ssize_t) ((left < chunk) ? left : chunk);
+    } else {
+      buf = (const char*) pb.buf;
+      n = read(fd_src, pb.buf, pb.size);
+    }
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      er_err("Failed to read file %s: %s @ %s:%d",
+        src, strerror(errno), __FILE__, __LINE__);
+      rc = ER_FAILURE;
+      break;
+    }
+    if (n == 0) {
+      break;
+    }
+
+    ssize_t written = 0;
+    while (written < n) {
+      ssize_t w = write(fd_dst, buf + written, (size_t) (n - written));
+      if (w < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        er_err("Failed to write file %s: %s @ %s:%d",
+          tmp, strerror(errno), __FILE__, __LINE__);
+        rc = ER_FAILURE;
+        break;
+      }
+      written += w;
+    }
+    *total += (unsigned long) n;
+    er_io_charge((unsigned long) n);
+  }
+
+  if (map != NULL) {
+    er_munmap_file(map, mapsize);
+  } else {
+    er_pool_put(&pb);
+  }
+  return rc;
+}
+
+int er_copy_file(const char* src, const char* dst, unsigned long* size)
+{
+  int fd_src = open(src, O_RDONLY);
+  if (fd_src < 0) {
+    er_err("Failed to open file %s: %s @ %s:%d",
+      src, strerror(errno), __FILE__, __LINE__);
+    return ER_FAILURE;
+  }
+
+  char tmp[ER_MAX_FILENAME];
+  snprintf(tmp, sizeof(tmp), "%s.part", dst);
+  int fd_dst = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd_dst < 0) {
+    er_err("Failed to open file %s: %s @ %s:%d",
+      tmp, strerror(errno), __FILE__, __LINE__);
+    close(fd_src);
+    return ER_FAILURE;
+  }
+
+  /* file systems that share extents between files copy for free,
+   * the copy gets its own extents once either file is rewritten */
+  int rc;
+  unsigned long total = 0;
+  int cloned = 0;
+#ifdef FICLONE
+  cloned = (ioctl(fd_dst, FICLONE, fd_src) == 0);
+#endif
+  if (cloned) {
+    total = (unsigned long) er_fd_size(fd_src);
+    rc = ER_SUCCESS;
+  } else {
+    rc = er_copy_fd(fd_src, fd_dst, src, tmp, &total);
+  }
+  close(fd_src);
+
+  /* the copy only counts once it has reached the slower tier */
+  if (rc == ER_SUCCESS && fsync(fd_dst) != 0) {
+    er_err("Failed to sync file %s: %s @ %s:%d",
+      tmp, strerror(errno), __FILE__, __LINE__);
+    rc = ER_FAILURE;
+  }
+  if (close(fd_dst) != 0) {
+    er_err("Failed to close file %s: %s @ %s:%d",
+      tmp, strerror(errno), __FILE__, __LINE__);
+    rc = ER_FAILURE;
+  }
+
+  if (rc == ER_SUCCESS && rename(tmp, dst) != 0) {
+    er_err("Failed to rename file %s to %s: %s @ %s:%d",
+      tmp, dst, strerror(errno), __FILE__, __LINE__);
+    rc = ER_FAILURE;
+  }
+  if (rc != ER_SUCCESS) {
+    unlink(tmp);
+  }
+
+  *size = total;
+  return rc;
+}
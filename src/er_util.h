@@ -1,6 +1,9 @@
 #ifndef ER_UTIL_H
 #define ER_UTIL_H
 
+#include <stdint.h>
+#include <pthread.h>
+
 #include "mpi.h"
 #include "kvtree.h"
 
@@ -20,16 +23,51 @@ extern char* er_hostname;
 extern int er_mpi_buf_size;
 extern size_t er_page_size;
 
+extern int er_buf_hugepage;
+
 extern int er_set_size;
 
+extern int er_crc_on_copy;
+
+extern int er_collect_stats;
+
+extern int er_pipeline_rebuild;
+
+extern int er_io_threads;
+
+extern int er_compress;
+extern int er_delta;
+
+extern int er_mmap;
+
+extern char* er_flush_dir;
+
+extern char* er_trace_file;
+
+extern unsigned long er_max_bw;
+extern int er_max_chunks;
+
+extern unsigned long er_verify_bw;
+
+extern int er_progress;
+extern char* er_progress_cpus;
+extern int er_progress_poll;
+
 /** print error message to stdout */
 void er_err(const char *fmt, ...);
 
 /** print warning message to stdout */
 void er_warn(const char *fmt, ...);
 
-/** print message to stdout if er_debug is set and it is >= level */
-void er_dbg(int level, const char *fmt, ...);
+/** print message to stdout if er_debug is set and it is >= level,
+ * the level is tested before the arguments are evaluated */
+#define er_dbg(level, ...) \
+  do { \
+    if ((level) == 0 || (er_debug > 0 && er_debug >= (level))) { \
+      er_dbg_print(__VA_ARGS__); \
+    } \
+  } while (0)
+void er_dbg_print(const char *fmt, ...);
 
 /** print abort message and kill run */
 void er_abort(int rc, const char *fmt, ...);
@@ -39,6 +77,10 @@ void er_abort(int rc, const char *fmt, ...);
 #define ER_MALLOC(X) er_malloc(X, __FILE__, __LINE__);
 void* er_malloc(size_t size, const char* file, int line);
 
+/** resize ptr to size bytes, calls er_abort if allocation fails */
+#define ER_REALLOC(P, X) er_realloc(P, X, __FILE__, __LINE__);
+void* er_realloc(void* ptr, size_t size, const char* file, int line);
+
 /** pass address of pointer to be freed, frees memory if not NULL and sets pointer to NULL */
 void er_free(void* ptr);
 
@@ -60,4 +102,60 @@ int er_str_sendrecv(
 /** returns true (non-zero) if flag on each process in comm is true */
 int er_alltrue(int flag, MPI_Comm comm);
 
+/** update CRC32C (Castagnoli) checksum crc with len bytes from buf,
+ * start with crc = 0, uses the CPU's crc32 instruction if available */
+uint32_t er_crc32c(uint32_t crc, const void* buf, size_t len);
+
+/** limits the rate at which several threads read files */
+typedef struct {
+  pthread_mutex_t mutex;
+  double rate;  /* bytes per second, 0 for no limit */
+  double start; /* time the first bytes were charged */
+  double bytes; /* number of bytes charged so far */
+} er_throttle;
+
+/** returns seconds since an arbitrary point in the past, unlike
+ * MPI_Wtime this may be called on I/O threads, which must not call
+ * into MPI */
+double er_wtime(void);
+
+/** prepare throttle t to allow rate bytes per second, 0 for no limit */
+void er_throttle_init(er_throttle* t, unsigned long rate);
+
+/** free resources of throttle t */
+void er_throttle_free(er_throttle* t);
+
+/** charge bytes to throttle t, sleeps until the rate of all bytes
+ * charged so far is within its limit, safe to call from any thread */
+void er_throttle_charge(er_throttle* t, unsigned long bytes);
+
+/** map size bytes of the file open at fd for reading if MMAP is set
+ * and the file lives in memory, on tmpfs or a file system mounted for
+ * DAX, so that its pages can be used in place, returns NULL if the file
+ * should be read with read() instead, release with er_munmap_file,
+ * only map files ER owns, a map of a file someone else truncates while
+ * it is being read raises SIGBUS */
+const void* er_mmap_file(int fd, size_t size);
+
+/** release a map of size bytes returned by er_mmap_file */
+void er_munmap_file(const void* map, size_t size);
+
+/** compute CRC32C checksum and size of file, if throttle is not
+ * NULL, each chunk read is charged to it,
+ * returns ER_SUCCESS if the whole file could be read */
+int er_crc32c_file(const char* file, uint32_t* crc, unsigned long* size, er_throttle* throttle);
+
+/** write size bytes from buf to file, replacing its contents,
+ * if crc is not NULL, compute CRC32C of the data in the same pass,
+ * returns ER_SUCCESS if all bytes were written */
+int er_write_buffer(const char* file, const void* buf, size_t size, uint32_t* crc);
+
+/** copy file src to dst and sync dst to storage, dst is written under
+ * a temporary name and renamed when complete, so it never holds a
+ * partial copy and never shares an inode with src, where the file
+ * system supports it the copy shares extents with src until either is
+ * rewritten, sets size to the number of bytes copied,
+ * returns ER_SUCCESS if the whole file was copied */
+int er_copy_file(const char* src, const char* dst, unsigned long* size);
+
 #endif
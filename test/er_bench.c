@@ -0,0 +1,539 @@
+/* Benchmark encode, rebuild, and remove throughput of ER.
+ *
+ * Each rank writes a number of files of a given size, then the set is
+ * encoded, optionally damaged according to a failure pattern, rebuilt,
+ * and removed again.  Rank 0 prints one JSON object per operation and
+ * iteration on stdout, for example:
+ *
+ *   mpirun -np 64 ./er_bench --files 4 --size 256M --scheme rs --erasure 2
+ *
+ * Run with --help for the full list of options. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <limits.h>
+#include <unistd.h>
+
+#include "mpi.h"
+#include "rankstr_mpi.h"
+#include "kvtree.h"
+#include "kvtree_util.h"
+
+#include "er.h"
+
+#define ER_HOSTNAME (255)
+
+#define BENCH_FAILURE_NONE    (0) /* no files are lost */
+#define BENCH_FAILURE_NODE    (1) /* files of the failure domain of rank 0 are lost */
+#define BENCH_FAILURE_REVERSE (2) /* rank 0 loses its files and ranks are reversed */
+
+/* size of buffer used to write and verify files */
+#define BENCH_CHUNK (1024 * 1024)
+
+/* phases reported from ER_Get_Stats, in the order they are printed */
+static const char* phases[] = {
+  "STATE_READ",
+  "STATE_WRITE",
+  "WRITE",
+  "REUSE",
+  "APPLY",
+  "CREATE",
+  "MIGRATE",
+  "RECOVER",
+  "UNAPPLY",
+  "REMOVE",
+  "CHECKSUM",
+  NULL
+};
+
+typedef struct {
+  int files;              /* number of files per rank */
+  unsigned long size;     /* bytes per file */
+  const char* scheme;     /* single, xor, rs, or partner */
+  int erasure;            /* erasure blocks for rs, replicas for partner */
+  int set_size;           /* SET_SIZE passed to ER */
+  unsigned long buf_size; /* MPI_BUF_SIZE passed to ER, 0 for default */
+  int failure;            /* one of BENCH_FAILURE constants */
+  const char* domain;     /* host or rank */
+  const char* dir;        /* directory to write files to */
+  int iters;              /* number of times to repeat the cycle */
+  int verify;             /* whether to check file contents after rebuild */
+  int crc;                /* CRC_ON_COPY passed to ER */
+  int io_threads;         /* IO_THREADS passed to ER */
+} bench_opts;
+
+static const char* failure_names[] = { "none", "node", "reverse" };
+
+/* parse a byte count like 4096, 64K, 16M, or 2G */
+static int parse_bytes(const char* str, unsigned long* val)
+{
+  char* end;
+  errno = 0;
+  unsigned long v = strtoul(str, &end, 10);
+  if (errno != 0 || end == str) {
+    return 1;
+  }
+  switch (*end) {
+  case 'g': case 'G': v *= 1024;
+  /* fall through */
+  case 'm': case 'M': v *= 1024;
+  /* fall through */
+  case 'k': case 'K': v *= 1024;
+    end++;
+    break;
+  default:
+    break;
+  }
+  if (*end != '\0') {
+    return 1;
+  }
+  *val = v;
+  return 0;
+}
+
+static void print_usage(void)
+{
+  printf("Usage: er_bench [options]\n");
+  printf("  --files N       number of files per rank (default 1)\n");
+  printf("  --size BYTES    size of each file, accepts K/M/G suffix (default 1M)\n");
+  printf("  --scheme NAME   single, xor, rs, or partner (default xor)\n");
+  printf("  --erasure N     erasure blocks for rs, replicas for partner (default 2 for rs, 1 for partner)\n");
+  printf("  --set-size N    redundancy set size (default 8)\n");
+  printf("  --buf-size BYTES  MPI buffer size for file transfers (default: ER default)\n");
+  printf("  --failure NAME  none, node, or reverse (default none)\n");
+  printf("  --domain NAME   failure domain: host or rank (default host)\n");
+  printf("  --dir PATH      directory to write files to (default /dev/shm)\n");
+  printf("  --iters N       number of encode/rebuild/remove cycles (default 1)\n");
+  printf("  --verify        check contents of files after rebuild\n");
+  printf("  --crc           record and check checksums of files (CRC_ON_COPY)\n");
+  printf("  --io-threads N  threads per node for ER's own file I/O (default: ER default)\n");
+}
+
+static int parse_opts(int argc, char* argv[], bench_opts* opts)
+{
+  static struct option long_opts[] = {
+    {"files",    required_argument, NULL, 'f'},
+    {"size",     required_argument, NULL, 's'},
+    {"scheme",   required_argument, NULL, 'c'},
+    {"erasure",  required_argument, NULL, 'e'},
+    {"set-size", required_argument, NULL, 'n'},
+    {"buf-size", required_argument, NULL, 'b'},
+    {"failure",  required_argument, NULL, 'x'},
+    {"domain",   required_argument, NULL, 'd'},
+    {"dir",      required_argument, NULL, 'o'},
+    {"iters",    required_argument, NULL, 'i'},
+    {"verify",   no_argument,       NULL, 'v'},
+    {"crc",      no_argument,       NULL, 'k'},
+    {"io-threads", required_argument, NULL, 't'},
+    {"help",     no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
+
+  opts->files    = 1;
+  opts->size     = 1024 * 1024;
+  opts->scheme   = "xor";
+  opts->erasure  = 0;
+  opts->set_size = 8;
+  opts->buf_size = 0;
+  opts->failure  = BENCH_FAILURE_NONE;
+  opts->domain   = "host";
+  opts->dir      = "/dev/shm";
+  opts->iters    = 1;
+  opts->verify   = 0;
+  opts->crc      = 0;
+  opts->io_threads = 0;
+
+  int c;
+  while ((c = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+    switch (c) {
+    case 'f': opts->files = atoi(optarg); break;
+    case 'c': opts->scheme = optarg; break;
+    case 'e': opts->erasure = atoi(optarg); break;
+    case 'n': opts->set_size = atoi(optarg); break;
+    case 'd': opts->domain = optarg; break;
+    case 'o': opts->dir = optarg; break;
+    case 'i': opts->iters = atoi(optarg); break;
+    case 'v': opts->verify = 1; break;
+    case 'k': opts->crc = 1; break;
+    case 't': opts->io_threads = atoi(optarg); break;
+    case 's':
+      if (parse_bytes(optarg, &opts->size)) {
+        return 1;
+      }
+      break;
+    case 'b':
+      if (parse_bytes(optarg, &opts->buf_size)) {
+        return 1;
+      }
+      break;
+    case 'x': {
+      int i;
+      opts->failure = -1;
+      for (i = 0; i < 3; i++) {
+        if (strcmp(optarg, failure_names[i]) == 0) {
+          opts->failure = i;
+        }
+      }
+      if (opts->failure < 0) {
+        return 1;
+      }
+      break;
+    }
+    default:
+      return 1;
+    }
+  }
+
+  if (opts->files < 1 || opts->iters < 1 || opts->set_size < 1) {
+    return 1;
+  }
+  if (strcmp(opts->domain, "host") != 0 && strcmp(opts->domain, "rank") != 0) {
+    return 1;
+  }
+
+  return 0;
+}
+
+/* map scheme name onto data and erasure blocks as ER_Create_Scheme
+ * interprets them */
+static int scheme_blocks(const bench_opts* opts, int* data, int* erasure)
+{
+  if (strcmp(opts->scheme, "single") == 0) {
+    *data    = 1;
+    *erasure = 0;
+  } else if (strcmp(opts->scheme, "xor") == 0) {
+    *data    = opts->set_size - 1;
+    *erasure = 1;
+  } else if (strcmp(opts->scheme, "rs") == 0) {
+    /* need 1 < erasure < data */
+    int k = (opts->erasure > 0) ? opts->erasure : 2;
+    *data    = opts->set_size - k;
+    *erasure = k;
+    if (k < 2 || *data <= k) {
+      return 1;
+    }
+  } else if (strcmp(opts->scheme, "partner") == 0) {
+    /* erasure blocks must be a multiple of data blocks larger than 1 */
+    int replicas = (opts->erasure > 0) ? opts->erasure : 1;
+    *data    = 2;
+    *erasure = 2 * replicas;
+  } else {
+    return 1;
+  }
+  if (*data < 1) {
+    *data = 1;
+  }
+  return 0;
+}
+
+/* byte for given rank, file, and offset so that files can be verified */
+static unsigned char fill_byte(int rank, int file, unsigned long offset)
+{
+  return (unsigned char) ((rank * 31 + file * 7 + offset) & 0xff);
+}
+
+static int write_file(const char* path, int rank, int file, unsigned long size, unsigned char* buf)
+{
+  int fd = open(path, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+    printf("Error opening file %s: %d %s\n", path, errno, strerror(errno));
+    return 1;
+  }
+  unsigned long offset = 0;
+  while (offset < size) {
+    size_t n = (size - offset < BENCH_CHUNK) ? (size_t) (size - offset) : BENCH_CHUNK;
+    size_t i;
+    for (i = 0; i < n; i++) {
+      buf[i] = fill_byte(rank, file, offset + i);
+    }
+    if (write(fd, buf, n) != (ssize_t) n) {
+      printf("Error writing file %s: %d %s\n", path, errno, strerror(errno));
+      close(fd);
+      return 1;
+    }
+    offset += n;
+  }
+  close(fd);
+  return 0;
+}
+
+static int verify_file(const char* path, int rank, int file, unsigned long size, unsigned char* buf)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return 1;
+  }
+  int rc = 0;
+  unsigned long offset = 0;
+  while (rc == 0 && offset < size) {
+    size_t n = (size - offset < BENCH_CHUNK) ? (size_t) (size - offset) : BENCH_CHUNK;
+    if (read(fd, buf, n) != (ssize_t) n) {
+      rc = 1;
+      break;
+    }
+    size_t i;
+    for (i = 0; i < n; i++) {
+      if (buf[i] != fill_byte(rank, file, offset + i)) {
+        rc = 1;
+        break;
+      }
+    }
+    offset += n;
+  }
+  close(fd);
+  return rc;
+}
+
+/* run one operation on a set, returns ER_Wait result,
+ * sets seconds to the time of the slowest proc */
+static int run_op(MPI_Comm world, MPI_Comm store, const char* name, int direction, int scheme_id,
+  int numfiles, char** files, double* seconds, kvtree** stats)
+{
+  MPI_Barrier(world);
+  double start = MPI_Wtime();
+
+  int rc = ER_FAILURE;
+  int set_id = ER_Create(world, store, name, direction, scheme_id);
+  if (set_id != -1) {
+    int i;
+    for (i = 0; i < numfiles; i++) {
+      ER_Add(set_id, files[i]);
+    }
+    if (ER_Dispatch(set_id) == ER_SUCCESS) {
+      rc = ER_Wait(set_id);
+    } else {
+      ER_Wait(set_id);
+    }
+    *stats = ER_Get_Stats(set_id, 1);
+    ER_Free(set_id);
+  }
+
+  double elapsed = MPI_Wtime() - start;
+  MPI_Allreduce(&elapsed, seconds, 1, MPI_DOUBLE, MPI_MAX, world);
+
+  /* report failure if any proc failed */
+  int failed = (rc != ER_SUCCESS), any;
+  MPI_Allreduce(&failed, &any, 1, MPI_INT, MPI_MAX, world);
+  return any ? ER_FAILURE : ER_SUCCESS;
+}
+
+/* print one result line, called on rank 0 */
+static void report(const bench_opts* opts, const char* op, int iter, int ranks,
+  double bytes, double seconds, int rc, const kvtree* stats)
+{
+  double gbps = (seconds > 0.0) ? bytes / seconds / 1.0e9 : 0.0;
+  printf("{\"op\":\"%s\",\"iter\":%d,\"ranks\":%d,\"files\":%d,\"file_size\":%lu,"
+         "\"scheme\":\"%s\",\"set_size\":%d,\"buf_size\":%lu,\"failure\":\"%s\",\"domain\":\"%s\","
+         "\"rc\":%d,\"bytes\":%.0f,\"seconds\":%.6f,\"gbps\":%.6f,\"phases\":{",
+    op, iter, ranks, opts->files, opts->size,
+    opts->scheme, opts->set_size, opts->buf_size, failure_names[opts->failure], opts->domain,
+    rc, bytes, seconds, gbps);
+
+  /* max time across procs of each phase that ran */
+  int first = 1;
+  const char** phase;
+  kvtree* max = kvtree_get(stats, "MAX");
+  for (phase = phases; *phase != NULL; phase++) {
+    double calls = 0.0, time = 0.0;
+    kvtree* hash = kvtree_get_kv(max, "PHASE", *phase);
+    kvtree_util_get_double(hash, "CALLS", &calls);
+    kvtree_util_get_double(hash, "TIME", &time);
+    if (calls > 0.0) {
+      printf("%s\"%s\":%.6f", first ? "" : ",", *phase, time);
+      first = 0;
+    }
+  }
+  printf("}}\n");
+  fflush(stdout);
+}
+
+int main (int argc, char* argv[])
+{
+  int rc = 0;
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+
+  int rank, ranks;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+  bench_opts opts;
+  int data_blocks, erasure_blocks;
+  if (parse_opts(argc, argv, &opts) || scheme_blocks(&opts, &data_blocks, &erasure_blocks)) {
+    if (rank == 0) {
+      print_usage();
+    }
+    MPI_Finalize();
+    return 1;
+  }
+
+  char hostname[ER_HOSTNAME + 1];
+  gethostname(hostname, sizeof(hostname));
+
+  /* create communicator of all procs on the same host */
+  MPI_Comm comm_host;
+  rankstr_mpi_comm_split(MPI_COMM_WORLD, hostname, 0, 0, 1, &comm_host);
+
+  /* procs with the same failure domain are lost together */
+  char domain[ER_HOSTNAME + 1];
+  if (strcmp(opts.domain, "rank") == 0) {
+    snprintf(domain, sizeof(domain), "%d", rank);
+  } else {
+    snprintf(domain, sizeof(domain), "%s", hostname);
+  }
+
+  /* find out whether we share the failure domain of rank 0 */
+  char domain0[ER_HOSTNAME + 1];
+  strcpy(domain0, domain);
+  MPI_Bcast(domain0, sizeof(domain0), MPI_CHAR, 0, MPI_COMM_WORLD);
+  int same_domain = (strcmp(domain, domain0) == 0);
+
+  char** files = (char**) malloc(opts.files * sizeof(char*));
+  int i;
+  for (i = 0; i < opts.files; i++) {
+    files[i] = (char*) malloc(PATH_MAX);
+    snprintf(files[i], PATH_MAX, "%s/er_bench_%d_%d.dat", opts.dir, rank, i);
+  }
+  unsigned char* buf = (unsigned char*) malloc(BENCH_CHUNK);
+
+  ER_Init(NULL);
+
+  /* configure ER and collect per-phase stats */
+  kvtree* config = kvtree_new();
+  kvtree_util_set_int(config, ER_KEY_CONFIG_SET_SIZE, opts.set_size);
+  kvtree_util_set_int(config, ER_KEY_CONFIG_STATS, 1);
+  kvtree_util_set_int(config, ER_KEY_CONFIG_CRC_ON_COPY, opts.crc);
+  if (opts.io_threads > 0) {
+    kvtree_util_set_int(config, ER_KEY_CONFIG_IO_THREADS, opts.io_threads);
+  }
+  if (opts.buf_size > 0) {
+    kvtree_util_set_bytecount(config, ER_KEY_CONFIG_MPI_BUF_SIZE, opts.buf_size);
+  }
+  if (ER_Config(config) == NULL) {
+    rc = 1;
+  }
+  kvtree_delete(&config);
+
+  int scheme_id = ER_Create_Scheme(MPI_COMM_WORLD, domain, data_blocks, erasure_blocks);
+  if (scheme_id == -1) {
+    if (rank == 0) {
+      printf("Failed to create %s scheme with %d data and %d erasure blocks\n",
+        opts.scheme, data_blocks, erasure_blocks);
+    }
+    rc = 1;
+  }
+
+  char name[PATH_MAX];
+  snprintf(name, sizeof(name), "%s/er_bench.set", opts.dir);
+
+  /* bytes of application data across all procs */
+  double total_bytes = (double) opts.files * (double) opts.size * (double) ranks;
+
+  int iter;
+  for (iter = 0; iter < opts.iters && rc == 0; iter++) {
+    for (i = 0; i < opts.files; i++) {
+      if (write_file(files[i], rank, i, opts.size, buf)) {
+        rc = 1;
+      }
+    }
+
+    double seconds;
+    kvtree* stats = NULL;
+    int op_rc = run_op(MPI_COMM_WORLD, comm_host, name, ER_DIRECTION_ENCODE, scheme_id,
+      opts.files, files, &seconds, &stats);
+    if (rank == 0) {
+      report(&opts, "encode", iter, ranks, total_bytes, seconds, op_rc, stats);
+    }
+    kvtree_delete(&stats);
+    if (op_rc != ER_SUCCESS) {
+      rc = 1;
+    }
+
+    /* lose files according to failure pattern */
+    int lose = 0;
+    if (opts.failure == BENCH_FAILURE_NODE) {
+      lose = same_domain;
+    } else if (opts.failure == BENCH_FAILURE_REVERSE) {
+      lose = (rank == 0);
+    }
+    if (lose) {
+      for (i = 0; i < opts.files; i++) {
+        unlink(files[i]);
+      }
+    }
+
+    /* rebuild on reversed ranks if asked to */
+    MPI_Comm world = MPI_COMM_WORLD;
+    MPI_Comm store = comm_host;
+    if (opts.failure == BENCH_FAILURE_REVERSE) {
+      MPI_Comm_split(MPI_COMM_WORLD, 0, ranks - rank, &world);
+      rankstr_mpi_comm_split(world, hostname, 0, 0, 1, &store);
+    }
+
+    op_rc = run_op(world, store, name, ER_DIRECTION_REBUILD, 0, 0, NULL, &seconds, &stats);
+    if (rank == 0) {
+      report(&opts, "rebuild", iter, ranks, total_bytes, seconds, op_rc, stats);
+    }
+    kvtree_delete(&stats);
+    if (op_rc != ER_SUCCESS) {
+      rc = 1;
+    }
+
+    if (opts.verify) {
+      int bad = 0;
+      for (i = 0; i < opts.files; i++) {
+        if (verify_file(files[i], rank, i, opts.size, buf)) {
+          printf("Rank %d: file %s does not match after rebuild\n", rank, files[i]);
+          bad = 1;
+        }
+      }
+      int any_bad;
+      MPI_Allreduce(&bad, &any_bad, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+      if (any_bad) {
+        rc = 1;
+      }
+    }
+
+    op_rc = run_op(world, store, name, ER_DIRECTION_REMOVE, 0, 0, NULL, &seconds, &stats);
+    if (rank == 0) {
+      report(&opts, "remove", iter, ranks, total_bytes, seconds, op_rc, stats);
+    }
+    kvtree_delete(&stats);
+    if (op_rc != ER_SUCCESS) {
+      rc = 1;
+    }
+
+    if (world != MPI_COMM_WORLD) {
+      MPI_Comm_free(&store);
+      MPI_Comm_free(&world);
+    }
+
+    for (i = 0; i < opts.files; i++) {
+      unlink(files[i]);
+    }
+  }
+
+  if (scheme_id != -1) {
+    ER_Free_Scheme(scheme_id);
+  }
+  ER_Finalize();
+
+  for (i = 0; i < opts.files; i++) {
+    free(files[i]);
+  }
+  free(files);
+  free(buf);
+
+  MPI_Comm_free(&comm_host);
+
+  MPI_Finalize();
+
+  return rc;
+}
@@ -113,7 +113,22 @@ void check_options(const int exp_debug, const int exp_set_size,
     ER_KEY_CONFIG_DEBUG,
     ER_KEY_CONFIG_SET_SIZE,
     ER_KEY_CONFIG_MPI_BUF_SIZE,
-    /* ER_KEY_CONFIG_CRC_ON_COPY, not supported */
+    ER_KEY_CONFIG_CRC_ON_COPY,
+    ER_KEY_CONFIG_STATS,
+    ER_KEY_CONFIG_BUF_HUGEPAGE,
+    ER_KEY_CONFIG_PIPELINE_REBUILD,
+    ER_KEY_CONFIG_IO_THREADS,
+    ER_KEY_CONFIG_COMPRESS,
+    ER_KEY_CONFIG_DELTA,
+    ER_KEY_CONFIG_MMAP,
+    ER_KEY_CONFIG_FLUSH_DIR,
+    ER_KEY_CONFIG_VERIFY_BW,
+    ER_KEY_CONFIG_MAX_BW,
+    ER_KEY_CONFIG_MAX_CHUNKS,
+    ER_KEY_CONFIG_PROGRESS,
+    ER_KEY_CONFIG_PROGRESS_CPUS,
+    ER_KEY_CONFIG_PROGRESS_POLL,
+    ER_KEY_CONFIG_TRACE_FILE,
     NULL
   };
   check_known_options(config, known_options);
@@ -221,6 +236,17 @@ main(int argc, char *argv[]) {
 
   check_options(new_er_debug, new_er_set_size, new_er_mpi_buf_size);
 
+  /* a malformed cpu list for the progress thread must be rejected */
+  kvtree_delete(&ER_Config_values);
+  ER_Config_values = kvtree_new();
+  kvtree_util_set_str(ER_Config_values, ER_KEY_CONFIG_PROGRESS_CPUS, "1-");
+  printf("Configuring ER (invalid progress cpu list)...\n");
+  if (ER_Config(ER_Config_values) != NULL) {
+    printf("ER_Config() accepted invalid %s\n", ER_KEY_CONFIG_PROGRESS_CPUS);
+    return EXIT_FAILURE;
+  }
+  kvtree_delete(&ER_Config_values);
+
   rc = ER_Finalize();
   if (rc != ER_SUCCESS) {
     printf("ER_Finalize() failed (error %d)\n", rc);
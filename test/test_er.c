@@ -5,20 +5,52 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <stdarg.h>
+#include <dirent.h>
 
 #include <limits.h>
 #include <unistd.h>
 
 #include "mpi.h"
 #include "rankstr_mpi.h"
+#include "kvtree.h"
+#include "kvtree_util.h"
 
 #include "er.h"
 
+/* for ER_TRACE and HAVE_LIBZ */
+#include "config.h"
+
 #define ER_HOSTNAME (255)
 
 #define TEST_PASS (0)
 #define TEST_FAIL (1)
 
+/* sets ER options from pairs of key and value strings ending in NULL */
+int set_config(const char* key, ...)
+{
+  kvtree* config = kvtree_new();
+  va_list args;
+  va_start(args, key);
+  while (key != NULL) {
+    kvtree_util_set_str(config, key, va_arg(args, const char*));
+    key = va_arg(args, const char*);
+  }
+  va_end(args);
+  int rc = (ER_Config(config) != NULL) ? TEST_PASS : TEST_FAIL;
+  kvtree_delete(&config);
+  return rc;
+}
+
+/* returns the name of a dataset no earlier call returned */
+const char* new_dsetname(void)
+{
+  static char names[64][256];
+  static int count = 0;
+  sprintf(names[count], "/dev/shm/timestep.%d", count + 1);
+  return names[count++];
+}
+
 int test_null(MPI_Comm comm_host, char* hostname){
   ER_Init(NULL);
   if(ER_Create_Scheme(comm_host, NULL, 1, 1) != -1){
@@ -83,6 +115,33 @@ int test_encode(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name,
   return TEST_PASS;
 }
 
+int test_encode_poll(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, int numfiles, const char** filelist)
+{
+  // encode files using redundancy scheme, poll for completion with ER_Test
+  int set_id = ER_Create(world, store, name, ER_DIRECTION_ENCODE, scheme_id);
+  if(set_id == -1)
+    return TEST_FAIL;
+
+  int i;
+  for (i = 0; i < numfiles; i++) {
+    const char* file = filelist[i];
+    if(ER_Add(set_id, file) == ER_FAILURE){
+      return TEST_FAIL;
+    }
+  }
+
+  if(ER_Dispatch(set_id) == ER_FAILURE){
+      return TEST_FAIL;
+  }
+  while (! ER_Test(set_id)) {
+    usleep(1000);
+  }
+  if(ER_Free(set_id) == ER_FAILURE){
+      return TEST_FAIL;
+  }
+  return TEST_PASS;
+}
+
 int test_rebuild_no_failure(MPI_Comm world, MPI_Comm store, const char* name)
 {
   // rebuild encoded files (and redundancy data)
@@ -147,76 +206,1578 @@ int test_remove_no_failure(MPI_Comm world, MPI_Comm store, const char* name)
   return TEST_PASS;
 }
 
-int main (int argc, char* argv[])
+int test_rebuild_corrupt(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, const char* file, const char* data)
 {
+  int rank;
+  MPI_Comm_rank(world, &rank);
+
+  // record checksums of files while encoding
+  if(set_config(ER_KEY_CONFIG_CRC_ON_COPY, "1", ER_KEY_CONFIG_IO_THREADS, "8", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  const char* filelist[1] = { file };
+  if(test_encode(scheme_id, world, store, name, 1, filelist) != TEST_PASS)
+      return TEST_FAIL;
+
+  // flip a byte in the file of one rank without changing its size
   int rc = TEST_PASS;
-  MPI_Init(&argc, &argv);
+  if (rank == 0) {
+    int fd = open(file, O_WRONLY);
+    if (fd == -1 || pwrite(fd, "X", 1, 0) != 1)
+      rc = TEST_FAIL;
+    if (fd != -1)
+      close(fd);
+  }
 
-  int rank, ranks;
-  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+  // rebuild should detect the damaged file and restore it
+  if(test_rebuild_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
 
   char buf[256];
-  sprintf(buf, "data from rank %d\n", rank);
-
-  char filename[256];
-  sprintf(filename, "/dev/shm/testfile_%d.out", rank);
-  int fd = open(filename, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
+  memset(buf, 0, sizeof(buf));
+  int fd = open(file, O_RDONLY);
   if (fd != -1) {
-    write(fd, buf, strlen(buf));
+    read(fd, buf, sizeof(buf) - 1);
     close(fd);
-  } else {
-    printf("Error opening file %s: %d %s\n", filename, errno, strerror(errno));
+  }
+  if (strcmp(buf, data) != 0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Rebuilt file %s does not match original contents\n", file);
     rc = TEST_FAIL;
   }
 
-  char hostname[ER_HOSTNAME + 1];
-  gethostname(hostname, sizeof(hostname));
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
 
-  /* create communicator of all procs on the same host */
-  MPI_Comm comm_host;
-  rankstr_mpi_comm_split(MPI_COMM_WORLD, hostname, 0, 0, 1, &comm_host);
+  if(set_config(ER_KEY_CONFIG_CRC_ON_COPY, "0", ER_KEY_CONFIG_IO_THREADS, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
 
-  char rankstr[256];
-  sprintf(rankstr, "%d", rank);
+  MPI_Allreduce(MPI_IN_PLACE, &rc, 1, MPI_INT, MPI_MAX, world);
+  return rc;
+}
 
-  const char* filelist[1] = { filename };
+int test_stats(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, int numfiles, const char** filelist)
+{
+  if(set_config(ER_KEY_CONFIG_STATS, "1", NULL) != TEST_PASS)
+      return TEST_FAIL;
 
-  ER_Init(NULL);
+  // estimate what the encode costs before we run it
+  unsigned long size = 0;
+  int i;
+  for (i = 0; i < numfiles; i++) {
+    struct stat st;
+    if(stat(filelist[i], &st) == 0)
+      size += (unsigned long) st.st_size;
+  }
+  kvtree* estimate = ER_Estimate(scheme_id, numfiles, size);
+  if(estimate == NULL)
+      return TEST_FAIL;
+  unsigned long est_steps = 0, est_storage = 0, est_parity = 0;
+  kvtree_util_get_unsigned_long(estimate, "STEPS", &est_steps);
+  kvtree_util_get_unsigned_long(estimate, "STORAGE_BYTES", &est_storage);
+  kvtree_util_get_unsigned_long(estimate, "PARITY_BYTES", &est_parity);
+  kvtree_delete(&estimate);
+  if (est_steps == 0 || est_storage < est_parity) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Unexpected estimate: steps %lu, storage %lu, parity %lu\n",
+      est_steps, est_storage, est_parity);
+    return TEST_FAIL;
+  }
+  if(ER_Estimate(-1, numfiles, size) != NULL)
+      return TEST_FAIL;
+
+  // without a predecessor, DELTA has nothing to compute deltas against
+  if(set_config(ER_KEY_CONFIG_DELTA, "1", NULL) != TEST_PASS)
+      return TEST_FAIL;
+  unsigned long delta_steps = 0, delta_storage = 0;
+  estimate = ER_Estimate(scheme_id, numfiles, size);
+  kvtree_util_get_unsigned_long(estimate, "STEPS", &delta_steps);
+  kvtree_util_get_unsigned_long(estimate, "STORAGE_BYTES", &delta_storage);
+  kvtree_delete(&estimate);
+  if(set_config(ER_KEY_CONFIG_DELTA, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
+  if (delta_steps != est_steps || delta_storage != est_storage) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("DELTA changed the estimate of a set without a predecessor\n");
+    return TEST_FAIL;
+  }
+
+  int set_id = ER_Create(world, store, name, ER_DIRECTION_ENCODE, scheme_id);
+  if(set_id == -1)
+      return TEST_FAIL;
+  for (i = 0; i < numfiles; i++) {
+    if(ER_Add(set_id, filelist[i]) == ER_FAILURE)
+        return TEST_FAIL;
+  }
+  if(ER_Dispatch(set_id) == ER_FAILURE)
+      return TEST_FAIL;
 
-  char dsetname[256];
-  sprintf(dsetname, "/dev/shm/timestep.%d", 1);
+  // stats are not available until the operation completes
+  if(ER_Get_Stats(set_id, 0) != NULL)
+      return TEST_FAIL;
 
-  int scheme_id = ER_Create_Scheme(MPI_COMM_WORLD, hostname, ranks, ranks);
+  if(ER_Wait(set_id) == ER_FAILURE)
+      return TEST_FAIL;
 
-  // encode files using redundancy scheme
-  if(test_encode(scheme_id, MPI_COMM_WORLD, comm_host, dsetname, 1, filelist) !=TEST_PASS){
-    rc = TEST_FAIL;
+  // encode applies redundancy once and reads our files while doing so
+  kvtree* stats = ER_Get_Stats(set_id, 1);
+  if(stats == NULL)
+      return TEST_FAIL;
+  double calls = 0.0, bytes = 0.0;
+  kvtree* apply = kvtree_get_kv(stats, "PHASE", "APPLY");
+  kvtree_util_get_double(apply, "CALLS", &calls);
+  kvtree* max_apply = kvtree_get_kv(kvtree_get(stats, "MAX"), "PHASE", "APPLY");
+  kvtree_util_get_double(max_apply, "BYTES_READ", &bytes);
+  double collectives = 0.0;
+  kvtree_elem* elem;
+  for (elem = kvtree_elem_first(kvtree_get(stats, "PHASE")); elem != NULL; elem = kvtree_elem_next(elem)) {
+    double phase_collectives = 0.0;
+    kvtree_util_get_double(kvtree_elem_hash(elem), "COLLECTIVES", &phase_collectives);
+    collectives += phase_collectives;
+  }
+  kvtree_delete(&stats);
+  if (collectives != (double) est_steps) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Estimated %lu steps, encode counted %f collectives\n", est_steps, collectives);
+    return TEST_FAIL;
+  }
+  if (calls != 1.0 || bytes <= 0.0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Unexpected stats for APPLY: calls %f, bytes read %f\n", calls, bytes);
+    return TEST_FAIL;
   }
 
-  // rebuild encoded files (and redundancy data)
-  if(test_rebuild_no_failure(MPI_COMM_WORLD, comm_host, dsetname) !=TEST_PASS){
-    rc = TEST_FAIL;
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+
+  if(set_config(ER_KEY_CONFIG_STATS, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+int test_encode_buffer(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, const char* file)
+{
+  int rank;
+  MPI_Comm_rank(world, &rank);
+
+  char data[256];
+  sprintf(data, "buffer from rank %d\n", rank);
+
+  // encode a file that ER writes from our buffer
+  int set_id = ER_Create(world, store, name, ER_DIRECTION_ENCODE, scheme_id);
+  if(set_id == -1)
+      return TEST_FAIL;
+  // adding the same file again replaces the earlier entry
+  if(ER_Add_buffer(set_id, file, "stale contents\n", 15) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Add_buffer(set_id, file, data, strlen(data)) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Dispatch(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Wait(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  char buf[256];
+  memset(buf, 0, sizeof(buf));
+  int fd = open(file, O_RDONLY);
+  if (fd == -1)
+      return TEST_FAIL;
+  read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (strcmp(buf, data) != 0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("File %s does not match buffer\n", file);
+    return TEST_FAIL;
   }
 
-  // delete redundancy data added during ENCODE
-  if(test_remove_no_failure(MPI_COMM_WORLD, comm_host, dsetname) !=TEST_PASS){
-    rc = TEST_FAIL;
+  if(test_rebuild_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+
+  unlink(file);
+  return TEST_PASS;
+}
+
+/* return max number of calls of a phase across all procs of a completed set */
+static double phase_calls(int set_id, const char* phase)
+{
+  double calls = -1.0;
+  kvtree* stats = ER_Get_Stats(set_id, 1);
+  if (stats != NULL) {
+    calls = 0.0;
+    kvtree* hash = kvtree_get_kv(kvtree_get(stats, "MAX"), "PHASE", phase);
+    kvtree_util_get_double(hash, "CALLS", &calls);
+    kvtree_delete(&stats);
   }
+  return calls;
+}
 
-  // encode files using redundancy scheme
-  if(test_encode(scheme_id, MPI_COMM_WORLD, comm_host, dsetname, 1, filelist) !=TEST_PASS){
-    rc = TEST_FAIL;
+/* encode a set and return number of calls of a phase across all procs */
+static int encode_phase_calls(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, const char* prev,
+  int numfiles, const char** filelist, const char* phase, double* calls)
+{
+  int set_id = ER_Create(world, store, name, ER_DIRECTION_ENCODE, scheme_id);
+  if(set_id == -1)
+      return TEST_FAIL;
+  if(prev != NULL && ER_Set_predecessor(set_id, prev) == ER_FAILURE)
+      return TEST_FAIL;
+  int i;
+  for (i = 0; i < numfiles; i++) {
+    if(ER_Add(set_id, filelist[i]) == ER_FAILURE)
+        return TEST_FAIL;
   }
+  if(ER_Dispatch(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Wait(set_id) == ER_FAILURE)
+      return TEST_FAIL;
 
-  // rebuild encoded files (and redundancy data)
-  if(test_rebuild_one_failure_reverse(MPI_COMM_WORLD, comm_host, dsetname, 1, filelist) !=TEST_PASS){
-    rc = TEST_FAIL;
-  } 
+  *calls = phase_calls(set_id, phase);
 
-  ER_Free_Scheme(scheme_id);
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  return TEST_PASS;
+}
 
-  ER_Finalize();
+int test_encode_incremental(int scheme_id, MPI_Comm world, MPI_Comm store, const char** names, const char* file)
+{
+  int rank;
+  MPI_Comm_rank(world, &rank);
+
+  if(set_config(ER_KEY_CONFIG_STATS, "1", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  const char* filelist[1] = { file };
+  double calls;
+
+  // first set computes redundancy data
+  if(encode_phase_calls(scheme_id, world, store, names[0], NULL, 1, filelist, "APPLY", &calls) != TEST_PASS || calls != 1.0)
+      return TEST_FAIL;
+
+  // nothing changed, so its successor reuses the redundancy data
+  if(encode_phase_calls(scheme_id, world, store, names[1], names[0], 1, filelist, "APPLY", &calls) != TEST_PASS || calls != 0.0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Successor of unchanged set applied redundancy\n");
+    return TEST_FAIL;
+  }
+
+  // the successor stays intact when its predecessor is removed
+  if(test_remove_no_failure(world, store, names[0]) != TEST_PASS)
+      return TEST_FAIL;
+  if(test_rebuild_no_failure(world, store, names[1]) != TEST_PASS)
+      return TEST_FAIL;
+
+  // after one proc changes its file, the next set is encoded again
+  if (rank == 0) {
+    int fd = open(file, O_WRONLY | O_APPEND);
+    if (fd == -1 || write(fd, "more\n", 5) != 5)
+      return TEST_FAIL;
+    close(fd);
+  }
+  MPI_Barrier(world);
+  if(encode_phase_calls(scheme_id, world, store, names[2], names[1], 1, filelist, "APPLY", &calls) != TEST_PASS || calls != 1.0)
+      return TEST_FAIL;
+
+  if(test_remove_no_failure(world, store, names[1]) != TEST_PASS)
+      return TEST_FAIL;
+  if(test_remove_no_failure(world, store, names[2]) != TEST_PASS)
+      return TEST_FAIL;
+
+  if(set_config(ER_KEY_CONFIG_STATS, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+int test_rebuild_fast(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, const char* file)
+{
+  int rank;
+  MPI_Comm_rank(world, &rank);
+
+  if(set_config(ER_KEY_CONFIG_STATS, "1", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  const char* filelist[1] = { file };
+  if(test_encode(scheme_id, world, store, name, 1, filelist) != TEST_PASS)
+      return TEST_FAIL;
+
+  // all files are in place, so rebuild neither migrates nor recovers
+  int set_id = ER_Create(world, store, name, ER_DIRECTION_REBUILD, 0);
+  if(ER_Dispatch(set_id) == ER_FAILURE || ER_Wait(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(phase_calls(set_id, "MIGRATE") != 0.0 || phase_calls(set_id, "RECOVER") != 0.0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Rebuild of intact set did not take the fast path\n");
+    return TEST_FAIL;
+  }
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  // after losing a file, rebuild has to do the full work
+  if (rank == 0) {
+    unlink(file);
+  }
+  MPI_Barrier(world);
+  set_id = ER_Create(world, store, name, ER_DIRECTION_REBUILD, 0);
+  if(ER_Dispatch(set_id) == ER_FAILURE || ER_Wait(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(phase_calls(set_id, "RECOVER") != 1.0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Rebuild of set with lost file did not recover\n");
+    return TEST_FAIL;
+  }
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+
+  if(set_config(ER_KEY_CONFIG_STATS, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+int test_rebuild_lazy(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, const char* file)
+{
+  int rank;
+  MPI_Comm_rank(world, &rank);
+
+  const char* filelist[1] = { file };
+  if(test_encode(scheme_id, world, store, name, 1, filelist) != TEST_PASS)
+      return TEST_FAIL;
+
+  // rank 0 loses its file, the others can use theirs before it is rebuilt
+  if (rank == 0) {
+    unlink(file);
+  }
+  MPI_Barrier(world);
+  int set_id = ER_Create(world, store, name, ER_DIRECTION_REBUILD, 0);
+  if(ER_Dispatch(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Wait_file(set_id, file) != ER_SUCCESS) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("File %s not available during rebuild\n", file);
+    return TEST_FAIL;
+  }
+  if(access(file, R_OK) != 0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("ER_Wait_file returned before %s exists\n", file);
+    return TEST_FAIL;
+  }
+  if(ER_Wait(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+static long state_epoch(const char* name)
+{
+  char file[1024];
+  snprintf(file, sizeof(file), "%s.er.er", name);
+
+  long epoch = -1;
+  unsigned long val;
+  kvtree* data = kvtree_new();
+  if (kvtree_read_file(file, data) == KVTREE_SUCCESS &&
+      kvtree_util_get_unsigned_long(data, "EPOCH", &val) == KVTREE_SUCCESS)
+  {
+    epoch = (long) val;
+  }
+  kvtree_delete(&data);
+  return epoch;
+}
+
+int test_state_epoch(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, const char* file)
+{
+  int rank_store;
+  MPI_Comm_rank(store, &rank_store);
+
+  // encoding the same set again has to produce newer state
+  const char* filelist[1] = { file };
+  if(test_encode(scheme_id, world, store, name, 1, filelist) != TEST_PASS)
+      return TEST_FAIL;
+  long first = state_epoch(name);
+  if(test_encode(scheme_id, world, store, name, 1, filelist) != TEST_PASS)
+      return TEST_FAIL;
+  long second = state_epoch(name);
+  int rc = TEST_PASS;
+  if (rank_store == 0 && (first < 1 || second <= first)) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("State epoch did not advance: %ld then %ld\n", first, second);
+    rc = TEST_FAIL;
+  }
+
+  // rebuild keeps the epoch of the state it restored
+  if(test_rebuild_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+  if (rank_store == 0 && state_epoch(name) != second) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Rebuild changed state epoch from %ld to %ld\n", second, state_epoch(name));
+    rc = TEST_FAIL;
+  }
+
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+
+  MPI_Allreduce(MPI_IN_PLACE, &rc, 1, MPI_INT, MPI_MAX, world);
+  return rc;
+}
+
+int test_encode_files(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, int numfiles, const char** filelist)
+{
+  // add all files with one call, listing the first one twice
+  int set_id = ER_Create(world, store, name, ER_DIRECTION_ENCODE, scheme_id);
+  if(set_id == -1)
+      return TEST_FAIL;
+  if(ER_Add_files(set_id, numfiles, filelist) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Add_files(set_id, 1, filelist) == ER_FAILURE)
+      return TEST_FAIL;
+  const char* badlist[2] = { filelist[0], NULL };
+  if(ER_Add_files(set_id, 2, badlist) != ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Dispatch(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Wait(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  if(test_rebuild_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+int test_rebuild_pipeline(int scheme_id, MPI_Comm world, MPI_Comm store, const char** names, const char** files)
+{
+  int rank;
+  MPI_Comm_rank(world, &rank);
+
+  if(set_config(ER_KEY_CONFIG_PIPELINE_REBUILD, "1", ER_KEY_CONFIG_STATS, "1", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  int i;
+  for (i = 0; i < 2; i++) {
+    if(test_encode(scheme_id, world, store, names[i], 1, &files[i]) != TEST_PASS)
+        return TEST_FAIL;
+  }
+
+  // lose a file of each set, so that both have to be recovered
+  if (rank == 0) {
+    unlink(files[0]);
+    unlink(files[1]);
+  }
+  MPI_Barrier(world);
+
+  int set_ids[2];
+  for (i = 0; i < 2; i++) {
+    set_ids[i] = ER_Create(world, store, names[i], ER_DIRECTION_REBUILD, 0);
+  }
+  if(ER_Dispatch_all(2, set_ids) == ER_FAILURE)
+      return TEST_FAIL;
+  for (i = 0; i < 2; i++) {
+    if(ER_Wait(set_ids[i]) == ER_FAILURE)
+        return TEST_FAIL;
+    if(phase_calls(set_ids[i], "MIGRATE") != 1.0 || phase_calls(set_ids[i], "RECOVER") != 1.0) {
+      printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+      printf("Set %s was not migrated and recovered once\n", names[i]);
+      return TEST_FAIL;
+    }
+    if(ER_Free(set_ids[i]) == ER_FAILURE)
+        return TEST_FAIL;
+    if(access(files[i], R_OK) != 0) {
+      printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+      printf("File %s was not rebuilt\n", files[i]);
+      return TEST_FAIL;
+    }
+  }
+
+  for (i = 0; i < 2; i++) {
+    if(test_remove_no_failure(world, store, names[i]) != TEST_PASS)
+        return TEST_FAIL;
+  }
+
+  if(set_config(ER_KEY_CONFIG_PIPELINE_REBUILD, "0", ER_KEY_CONFIG_STATS, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+int test_create_scheme_auto(MPI_Comm world, MPI_Comm store, const char* name, const char* file)
+{
+  // treat each proc as its own failure domain
+  int rank, ranks;
+  MPI_Comm_rank(world, &rank);
+  MPI_Comm_size(world, &ranks);
+  char domain[32];
+  sprintf(domain, "%d", rank);
+
+  // no scheme can survive the loss of every failure domain
+  if(ER_Create_Scheme_auto(world, domain, ranks, 100.0) != -1)
+      return TEST_FAIL;
+
+  // with fewer than three failure domains XOR costs as much as PARTNER
+  if (ranks < 3)
+      return TEST_PASS;
+
+  // only XOR over all procs fits within the overhead budget
+  double overhead = 1.0 / (double)(ranks - 1);
+  int scheme_id = ER_Create_Scheme_auto(world, domain, 1, overhead);
+  if(scheme_id == -1)
+      return TEST_FAIL;
+
+  kvtree* config = ER_Config(NULL);
+  if(config == NULL)
+      return TEST_FAIL;
+  char* type = NULL;
+  int set_size = 0, domains = 0;
+  kvtree_util_get_str(config, ER_KEY_CONFIG_AUTO_SCHEME_TYPE, &type);
+  kvtree_util_get_int(config, ER_KEY_CONFIG_AUTO_SCHEME_SET_SIZE, &set_size);
+  kvtree_util_get_int(config, ER_KEY_CONFIG_AUTO_SCHEME_DOMAINS, &domains);
+  if(type == NULL || strcmp(type, "XOR") != 0 || set_size != ranks || domains != ranks) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Picked %s scheme of set size %d over %d domains\n", type ? type : "no", set_size, domains);
+    kvtree_delete(&config);
+    return TEST_FAIL;
+  }
+  kvtree_delete(&config);
+
+  if(test_encode(scheme_id, world, store, name, 1, &file) != TEST_PASS)
+      return TEST_FAIL;
+  if(test_rebuild_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+
+  if(ER_Free_Scheme(scheme_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+int test_compose_scheme(MPI_Comm world, MPI_Comm store, const char* name, const char* file)
+{
+  int rank;
+  MPI_Comm_rank(world, &rank);
+  char domain[32];
+  sprintf(domain, "%d", rank);
+
+  // XOR first, falling back to PARTNER
+  int local_id  = ER_Create_Scheme(world, domain, 1, 1);
+  int global_id = ER_Create_Scheme(world, domain, 1, 2);
+  if(local_id == -1 || global_id == -1)
+      return TEST_FAIL;
+  int scheme_id = ER_Compose_Scheme(local_id, global_id);
+  if(scheme_id == -1)
+      return TEST_FAIL;
+  if(ER_Compose_Scheme(scheme_id, global_id) != -1)
+      return TEST_FAIL;
+
+  // levels must be created on the same procs
+  int self_id = ER_Create_Scheme(MPI_COMM_SELF, domain, 1, 0);
+  if(self_id == -1)
+      return TEST_FAIL;
+  int ranks;
+  MPI_Comm_size(world, &ranks);
+  if(ranks > 1 && ER_Compose_Scheme(self_id, global_id) != -1)
+      return TEST_FAIL;
+  if(ER_Free_Scheme(self_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  // the composed scheme keeps its levels alive
+  if(ER_Free_Scheme(local_id) == ER_FAILURE || ER_Free_Scheme(global_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  if(test_encode(scheme_id, world, store, name, 1, &file) != TEST_PASS)
+      return TEST_FAIL;
+
+  // lose a file along with the redundancy files of the first level of
+  // another proc, which are named after the set and its rank, that is
+  // more than XOR can rebuild, so the second level has to get it back
+  int lost = 0;
+  if (rank == 0) {
+    unlink(file);
+  }
+  if (rank == 1) {
+    char dir[256], prefix[256];
+    snprintf(dir, sizeof(dir), "%s", name);
+    *strrchr(dir, '/') = '\0';
+    snprintf(prefix, sizeof(prefix), "%s.er.%d.", strrchr(name, '/') + 1, rank);
+    DIR* d = opendir(dir);
+    struct dirent* entry;
+    while (d != NULL && (entry = readdir(d)) != NULL) {
+      if (strncmp(entry->d_name, prefix, strlen(prefix)) == 0) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+        lost++;
+      }
+    }
+    if (d != NULL) {
+      closedir(d);
+    }
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &lost, 1, MPI_INT, MPI_SUM, world);
+  if(ranks > 1 && lost == 0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Found no redundancy files of the first level of %s\n", name);
+    return TEST_FAIL;
+  }
+  if(test_rebuild_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+  int found = (access(file, R_OK) == 0);
+  MPI_Allreduce(MPI_IN_PLACE, &found, 1, MPI_INT, MPI_LAND, world);
+  if(! found) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("File %s was not rebuilt from the second level\n", file);
+    return TEST_FAIL;
+  }
+
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+
+  if(ER_Free_Scheme(scheme_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+/* returns 1 if file holds exactly size bytes of data */
+static int file_matches(const char* file, const char* data, size_t size)
+{
+  char* buf = (char*) malloc(size + 1);
+  int match = 0;
+  int fd = open(file, O_RDONLY);
+  if (fd != -1) {
+    match = (read(fd, buf, size + 1) == (ssize_t) size && memcmp(buf, data, size) == 0);
+    close(fd);
+  }
+  free(buf);
+  return match;
+}
+
+int test_encode_compressed(int scheme_id, MPI_Comm world, MPI_Comm store, const char** names, const char* file)
+{
+  const char* name = names[0];
+  int rank;
+  MPI_Comm_rank(world, &rank);
+
+  // a file that is mostly zeros, compressed from memory
+  size_t size = 32768;
+  char* data = (char*) calloc(size, 1);
+  sprintf(data, "compressed data of rank %d", rank);
+
+  if(set_config(ER_KEY_CONFIG_COMPRESS, "1", ER_KEY_CONFIG_CRC_ON_COPY, "1", ER_KEY_CONFIG_STATS, "1", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  int set_id = ER_Create(world, store, name, ER_DIRECTION_ENCODE, scheme_id);
+  if(set_id == -1)
+      return TEST_FAIL;
+  if(ER_Add_buffer(set_id, file, data, size) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Dispatch(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Wait(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  // the copy that got encoded is smaller than the file
+  double read = 0.0, written = 0.0;
+  kvtree* stats = ER_Get_Stats(set_id, 0);
+  kvtree* hash = kvtree_get_kv(stats, "PHASE", "COMPRESS");
+  kvtree_util_get_double(hash, "BYTES_READ", &read);
+  kvtree_util_get_double(hash, "BYTES_WRITTEN", &written);
+  kvtree_delete(&stats);
+  if(written <= 0.0 || written >= read) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Compressed %f bytes into %f bytes\n", read, written);
+    return TEST_FAIL;
+  }
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  // a compressed successor of an unchanged set encodes its own copies,
+  // and can be rebuilt once the predecessor is gone, see below
+  const char* filelist[1] = { file };
+  double calls;
+  if(encode_phase_calls(scheme_id, world, store, names[1], name, 1, filelist, "APPLY", &calls) != TEST_PASS || calls != 1.0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Compressed successor reused redundancy of its predecessor\n");
+    return TEST_FAIL;
+  }
+
+  // a lost file is restored from its compressed copy
+  char shadow[256];
+  sprintf(shadow, "%s.er.z.%d.0", name, rank);
+  if (rank == 0) {
+    unlink(file);
+  }
+  MPI_Barrier(world);
+  if(test_rebuild_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+  if(! file_matches(file, data, size)) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("File %s was not restored from %s\n", file, shadow);
+    return TEST_FAIL;
+  }
+
+  // so is a file that lost its copy too
+  if (rank == 0) {
+    unlink(file);
+    unlink(shadow);
+  }
+  MPI_Barrier(world);
+  if(test_rebuild_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+  if(! file_matches(file, data, size)) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("File %s was not rebuilt\n", file);
+    return TEST_FAIL;
+  }
+
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+  MPI_Barrier(world);
+  if(access(shadow, F_OK) == 0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Compressed copy %s was not removed\n", shadow);
+    return TEST_FAIL;
+  }
+
+  char shadow2[256];
+  sprintf(shadow2, "%s.er.z.%d.0", names[1], rank);
+  if (rank == 0) {
+    unlink(file);
+    unlink(shadow2);
+  }
+  MPI_Barrier(world);
+  if(test_rebuild_no_failure(world, store, names[1]) != TEST_PASS)
+      return TEST_FAIL;
+  if(! file_matches(file, data, size)) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("File %s was not rebuilt from successor %s\n", file, names[1]);
+    return TEST_FAIL;
+  }
+  free(data);
+
+  if(test_remove_no_failure(world, store, names[1]) != TEST_PASS)
+      return TEST_FAIL;
+
+  if(set_config(ER_KEY_CONFIG_COMPRESS, "0", ER_KEY_CONFIG_CRC_ON_COPY, "0", ER_KEY_CONFIG_STATS, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+int test_encode_delta(int scheme_id, MPI_Comm world, MPI_Comm store, const char** names, const char** files)
+{
+  int rank;
+  MPI_Comm_rank(world, &rank);
+
+  if(set_config(ER_KEY_CONFIG_DELTA, "1", ER_KEY_CONFIG_CRC_ON_COPY, "1", ER_KEY_CONFIG_STATS, "1", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  // a checkpoint of several blocks, and its successor in which one changed
+  size_t size = 4 * 65536 + 100;
+  char* data = (char*) malloc(size);
+  size_t k;
+  for (k = 0; k < size; k++) {
+    data[k] = (char) ((k * 7 + rank) % 251);
+  }
+  int gen;
+  for (gen = 0; gen < 2; gen++) {
+    if (gen == 1) {
+      sprintf(data + 2 * 65536 + 10, "changed block of rank %d", rank);
+    }
+    int fd = open(files[gen], O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd == -1 || write(fd, data, size) != (ssize_t) size) {
+      free(data);
+      return TEST_FAIL;
+    }
+    close(fd);
+  }
+
+  if(test_encode(scheme_id, world, store, names[0], 1, &files[0]) != TEST_PASS)
+      return TEST_FAIL;
+
+  int set_id = ER_Create(world, store, names[1], ER_DIRECTION_ENCODE, scheme_id);
+  if(set_id == -1)
+      return TEST_FAIL;
+  if(ER_Set_predecessor(set_id, names[0]) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Add(set_id, files[1]) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Dispatch(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Wait(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  // only the changed block got encoded
+  double read = 0.0, written = 0.0;
+  kvtree* stats = ER_Get_Stats(set_id, 0);
+  kvtree* hash = kvtree_get_kv(stats, "PHASE", "COMPRESS");
+  kvtree_util_get_double(hash, "BYTES_READ", &read);
+  kvtree_util_get_double(hash, "BYTES_WRITTEN", &written);
+  kvtree_delete(&stats);
+  if(read != (double) size || written <= 0.0 || written > 2 * 65536) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Delta of %f bytes took %f bytes\n", read, written);
+    return TEST_FAIL;
+  }
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  // a lost file is restored from the file of the predecessor and its delta
+  char shadow[256];
+  sprintf(shadow, "%s.er.z.%d.0", names[1], rank);
+  if (rank == 0) {
+    unlink(files[1]);
+  }
+  MPI_Barrier(world);
+  if(test_rebuild_no_failure(world, store, names[1]) != TEST_PASS)
+      return TEST_FAIL;
+  if(! file_matches(files[1], data, size)) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("File %s was not restored from %s\n", files[1], shadow);
+    return TEST_FAIL;
+  }
+
+  // blocks of a delta don't depend on the transfer buffers of the job
+  if(set_config(ER_KEY_CONFIG_MPI_BUF_SIZE, "16384", NULL) != TEST_PASS)
+      return TEST_FAIL;
+  if (rank == 0) {
+    unlink(files[1]);
+  }
+  MPI_Barrier(world);
+  int rc = test_rebuild_no_failure(world, store, names[1]);
+  if(set_config(ER_KEY_CONFIG_MPI_BUF_SIZE, "1048576", NULL) != TEST_PASS)
+      return TEST_FAIL;
+  if(rc != TEST_PASS || ! file_matches(files[1], data, size)) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("File %s was not restored with small transfer buffers\n", files[1]);
+    return TEST_FAIL;
+  }
+
+  // a delta is undone once its set is recovered, even while the sets
+  // after it are migrated in the background
+  if(set_config(ER_KEY_CONFIG_PIPELINE_REBUILD, "1", NULL) != TEST_PASS)
+      return TEST_FAIL;
+  if (rank == 0) {
+    unlink(files[1]);
+  }
+  MPI_Barrier(world);
+  int set_ids[2];
+  for (gen = 0; gen < 2; gen++) {
+    set_ids[gen] = ER_Create(world, store, names[gen], ER_DIRECTION_REBUILD, 0);
+  }
+  if(ER_Dispatch_all(2, set_ids) == ER_FAILURE)
+      return TEST_FAIL;
+  for (gen = 0; gen < 2; gen++) {
+    if(ER_Wait(set_ids[gen]) == ER_FAILURE)
+        rc = TEST_FAIL;
+    if(ER_Free(set_ids[gen]) == ER_FAILURE)
+        return TEST_FAIL;
+  }
+  if(set_config(ER_KEY_CONFIG_PIPELINE_REBUILD, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
+  if(rc != TEST_PASS || ! file_matches(files[1], data, size)) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("File %s was not restored with pipelined rebuilds\n", files[1]);
+    return TEST_FAIL;
+  }
+  free(data);
+
+  if(test_remove_no_failure(world, store, names[1]) != TEST_PASS)
+      return TEST_FAIL;
+  if(test_remove_no_failure(world, store, names[0]) != TEST_PASS)
+      return TEST_FAIL;
+  MPI_Barrier(world);
+  if(access(shadow, F_OK) == 0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Delta %s was not removed\n", shadow);
+    return TEST_FAIL;
+  }
+
+  if(set_config(ER_KEY_CONFIG_DELTA, "0", ER_KEY_CONFIG_CRC_ON_COPY, "0", ER_KEY_CONFIG_STATS, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+int test_encode_flush(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, const char* dir, const char* file)
+{
+  int rank;
+  MPI_Comm_rank(world, &rank);
+
+  if(set_config(ER_KEY_CONFIG_FLUSH_DIR, dir, ER_KEY_CONFIG_STATS, "1", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  int set_id = ER_Create(world, store, name, ER_DIRECTION_ENCODE, scheme_id);
+  if(set_id == -1)
+      return TEST_FAIL;
+  if(ER_Get_tier(set_id) != ER_TIER_NONE)
+      return TEST_FAIL;
+  if(ER_Add(set_id, file) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Dispatch(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  // the local commit comes no later than the flush
+  int tier;
+  while ((tier = ER_Get_tier(set_id)) == ER_TIER_NONE) {
+    usleep(1000);
+  }
+  if(tier != ER_TIER_LOCAL && tier != ER_TIER_FLUSHED) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Unexpected tier %d\n", tier);
+    return TEST_FAIL;
+  }
+  if(ER_Wait(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Get_tier(set_id) != ER_TIER_FLUSHED) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Set was not flushed to %s\n", dir);
+    return TEST_FAIL;
+  }
+
+  double written = 0.0;
+  kvtree* stats = ER_Get_Stats(set_id, 0);
+  kvtree_util_get_double(kvtree_get_kv(stats, "PHASE", "FLUSH"), "BYTES_WRITTEN", &written);
+  kvtree_delete(&stats);
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  // the first proc of the storage group flushed the state file
+  int found = 1;
+  if (rank == 0) {
+    char state[256];
+    sprintf(state, "%s/%s.er.er.%d", dir, strrchr(name, '/') + 1, rank);
+    found = (access(state, R_OK) == 0 && written > 0.0);
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &found, 1, MPI_INT, MPI_LAND, world);
+  if(! found) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Flushed files are missing from %s\n", dir);
+    return TEST_FAIL;
+  }
+
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+
+  // remove deletes the flushed copies too
+  MPI_Barrier(world);
+  int left = 0;
+  if (rank == 0) {
+    DIR* d = opendir(dir);
+    struct dirent* entry;
+    while (d != NULL && (entry = readdir(d)) != NULL) {
+      if (entry->d_name[0] != '.') {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+        left++;
+      }
+    }
+    if (d != NULL) {
+      closedir(d);
+    }
+    rmdir(dir);
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &left, 1, MPI_INT, MPI_SUM, world);
+  if(left != 0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Remove left %d flushed files in %s\n", left, dir);
+    return TEST_FAIL;
+  }
+
+  if(set_config(ER_KEY_CONFIG_FLUSH_DIR, "", ER_KEY_CONFIG_STATS, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+int test_mmap(int scheme_id, MPI_Comm world, MPI_Comm store, const char** names, const char* file, const char* data, const char** genfiles)
+{
+  // files ER owns on /dev/shm are copied through maps, app files are read
+  if(set_config(ER_KEY_CONFIG_MMAP, "1", NULL) != TEST_PASS)
+      return TEST_FAIL;
+  kvtree* current = ER_Config(NULL);
+  int mapped = 0;
+  kvtree_util_get_int(current, ER_KEY_CONFIG_MMAP, &mapped);
+  kvtree_delete(&current);
+  if(mapped != 1) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("MMAP was not set\n");
+    return TEST_FAIL;
+  }
+
+  int rc = test_rebuild_corrupt(scheme_id, world, store, names[0], file, data);
+  if(rc == TEST_PASS)
+      rc = test_encode_delta(scheme_id, world, store, &names[1], genfiles);
+  if(rc == TEST_PASS)
+      rc = test_encode_flush(scheme_id, world, store, names[3], "/dev/shm/flushmap", file);
+
+  if(set_config(ER_KEY_CONFIG_MMAP, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  return rc;
+}
+
+int test_verify_one(MPI_Comm world, MPI_Comm store, const char* name, int expect, double* read)
+{
+  int set_id = ER_Create(world, store, name, ER_DIRECTION_VERIFY, 0);
+  if(set_id == -1)
+      return TEST_FAIL;
+  if(ER_Dispatch(set_id) == ER_FAILURE && expect == ER_SUCCESS)
+      return TEST_FAIL;
+  if(ER_Wait(set_id) != expect) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Verify of %s did not return %d\n", name, expect);
+    return TEST_FAIL;
+  }
+  kvtree* stats = ER_Get_Stats(set_id, 0);
+  kvtree_util_get_double(kvtree_get_kv(stats, "PHASE", "VERIFY"), "BYTES_READ", read);
+  kvtree_delete(&stats);
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  return TEST_PASS;
+}
+
+int test_verify(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, const char* file)
+{
+  int rank;
+  MPI_Comm_rank(world, &rank);
+
+  // checksums recorded at encode are checked even with CRC_ON_COPY off
+  if(set_config(ER_KEY_CONFIG_CRC_ON_COPY, "1", ER_KEY_CONFIG_STATS, "1", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  const char* filelist[1] = { file };
+  if(test_encode(scheme_id, world, store, name, 1, filelist) != TEST_PASS)
+      return TEST_FAIL;
+
+  if(set_config(ER_KEY_CONFIG_CRC_ON_COPY, "0", ER_KEY_CONFIG_VERIFY_BW, "1073741824", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  double read = 0.0;
+  if(test_verify_one(world, store, name, ER_SUCCESS, &read) != TEST_PASS)
+      return TEST_FAIL;
+  if(read <= 0.0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Verify did not read any files\n");
+    return TEST_FAIL;
+  }
+
+  // flip a byte in the file of one rank without changing its size
+  char orig;
+  if (rank == 0) {
+    int fd = open(file, O_RDWR);
+    if (fd == -1 || pread(fd, &orig, 1, 0) != 1 || pwrite(fd, "X", 1, 0) != 1)
+      return TEST_FAIL;
+    close(fd);
+  }
+  MPI_Barrier(world);
+  if(test_verify_one(world, store, name, ER_FAILURE, &read) != TEST_PASS)
+      return TEST_FAIL;
+
+  // the result ends up in the state file, which stays encoded
+  int bad = -1, state = 0;
+  if (rank == 0) {
+    char er_file[256];
+    sprintf(er_file, "%s.er.er", name);
+    kvtree* data = kvtree_new();
+    kvtree_read_file(er_file, data);
+    kvtree_util_get_int(kvtree_get(data, "VERIFY"), "BAD", &bad);
+    kvtree_util_get_int(data, "STATE", &state);
+    kvtree_delete(&data);
+    if (bad != 1 || state != 2) {
+      printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+      printf("State file %s has BAD %d and STATE %d\n", er_file, bad, state);
+    }
+
+    int fd = open(file, O_WRONLY);
+    if (fd == -1 || pwrite(fd, &orig, 1, 0) != 1)
+      return TEST_FAIL;
+    close(fd);
+  }
+  int ok = (rank != 0 || (bad == 1 && state == 2));
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, world);
+  if(! ok)
+      return TEST_FAIL;
+
+  // a repaired file passes again
+  if(test_verify_one(world, store, name, ER_SUCCESS, &read) != TEST_PASS)
+      return TEST_FAIL;
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+
+  if(set_config(ER_KEY_CONFIG_STATS, "0", ER_KEY_CONFIG_VERIFY_BW, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+int test_encode_paused(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, const char* file)
+{
+  // limit background traffic of the encode
+  if(set_config(ER_KEY_CONFIG_MAX_BW, "67108864", ER_KEY_CONFIG_MAX_CHUNKS, "2", ER_KEY_CONFIG_IO_THREADS, "8", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  int provided;
+  MPI_Query_thread(&provided);
+
+  if(ER_Pause() == ER_FAILURE)
+      return TEST_FAIL;
+
+  int set_id = ER_Create(world, store, name, ER_DIRECTION_ENCODE, scheme_id);
+  if(set_id == -1)
+      return TEST_FAIL;
+  if(ER_Add(set_id, file) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Dispatch(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  // a paused encode in the background does not finish
+  usleep(100000);
+  if(provided == MPI_THREAD_MULTIPLE && ER_Test(set_id)) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Encode finished while paused\n");
+    return TEST_FAIL;
+  }
+
+  if(ER_Resume() == ER_FAILURE)
+      return TEST_FAIL;
+  if(provided == MPI_THREAD_MULTIPLE && ER_Wait(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  if(test_rebuild_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+
+  if(set_config(ER_KEY_CONFIG_MAX_BW, "0", ER_KEY_CONFIG_MAX_CHUNKS, "0", ER_KEY_CONFIG_IO_THREADS, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+int test_rebuild_partial(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, const char** files)
+{
+  int rank;
+  MPI_Comm_rank(world, &rank);
+
+  if(set_config(ER_KEY_CONFIG_STATS, "1", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  if(test_encode(scheme_id, world, store, name, 2, files) != TEST_PASS)
+      return TEST_FAIL;
+
+  // lose the file nobody is going to read
+  if (rank == 0) {
+    unlink(files[1]);
+  }
+  MPI_Barrier(world);
+
+  // a rebuild of the first file has nothing to move or recover
+  int set_id = ER_Create(world, store, name, ER_DIRECTION_REBUILD, 0);
+  if(set_id == -1)
+      return TEST_FAIL;
+  if(ER_Add(set_id, files[0]) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Dispatch(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Wait(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  double migrates = -1.0, recovers = -1.0;
+  kvtree* stats = ER_Get_Stats(set_id, 0);
+  kvtree_util_get_double(kvtree_get_kv(stats, "PHASE", "MIGRATE"), "CALLS", &migrates);
+  kvtree_util_get_double(kvtree_get_kv(stats, "PHASE", "RECOVER"), "CALLS", &recovers);
+  kvtree_delete(&stats);
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(migrates != 0.0 || recovers != 0.0) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Partial rebuild migrated %f and recovered %f times\n", migrates, recovers);
+    return TEST_FAIL;
+  }
+  if(access(files[0], F_OK) != 0 || (rank == 0 && access(files[1], F_OK) == 0)) {
+    printf("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Partial rebuild touched files it did not need\n");
+    return TEST_FAIL;
+  }
+
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+
+  if(set_config(ER_KEY_CONFIG_STATS, "0", NULL) != TEST_PASS)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+int test_comm_freed(int scheme_id, MPI_Comm world, MPI_Comm store, const char* name, const char* file)
+{
+  // sets are free to outlive the comms they were created on
+  MPI_Comm dup_world, dup_store;
+  MPI_Comm_dup(world, &dup_world);
+  MPI_Comm_dup(store, &dup_store);
+
+  int set_id = ER_Create(dup_world, dup_store, name, ER_DIRECTION_ENCODE, scheme_id);
+  if(set_id == -1)
+      return TEST_FAIL;
+
+  MPI_Comm_free(&dup_store);
+  MPI_Comm_free(&dup_world);
+
+  if(ER_Add(set_id, file) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Dispatch(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Wait(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+  if(ER_Free(set_id) == ER_FAILURE)
+      return TEST_FAIL;
+
+  if(test_rebuild_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+  if(test_remove_no_failure(world, store, name) != TEST_PASS)
+      return TEST_FAIL;
+
+  return TEST_PASS;
+}
+
+int test_dispatch_all(int scheme_id, MPI_Comm world, MPI_Comm store, int numsets, const char** names, int numfiles, const char** filelist)
+{
+  int i, j;
+  int set_ids[8];
+  int directions[3] = { ER_DIRECTION_ENCODE, ER_DIRECTION_REBUILD, ER_DIRECTION_REMOVE };
+
+  // encode, rebuild, and remove several sets at once
+  int d;
+  for (d = 0; d < 3; d++) {
+    for (i = 0; i < numsets; i++) {
+      set_ids[i] = ER_Create(world, store, names[i], directions[d], scheme_id);
+      if (set_ids[i] == -1)
+        return TEST_FAIL;
+      if (directions[d] == ER_DIRECTION_ENCODE) {
+        for (j = 0; j < numfiles; j++) {
+          if (ER_Add(set_ids[i], filelist[j]) == ER_FAILURE)
+            return TEST_FAIL;
+        }
+      }
+    }
+
+    if (ER_Dispatch_all(numsets, set_ids) == ER_FAILURE)
+      return TEST_FAIL;
+
+    // a dispatched set can't be dispatched again
+    if (ER_Dispatch_all(1, set_ids) != ER_FAILURE)
+      return TEST_FAIL;
+
+    for (i = 0; i < numsets; i++) {
+      if (ER_Wait(set_ids[i]) == ER_FAILURE)
+        return TEST_FAIL;
+      if (ER_Free(set_ids[i]) == ER_FAILURE)
+        return TEST_FAIL;
+    }
+  }
+  return TEST_PASS;
+}
+
+int test_trace(const char* prefix)
+{
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  char file[256];
+  sprintf(file, "%s.%d.json", prefix, rank);
+  FILE* fp = fopen(file, "r");
+
+#ifdef ER_TRACE
+  // ER_Finalize wrote the phases of the operations we dispatched
+  if(fp == NULL){
+    printf ("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Trace file %s was not written\n", file);
+    return TEST_FAIL;
+  }
+  char line[1024];
+  int phases = 0;
+  while(fgets(line, sizeof(line), fp) != NULL){
+    if(strstr(line, "\"cat\":\"PHASE\"") != NULL)
+      phases++;
+  }
+  fclose(fp);
+  unlink(file);
+  if(phases == 0){
+    printf ("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Trace file %s has no phases\n", file);
+    return TEST_FAIL;
+  }
+#else
+  // trace points are not compiled in, so nothing is written
+  if(fp != NULL){
+    fclose(fp);
+    unlink(file);
+    printf ("Error in line %d, file %s, function %s.\n", __LINE__, __FILE__, __func__);
+    printf("Trace file %s was written without ER_TRACE\n", file);
+    return TEST_FAIL;
+  }
+#endif
+
+  return TEST_PASS;
+}
+
+int main (int argc, char* argv[])
+{
+  int rc = TEST_PASS;
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+
+  int rank, ranks;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+  char buf[256];
+  sprintf(buf, "data from rank %d\n", rank);
+
+  char filename[256];
+  sprintf(filename, "/dev/shm/testfile_%d.out", rank);
+  int fd = open(filename, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
+  if (fd != -1) {
+    write(fd, buf, strlen(buf));
+    close(fd);
+  } else {
+    printf("Error opening file %s: %d %s\n", filename, errno, strerror(errno));
+    rc = TEST_FAIL;
+  }
+
+  char hostname[ER_HOSTNAME + 1];
+  gethostname(hostname, sizeof(hostname));
+
+  /* create communicator of all procs on the same host */
+  MPI_Comm comm_host;
+  rankstr_mpi_comm_split(MPI_COMM_WORLD, hostname, 0, 0, 1, &comm_host);
+
+  char rankstr[256];
+  sprintf(rankstr, "%d", rank);
+
+  const char* filelist[1] = { filename };
+
+  ER_Init(NULL);
+
+  // record trace events of everything below, if they are compiled in
+  char traceprefix[256];
+  sprintf(traceprefix, "/dev/shm/testtrace");
+  if(set_config(ER_KEY_CONFIG_TRACE_FILE, traceprefix, NULL) != TEST_PASS)
+    rc = TEST_FAIL;
+
+  const char* dsetname = new_dsetname();
+
+  int scheme_id = ER_Create_Scheme(MPI_COMM_WORLD, hostname, ranks, ranks);
+
+  // encode files using redundancy scheme
+  if(test_encode(scheme_id, MPI_COMM_WORLD, comm_host, dsetname, 1, filelist) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // rebuild encoded files (and redundancy data)
+  if(test_rebuild_no_failure(MPI_COMM_WORLD, comm_host, dsetname) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // delete redundancy data added during ENCODE
+  if(test_remove_no_failure(MPI_COMM_WORLD, comm_host, dsetname) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // encode, rebuild, and remove multiple sets in a single dispatch
+  const char* dsetnames[2] = { new_dsetname(), new_dsetname() };
+  if(test_dispatch_all(scheme_id, MPI_COMM_WORLD, comm_host, 2, dsetnames, 1, filelist) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // rebuild a file that was damaged after it was encoded
+  if(test_rebuild_corrupt(scheme_id, MPI_COMM_WORLD, comm_host, new_dsetname(), filename, buf) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // reuse redundancy data of a predecessor when files did not change
+  const char* incnames[3] = { new_dsetname(), new_dsetname(), new_dsetname() };
+  char incfile[256];
+  sprintf(incfile, "/dev/shm/testinc_%d.out", rank);
+  int incfd = open(incfile, O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
+  if (incfd != -1) {
+    write(incfd, buf, strlen(buf));
+    close(incfd);
+  }
+  if(test_encode_incremental(scheme_id, MPI_COMM_WORLD, comm_host, incnames, incfile) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+  unlink(incfile);
+
+  // skip migrate and recover when nothing was lost
+  if(test_rebuild_fast(scheme_id, MPI_COMM_WORLD, comm_host, new_dsetname(), filename) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // wait on a single file while the rest of the set is rebuilt
+  if(test_rebuild_lazy(scheme_id, MPI_COMM_WORLD, comm_host, new_dsetname(), filename) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // newer encodes of a set win over older state
+  if(test_state_epoch(scheme_id, MPI_COMM_WORLD, comm_host, new_dsetname(), filename) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // add a list of files in one call
+  if(test_encode_files(scheme_id, MPI_COMM_WORLD, comm_host, new_dsetname(), 1, filelist) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // recover one set while the next one migrates
+  char pipefile0[256], pipefile1[256];
+  sprintf(pipefile0, "/dev/shm/testpipe0_%d.out", rank);
+  sprintf(pipefile1, "/dev/shm/testpipe1_%d.out", rank);
+  const char* pipenames[2] = { new_dsetname(), new_dsetname() };
+  const char* pipefiles[2] = { pipefile0, pipefile1 };
+  int k;
+  for (k = 0; k < 2; k++) {
+    int pipefd = open(pipefiles[k], O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
+    if (pipefd != -1) {
+      write(pipefd, buf, strlen(buf));
+      close(pipefd);
+    }
+  }
+  if(test_rebuild_pipeline(scheme_id, MPI_COMM_WORLD, comm_host, pipenames, pipefiles) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+  unlink(pipefile0);
+  unlink(pipefile1);
+
+  // let ER pick the scheme from the failure domain layout
+  if(test_create_scheme_auto(MPI_COMM_WORLD, comm_host, new_dsetname(), filename) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // rebuild with the cheaper of two levels of redundancy
+  if(test_compose_scheme(MPI_COMM_WORLD, comm_host, new_dsetname(), filename) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+#ifdef HAVE_LIBZ
+  // encode compressed copies of files
+  char zipname[256];
+  sprintf(zipname, "/dev/shm/testzip_%d.out", rank);
+  const char* zipnames[2] = { new_dsetname(), new_dsetname() };
+  if(test_encode_compressed(scheme_id, MPI_COMM_WORLD, comm_host, zipnames, zipname) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+  unlink(zipname);
+#endif
+
+  // flush redundancy to a slower tier after the local commit
+  if(test_encode_flush(scheme_id, MPI_COMM_WORLD, comm_host, new_dsetname(), "/dev/shm/flush", filename) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // check an encoded set in place without rebuilding it
+  if(test_verify(scheme_id, MPI_COMM_WORLD, comm_host, new_dsetname(), filename) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // hold a throttled encode in the background
+  if(test_encode_paused(scheme_id, MPI_COMM_WORLD, comm_host, new_dsetname(), filename) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // rebuild only the files a restart reads
+  char partfile0[256], partfile1[256];
+  sprintf(partfile0, "/dev/shm/testpart0_%d.out", rank);
+  sprintf(partfile1, "/dev/shm/testpart1_%d.out", rank);
+  const char* partfiles[2] = { partfile0, partfile1 };
+  for (k = 0; k < 2; k++) {
+    int partfd = open(partfiles[k], O_WRONLY | O_TRUNC | O_CREAT, S_IRUSR | S_IWUSR);
+    if (partfd != -1) {
+      write(partfd, buf, strlen(buf));
+      close(partfd);
+    }
+  }
+  if(test_rebuild_partial(scheme_id, MPI_COMM_WORLD, comm_host, new_dsetname(), partfiles) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+  unlink(partfile0);
+  unlink(partfile1);
+
+  // encode a set whose comms were freed before it was dispatched
+  if(test_comm_freed(scheme_id, MPI_COMM_WORLD, comm_host, new_dsetname(), filename) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // encode a checkpoint as the delta against its predecessor
+  char genfile0[256], genfile1[256];
+  sprintf(genfile0, "/dev/shm/testgen0_%d.out", rank);
+  sprintf(genfile1, "/dev/shm/testgen1_%d.out", rank);
+  const char* gennames[2] = { new_dsetname(), new_dsetname() };
+  const char* genfiles[2] = { genfile0, genfile1 };
+  if(test_encode_delta(scheme_id, MPI_COMM_WORLD, comm_host, gennames, genfiles) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // the same with files read through memory maps
+  const char* mmapnames[4] = { new_dsetname(), new_dsetname(), new_dsetname(), new_dsetname() };
+  if(test_mmap(scheme_id, MPI_COMM_WORLD, comm_host, mmapnames, filename, buf, genfiles) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+  unlink(genfile0);
+  unlink(genfile1);
+
+  // encode a file straight from memory
+  char bufname[256];
+  sprintf(bufname, "/dev/shm/testbuf_%d.out", rank);
+  if(test_encode_buffer(scheme_id, MPI_COMM_WORLD, comm_host, new_dsetname(), bufname) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // collect per-phase stats of an encode
+  if(test_stats(scheme_id, MPI_COMM_WORLD, comm_host, new_dsetname(), 1, filelist) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // encode files using redundancy scheme
+  if(test_encode_poll(scheme_id, MPI_COMM_WORLD, comm_host, dsetname, 1, filelist) !=TEST_PASS){
+    rc = TEST_FAIL;
+  }
+
+  // rebuild encoded files (and redundancy data)
+  if(test_rebuild_one_failure_reverse(MPI_COMM_WORLD, comm_host, dsetname, 1, filelist) !=TEST_PASS){
+    rc = TEST_FAIL;
+  } 
+
+  ER_Free_Scheme(scheme_id);
+
+  ER_Finalize();
+
+  if(test_trace(traceprefix) != TEST_PASS){
+    rc = TEST_FAIL;
+  }
 
   unlink(filename);
   